@@ -0,0 +1,422 @@
+/*
+ * vim: set smartindent autoindent expandtab tabstop=4 shiftwidth=4:
+ */
+
+// Interface
+#include "BlobStore.hpp"
+
+// verbatim
+#include "utility/Exception.hpp"
+
+// libstdc++
+#include <algorithm>
+
+// libc
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using std::string;
+using std::lock_guard;
+using std::make_pair;
+
+namespace {
+
+/*
+ * The file starts with a header, then each blob follows the last as its
+ * digest, its size and its content, padded to eight bytes. In host byte
+ * order, as the LMDB environment beside it is.
+ */
+static const char MAGIC[4] = {'V', 'B', 'L', 'B'};
+static const uint32_t VERSION = 2; // Of 128-bit digests
+
+struct Header
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t end; // Of what was made durable, 0 if not recorded (yet)
+};
+
+struct Blob
+{
+    uint64_t low, high, size, reserved; // Digest, then size
+};
+
+inline
+size_t
+padded(size_t size)
+{
+    return (size + 7) & ~size_t(7);
+}
+
+void
+pwrite_all(int fd, const char *data, size_t size, size_t offset,
+           const string &path)
+{
+    while (size > 0) {
+        const ssize_t n = pwrite(fd, data, size, offset);
+
+        if (n == -1 && errno == EINTR)
+            continue;
+
+        if (n == -1)
+            throw verbatim::utility::FileError("BlobStore::put",
+                                               errno,
+                                               "Failed to write %s",
+                                               path.c_str());
+
+        data += n;
+        size -= n;
+        offset += n;
+    }
+}
+
+void
+datasync(int fd, const string &path)
+{
+    if (fdatasync(fd) == -1)
+        throw verbatim::utility::FileError("BlobStore::sync",
+                                           errno,
+                                           "Failed to sync %s",
+                                           path.c_str());
+}
+
+/*
+ * Record in the header where what is durable ends, durably
+ */
+void
+record_end(int fd, uint64_t end, const string &path)
+{
+    pwrite_all(fd, reinterpret_cast<const char*>(&end), sizeof(end),
+               offsetof(Header, end), path);
+    datasync(fd, path);
+}
+
+} // anonymous
+
+namespace verbatim {
+
+BlobStore::BlobStore() :
+    fd(-1),
+    writable(false),
+    end(0),
+    synced(0),
+    duplicates(0),
+    extent(0)
+{
+}
+
+BlobStore::~BlobStore()
+{
+    close();
+}
+
+/*
+ * Throws FileError, or ValueError if the file is not a blob store. Opened
+ * for writing, the file is created if need be and locked until closed,
+ * waiting for any other writer to close it first; opened for reading, one
+ * that does not exist is an empty store and nothing is ever written.
+ */
+void
+BlobStore::open(const string &p, bool w)
+{
+    close();
+
+    fd = ::open(p.c_str(), w ? O_RDWR | O_CREAT | O_CLOEXEC :
+                               O_RDONLY | O_CLOEXEC, 0644);
+    path = p;
+    writable = w;
+
+    if (fd == -1 && !writable && errno == ENOENT)
+        return;
+
+    if (fd == -1)
+        throw utility::FileError("BlobStore::open",
+                                 errno,
+                                 "Failed to open %s",
+                                 path.c_str());
+
+    int r = 0;
+
+    while (writable && (r = flock(fd, LOCK_EX)) == -1 && errno == EINTR)
+        ;
+
+    if (writable && r == -1) {
+        const int error = errno;
+
+        close();
+        throw utility::FileError("BlobStore::open",
+                                 error,
+                                 "Failed to lock %s",
+                                 p.c_str());
+    }
+
+    Header h;
+    const ssize_t n = pread(fd, &h, sizeof(h), 0);
+
+    if (n == 0 && !writable)
+        return;
+
+    if (n == 0) {
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, MAGIC, sizeof(MAGIC));
+        h.version = VERSION;
+        h.end = sizeof(h);
+        pwrite_all(fd, reinterpret_cast<const char*>(&h), sizeof(h), 0, path);
+    } else if (n != sizeof(h) ||
+               memcmp(h.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+               h.version != VERSION) {
+        close();
+        throw utility::ValueError("BlobStore::open",
+                                  0,
+                                  "%s is not a blob store of version %u",
+                                  p.c_str(),
+                                  VERSION);
+    }
+
+    recover(h.end);
+}
+
+/*
+ * Appended with the file's own record of what it is, so the digest and
+ * offset need not be durable for the blob to be found again
+ */
+BlobStore::Offset
+BlobStore::put(Digest d, const char *data, size_t size)
+{
+    std::unordered_map<Digest, Offset, Hasher>::const_iterator i(
+        offsets.find(d));
+
+    if (i != offsets.end()) {
+        ++duplicates;
+        return i->second;
+    }
+
+    static const char zeros[8] = {0};
+    const Blob b = {d.low, d.high, size, 0};
+    const Offset o = end + sizeof(b);
+
+    pwrite_all(fd, reinterpret_cast<const char*>(&b), sizeof(b), end, path);
+    pwrite_all(fd, data, size, o, path);
+    pwrite_all(fd, zeros, padded(size) - size, o + size, path);
+
+    end = o + padded(size);
+    offsets[d] = o;
+
+    return o;
+}
+
+BlobStore::Offset
+BlobStore::find(Digest d) const
+{
+    std::unordered_map<Digest, Offset, Hasher>::const_iterator i(
+        offsets.find(d));
+
+    return i != offsets.end() ? i->second : 0;
+}
+
+/*
+ * The blobs, then the header's record of where they end, so it never
+ * counts one that is not durable
+ */
+void
+BlobStore::sync()
+{
+    if (synced == end)
+        return;
+
+    datasync(fd, path);
+    record_end(fd, end, path);
+    synced = end;
+}
+
+/*
+ * False unless a blob of that size starts at the offset given, as one
+ * recorded by a database the file does not belong to would not
+ */
+bool
+BlobStore::get(Offset o, size_t size, boost::string_ref &data) const
+{
+    Digest d;
+    uint64_t n;
+
+    if (!read(o, d, n) || n != size)
+        return false;
+
+    lock_guard<std::mutex> l(lock);
+
+    if (!map(o + size))
+        return false;
+
+    data = boost::string_ref(base() + o, size);
+
+    return true;
+}
+
+bool
+BlobStore::digest(Offset o, Digest &d) const
+{
+    uint64_t size;
+
+    return read(o, d, size);
+}
+
+void
+BlobStore::close()
+{
+    for (size_t i = 0 ; i < mappings.size() ; ++i)
+        munmap(mappings[i].first, mappings[i].second);
+
+    mappings.clear();
+    offsets.clear();
+
+    if (fd != -1)
+        ::close(fd);
+
+    fd = -1;
+    end = synced = extent = 0;
+}
+
+/*
+ * Read rather than mapped, as only the content of a blob is worth mapping
+ */
+bool
+BlobStore::read(Offset o, Digest &d, uint64_t &size) const
+{
+    Blob b;
+
+    if (fd == -1 || o < sizeof(Header) + sizeof(b) || o % 8 != 0 ||
+        pread(fd, &b, sizeof(b), o - sizeof(b)) != ssize_t(sizeof(b)) ||
+        b.size > SIZE_MAX - o)
+        return false;
+
+    lock_guard<std::mutex> l(lock);
+
+    if (!within(o + b.size))
+        return false;
+
+    d = Digest(b.low, b.high);
+    size = b.size;
+
+    return true;
+}
+
+/*
+ * True if the file is as large as the size given, at least. Looked at
+ * again only when it was smaller, as it only ever grows while open.
+ */
+bool
+BlobStore::within(size_t size) const
+{
+    if (size <= extent)
+        return true;
+
+    struct stat info;
+
+    if (fd == -1 || fstat(fd, &info) == -1)
+        return false;
+
+    extent = info.st_size;
+
+    return size <= extent;
+}
+
+/*
+ * True if the file is mapped up to the given size, at least. Mapped past
+ * its end when the mapping is doubled, which is harmless as no more of it
+ * is ever read than the file holds.
+ */
+bool
+BlobStore::map(size_t size) const
+{
+    if (!within(size))
+        return false;
+
+    if (!mappings.empty() && size <= mappings.back().second)
+        return true;
+
+    const size_t length = mappings.empty() ?
+                          extent :
+                          std::max(extent, 2 * mappings.back().second);
+    void *m = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+
+    if (m == MAP_FAILED)
+        throw utility::FileError("BlobStore::get",
+                                 errno,
+                                 "Failed to map %s",
+                                 path.c_str());
+
+    mappings.push_back(make_pair(m, length));
+
+    return true;
+}
+
+/*
+ * Only the headers of the blobs are read, up to where the header records
+ * they were made durable; past it another writer may be appending, or was
+ * when it crashed. What lies beyond a writer drops, as nothing recorded
+ * refers to it, and a reader leaves be. Without that record, of a file
+ * written before there was one or cut short since, the content of each
+ * blob is checked against its digest instead, as one torn or never synced
+ * could otherwise be taken for whole.
+ */
+void
+BlobStore::recover(size_t durable)
+{
+    struct stat info;
+
+    if (fstat(fd, &info) == -1)
+        throw utility::FileError("BlobStore::open",
+                                 errno,
+                                 "Failed to stat %s",
+                                 path.c_str());
+
+    const bool check = durable == 0 || durable > size_t(info.st_size);
+    const size_t size = check ? info.st_size : durable;
+    size_t at = sizeof(Header);
+    Blob b;
+
+    while (at + sizeof(b) <= size) {
+        if (pread(fd, &b, sizeof(b), at) != ssize_t(sizeof(b)) ||
+            b.size > size - at - sizeof(b) ||
+            padded(b.size) > size - at - sizeof(b))
+            break;
+
+        const Offset o = at + sizeof(b);
+
+        if (check &&
+            (!map(o + b.size) ||
+             utility::Hash128::of(base() + o, b.size) !=
+             Digest(b.low, b.high)))
+            break;
+
+        offsets[Digest(b.low, b.high)] = o;
+        at = o + padded(b.size);
+    }
+
+    if (writable && at != size_t(info.st_size) && ftruncate(fd, at) == -1)
+        throw utility::FileError("BlobStore::open",
+                                 errno,
+                                 "Failed to truncate %s",
+                                 path.c_str());
+
+    if (writable)
+        extent = std::min(extent, at);
+
+    /*
+     * Checked once, the blobs are recorded as durable once they are
+     */
+    if (writable && at != durable) {
+        datasync(fd, path);
+        record_end(fd, at, path);
+    }
+
+    end = synced = at;
+}
+
+} // verbatim
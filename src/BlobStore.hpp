@@ -0,0 +1,101 @@
+/*
+ * vim: set smartindent autoindent expandtab tabstop=4 shiftwidth=4:
+ */
+
+#ifndef VERBATIM_BLOB_STORE_HPP
+#define VERBATIM_BLOB_STORE_HPP
+
+// verbatim
+#include "utility/Hash.hpp"
+
+// boost
+#include <boost/utility/string_ref.hpp>
+
+// libstdc++
+#include <mutex>
+#include <string>
+#include <vector>
+#include <utility>
+#include <unordered_map>
+
+// libc
+#include <stdint.h>
+#include <stddef.h>
+
+namespace verbatim {
+
+/*
+ * An append-only file of blobs, each stored once under the digest of its
+ * content, for what is too large to belong in the B-tree (pictures). Each
+ * blob is preceded by its digest and size, so the file alone is enough to
+ * know what it holds; whoever puts a blob records where it went, and reads
+ * are straight from a shared mapping of the file.
+ *
+ * One writer at a time, held to it by a lock on the file, and any number of
+ * readers, in this process or others. The header records how much of the
+ * file sync() made durable, all a reader or the next writer trusts. Blobs
+ * no longer referred to are left where they are.
+ */
+class BlobStore
+{
+    public:
+        /* Type definitions */
+        typedef utility::Hash128::Digest Digest;
+        typedef uint64_t Offset; // Of the content of a blob, never 0
+
+        /* Member functions/methods */
+        BlobStore();
+        ~BlobStore();
+
+        void open(const std::string &path, bool writable = true);
+        Offset put(Digest d, const char *data, size_t size); // Unless stored
+        Offset find(Digest d) const; // 0 if not stored
+        void sync(); // Before recording the offsets of what was put
+        bool get(Offset o, size_t size, boost::string_ref &data) const;
+        bool digest(Offset o, Digest &d) const; // Of the blob at the offset
+
+        inline size_t size() const { return end; } // Of the file, in bytes
+        inline size_t blobs() const { return offsets.size(); }
+        inline size_t reused() const { return duplicates; } // Not put again
+    private:
+        /* Type definitions */
+        struct Hasher
+        {
+            inline size_t operator() (const Digest &d) const { return d.low; }
+        };
+
+        /* Member functions/methods */
+        BlobStore(const BlobStore&); // Not copyable
+        BlobStore& operator= (const BlobStore&);
+
+        void close();
+        void recover(size_t durable); // Index what the file holds
+        bool read(Offset o, Digest &d, uint64_t &size) const; // Header
+        bool within(size_t size) const; // Of the file, as far as seen
+        bool map(size_t size) const;
+        inline const char* base() const
+        {
+            return static_cast<const char*>(mappings.back().first);
+        }
+
+        /* Member variables/attributes */
+        int fd;
+        bool writable;
+        std::string path;
+        size_t end, synced; // Bytes of the file, and of them made durable
+        size_t duplicates;
+        std::unordered_map<Digest, Offset, Hasher> offsets;
+
+        /*
+         * Mappings of the file, each at least twice as large as the last
+         * so there are only ever a few; older ones are kept until closed
+         * as readers may still refer into them
+         */
+        mutable std::mutex lock;
+        mutable size_t extent; // Of the file, when last looked at
+        mutable std::vector<std::pair<void*, size_t> > mappings;
+};
+
+} // verbatim
+
+#endif // VERBATIM_BLOB_STORE_HPP
@@ -9,9 +9,12 @@ using std::ostream;
 
 namespace verbatim {
 
-Context::Context(size_t concurrency) : threads(NULL), tv(NULL), db(NULL)
+Context::Context(size_t concurrency, size_t walkers, size_t batch_size) :
+    threads(NULL),
+    tv(NULL),
+    db(NULL)
 {
-    tv = new Traverse();
+    tv = new Traverse(walkers, batch_size);
     threads = new utility::ThreadPool(concurrency);
     db = new Database(*tv, *threads);
 }
@@ -29,8 +32,19 @@ Context::~Context()
 void
 Context::wait()
 {
+    if (db)
+        db->flush();
+
     threads->wait();
 
+    if (db)
+        db->drain(); // Committing what the workers left to the writer
+
+    if (db && db->link()) { // Once all of the files have been maintained
+        threads->wait();
+        db->drain(); // The checkpoints of the aliases' directories
+    }
+
     if (db)
         db->aggregate_metrics();
 }
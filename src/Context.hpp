@@ -22,7 +22,7 @@ class Context
 {
     public:
         /* Methods/Member functions */
-        Context(size_t concurrency);
+        Context(size_t concurrency, size_t walkers = 1, size_t batch_size = 256);
         ~Context();
 
         void wait();
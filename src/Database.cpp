@@ -7,29 +7,46 @@
 
 // verbatim
 #include "Tag.hpp"
+#include "Format.hpp"
+#include "Record.hpp"
+#include "Metadata.hpp"
+#include "Picture.hpp"
+#include "SuffixArray.hpp"
 #include "utility/Hash.hpp"
+#include "utility/Ring.hpp"
+#include "utility/Text.hpp"
 #include "utility/Exception.hpp"
 
 // Taglib
 #include <taglib/tag.h>
 #include <taglib/mpegfile.h>
+#include <taglib/mpegproperties.h>
 #include <taglib/id3v2tag.h>
+#include <taglib/tbytevector.h>
+#include <taglib/tfilestream.h>
+#include <taglib/id3v2framefactory.h>
 #include <taglib/attachedpictureframe.h>
 
-// boost serialization
-#include <boost/serialization/set.hpp>
-#include <boost/archive/binary_iarchive.hpp>
-#include <boost/archive/binary_oarchive.hpp>
-
 // libstdc++
 #include <set>
+#include <chrono>
+#include <memory>
+#include <iterator>
 #include <vector>
 #include <sstream>
+#include <utility>
+#include <algorithm>
 
 // libc
 #include <math.h>
+#include <fcntl.h>
 #include <assert.h>
+#include <time.h>
+#include <string.h>
 #include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
 
 // STL
 using std::set;
@@ -37,7 +54,7 @@ using std::endl;
 using std::string;
 using std::vector;
 using std::ostream;
-using std::istringstream;
+using std::lock_guard;
 using std::ostringstream;
 
 namespace {
@@ -50,20 +67,173 @@ enum TypeID
 {
     NO_ID = 0,
     TAG_ID = 1,
-    IMG_ID = 2
+    IMG_ID = 2,
+    DIR_ID = 3,
+    SCAN_ID = 4
+};
+
+/*
+ * Named databases of the environment. An entry lives in the table of its
+ * type, keyed by the raw value of its Key, so a scan of one type never
+ * touches another. Links, only ever from a Tag to an Img, are kept apart as
+ * sorted duplicates under either end.
+ */
+enum Table
+{
+    TAGS = 0,
+    IMAGES,
+    DIRS,
+    SCANS,
+    LINKS_TO,   // Tag key -> Img keys
+    LINKS_FROM, // Img key -> Tag keys
+    ARTISTS,    // Normalised artist -> Tag keys
+    ALBUMS,     // Ditto, album
+    GENRES,     // Ditto, genre
+    TITLES,     // Ditto, title
+    TRIGRAMS,   // Trigram -> Index and normalised value of the above
+    PICTURES,   // Fingerprint -> digest of a picture seen before
+    META,       // Name -> what the environment is
+    TABLES
+};
+
+static const char *const TABLE_NAMES[TABLES] = {
+    "tags",
+    "images",
+    "dirs",
+    "scans",
+    "links_to",
+    "links_from",
+    "artists",
+    "albums",
+    "genres",
+    "titles",
+    "trigrams",
+    "pictures",
+    "meta"
+};
+
+/*
+ * Keys (and the duplicates of the link tables) are size_t in host order,
+ * which MDB_INTEGERKEY compares as the integers they are rather than byte by
+ * byte. LMDB files are specific to the byte order of the host regardless.
+ */
+static const unsigned int TABLE_FLAGS[TABLES] = {
+    MDB_CREATE | MDB_INTEGERKEY,
+    MDB_CREATE | MDB_INTEGERKEY,
+    MDB_CREATE | MDB_INTEGERKEY,
+    MDB_CREATE | MDB_INTEGERKEY,
+    MDB_CREATE | MDB_INTEGERKEY | MDB_DUPSORT | MDB_DUPFIXED | MDB_INTEGERDUP,
+    MDB_CREATE | MDB_INTEGERKEY | MDB_DUPSORT | MDB_DUPFIXED | MDB_INTEGERDUP,
+    MDB_CREATE | MDB_DUPSORT | MDB_DUPFIXED | MDB_INTEGERDUP,
+    MDB_CREATE | MDB_DUPSORT | MDB_DUPFIXED | MDB_INTEGERDUP,
+    MDB_CREATE | MDB_DUPSORT | MDB_DUPFIXED | MDB_INTEGERDUP,
+    MDB_CREATE | MDB_DUPSORT | MDB_DUPFIXED | MDB_INTEGERDUP,
+    MDB_CREATE | MDB_DUPSORT,
+    MDB_CREATE,
+    MDB_CREATE
+};
+
+/*
+ * The secondary indexes, in the order of Database::Index, and the search
+ * key of a Tag each indexes
+ */
+struct Secondary
+{
+    Table table;
+    verbatim::TagField field;
+    string verbatim::Tag::*member;
+};
+
+static const size_t INDEXES = 4;
+
+static const Secondary SECONDARIES[INDEXES] = {
+    {ARTISTS, verbatim::TAG_ARTIST_KEY, &verbatim::Tag::artist_key},
+    {ALBUMS, verbatim::TAG_ALBUM_KEY, &verbatim::Tag::album_key},
+    {GENRES, verbatim::TAG_GENRE_KEY, &verbatim::Tag::genre_key},
+    {TITLES, verbatim::TAG_TITLE_KEY, &verbatim::Tag::title_key}
 };
 
+/*
+ * Longest key LMDB accepts (MDB_MAXKEYSIZE) as built by default
+ */
+static const size_t MAX_KEY_SIZE = 511;
+
+/*
+ * Values compared in full by a fuzzy search, at most, most trigrams in
+ * common first, however many share one; and edits allowed per byte searched
+ * for, as a fraction
+ */
+static const size_t FUZZY_CANDIDATES = 512;
+static const size_t FUZZY_BYTES_PER_EDIT = 3;
+
+/*
+ * Changes committed by the writer at once, at most, how long it waits for
+ * a group to fill (in ms) and how many changes may be waiting, or how many
+ * bytes they may hold, before the workers are held up
+ */
+static const size_t WRITE_GROUP = 256;
+static const unsigned int WRITE_LATENCY = 100;
+static const size_t WRITE_BACKLOG = WRITE_GROUP * 4;
+static const size_t WRITE_BACKLOG_BYTES = 64 * 1024 * 1024;
+
+/*
+ * Initial size of the map, and what each audio file the traversal finds is
+ * expected to need of it: the Tag, its links and index rows, and the
+ * descriptor of its picture
+ */
+static const size_t MAP_SIZE = 64 * 1024 * 1024;
+static const size_t BYTES_PER_FILE = 8 * 1024;
+
+/*
+ * Reader slots of the environment besides one per worker and walker, which
+ * may each hold a read transaction at once: for the writer, the thread the
+ * scan runs on and for other processes reading the environment meanwhile.
+ * Never fewer than LMDB's default.
+ */
+static const size_t SPARE_READERS = 16;
+static const size_t MIN_READERS = 126;
+
+/*
+ * The substring index of the Tag entries, and the pictures of the Img
+ * entries, in the environment's directory
+ */
+static const char INDEX_FILE[] = "search.sa";
+static const char BLOB_FILE[] = "images.blob";
+
+/*
+ * Format of the environment, as recorded in META. One of an older format
+ * holds text as Latin-1 (before 3), tags without audio properties (before
+ * 4) or without search keys (before 5), and is migrated on opening; one
+ * keyed by another hash (FNV-1, before there was a record of the format)
+ * can only be rebuilt, when asked to.
+ */
+static const char FORMAT_KEY[] = "format";
+static const uint32_t FORMAT = 5;
+static const uint32_t OLDEST_FORMAT = 2; // Migrated rather than rebuilt
+
+/*
+ * The one and only scan state record
+ */
+static const char SCAN_KEY[] = "scan";
+
 /*
  * Free functions private to this module
  */
 
-bool
-copy_img_data(const TagLib::ID3v2::Tag *tag, verbatim::Img &img)
+/*
+ * The picture of the tag, if it has one, in TagLib's buffer; nothing is
+ * copied, ByteVectors share their data
+ */
+void
+picture(const TagLib::ID3v2::Tag *tag,
+        std::shared_ptr<const void> &buffer,
+        boost::string_ref &data,
+        string &mimetype)
 {
     const TagLib::ID3v2::FrameList &frames = tag->frameList("APIC");
 
     if (frames.isEmpty())
-        return false;
+        return;
 
     /*
      * Adds only the first in the list and this assumes
@@ -71,59 +241,75 @@ copy_img_data(const TagLib::ID3v2::Tag *tag, verbatim::Img &img)
      */
     TagLib::ID3v2::AttachedPictureFrame *frame =
         static_cast<TagLib::ID3v2::AttachedPictureFrame*>(frames.front());
+    const std::shared_ptr<const TagLib::ByteVector> picture(
+        std::make_shared<const TagLib::ByteVector>(frame->picture()));
 
-    const TagLib::ByteVector bv(frame->picture());
-
-    if (bv.size() == 0)
-        return false;
-
-    img.data.reserve(bv.size());
-    img.data.insert(img.data.begin(), bv.data(), bv.data() + bv.size());
-
-    img.size = bv.size();
-    img.mimetype = frame->mimeType().to8Bit();
-
-    return true;
+    buffer = picture;
+    data = boost::string_ref(picture->data(), picture->size());
+    mimetype = frame->mimeType().to8Bit(true);
 }
 
-static const std::ios_base::openmode BINARY_STREAM = std::ios_base::in | \
-                                                     std::ios_base::out | \
-                                                     std::ios_base::binary;
-
-template<typename Type>
-Type
-reconstruct(const lmdb::val &serialised_data)
+inline
+double
+seconds(const verbatim::utility::Timer &t)
 {
-    Type value;
-    istringstream stream(BINARY_STREAM);
-    char *buf = const_cast<char*>(serialised_data.data());
-    boost::archive::binary_iarchive ba(stream, boost::archive::no_header);
-
-    stream.rdbuf()->pubsetbuf(buf, serialised_data.size());
-
-    ba >> value;
-    if (stream.fail())
-        throw verbatim::utility::StreamError("reconstruct()",
-                                             errno,
-                                             "Failed to serialise data");
-
-    return value;
+    const verbatim::utility::Timer::Duration d(t.elapsed());
+    return d.seconds + d.nanoseconds / 1000000000.0;
 }
 
-template<typename Type>
-string
-deconstruct(const Type &value)
+/*
+ * A file stream counting the bytes TagLib reads of it
+ */
+class CountingStream : public TagLib::FileStream
 {
-    ostringstream stream(BINARY_STREAM);
-    boost::archive::binary_oarchive ba(stream, boost::archive::no_header);
+    public:
+        CountingStream(const char *path) :
+            TagLib::FileStream(path, true),
+            read(0)
+        {
+        }
+
+        TagLib::ByteVector
+        readBlock(unsigned long length)
+        {
+            const TagLib::ByteVector b(TagLib::FileStream::readBlock(length));
+            read += b.size();
+            return b;
+        }
 
-    ba << value;
-    if (stream.fail())
-        throw verbatim::utility::StreamError("deconstruct()",
-                                             errno,
-                                             "Failed to serialise data");
+        uint64_t read;
+};
 
-    return stream.str();
+/*
+ * Where the data of a file starts on its device: the physical offset of its
+ * first extent, or failing that (no FIEMAP, or nothing allocated yet), the
+ * inode number as most file systems allocate data near their inodes and
+ * inodes in creation order. FIEMAP support is per file system so the keys of
+ * one device are, in practice, all of one kind and comparable.
+ */
+uint64_t
+position(const char *path, const struct stat &info)
+{
+    uint64_t physical = info.st_ino;
+#ifdef FS_IOC_FIEMAP
+    static const size_t size = sizeof(fiemap) + sizeof(fiemap_extent);
+    uint64_t buffer[(size + sizeof(uint64_t) - 1) / sizeof(uint64_t)];
+    fiemap *map = reinterpret_cast<fiemap*>(buffer);
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd == -1)
+        return physical;
+
+    memset(buffer, 0, sizeof(buffer));
+    map->fm_length = FIEMAP_MAX_OFFSET;
+    map->fm_extent_count = 1;
+
+    if (ioctl(fd, FS_IOC_FIEMAP, map) == 0 && map->fm_mapped_extents > 0)
+        physical = map->fm_extents[0].fe_physical;
+
+    close(fd);
+#endif
+    return physical;
 }
 
 } // anonymous
@@ -136,20 +322,18 @@ namespace verbatim {
 struct Key
 {
     /* Type definitions */
-    typedef unsigned long long key_t;
+    typedef size_t key_t;
 
     /* Methods/Member functions */
     Key();
-    explicit Key(const string &s);
-    explicit Key(const TagLib::ID3v2::Tag *tag);
+    explicit Key(const string &s, enum TypeID i = TAG_ID);
 
     operator bool() const;
     bool operator< (const Key &other) const;
     bool operator== (const Key &other) const;
 
-    template<typename Archive>
-    void
-    serialize(Archive &archive, unsigned int /* version */);
+    lmdb::val raw() const; // As stored, the type is implied by the table
+    static Key from(const lmdb::val &raw, enum TypeID i);
 
     /* Attributes/member variables */
     key_t value;
@@ -166,33 +350,10 @@ Key::Key() : value(0), id(NO_ID)
 {
 }
 
-Key::Key(const string &s) : value(0), id(NO_ID)
+Key::Key(const string &s, enum TypeID i) : value(0), id(NO_ID)
 {
     value = hasher(s.c_str(), s.size());
-    id = TAG_ID;
-}
-
-Key::Key(const TagLib::ID3v2::Tag *tag) : value(0), id(NO_ID)
-{
-    const TagLib::ID3v2::FrameList &frames = tag->frameList("APIC");
-
-    if (frames.isEmpty())
-        return;
-
-    /*
-     * Adds only the first in the list and this assumes
-     * it is the album cover, not the back or inside etc.
-     */
-    TagLib::ID3v2::AttachedPictureFrame *frame =
-        static_cast<TagLib::ID3v2::AttachedPictureFrame*>(frames.front());
-
-    const TagLib::ByteVector bv(frame->picture());
-
-    if (bv.size() == 0)
-        return;
-
-    value = hasher(bv.data(), bv.size());
-    id = IMG_ID;
+    id = i;
 }
 
 inline
@@ -215,11 +376,51 @@ Key::operator== (const Key &other) const
     return id == other.id && value == other.value;
 }
 
-template<typename Archive>
-void
-Key::serialize(Archive &archive, unsigned int /* version */)
+namespace {
+
+/*
+ * The entry of a multiply linked file is keyed by its inode rather than by
+ * path so that it is the one entry whichever path the file is reached by
+ */
+Key
+inode_key(const struct stat &info)
+{
+    ostringstream s;
+    s << "inode:" << info.st_dev << ':' << info.st_ino;
+    return Key(s.str());
+}
+
+Key
+file_key(const string &path, const struct stat &info)
+{
+    return info.st_nlink > 1 ? inode_key(info) : Key(path);
+}
+
+} // anonymous
+
+inline
+lmdb::val
+Key::raw() const
+{
+    return lmdb::val(&value, sizeof(value));
+}
+
+Key
+Key::from(const lmdb::val &raw, enum TypeID i)
 {
-    archive & id & value;
+    Key k;
+
+    if (raw.size() != sizeof(k.value))
+        throw utility::ValueError("Key::from",
+                                  0,
+                                  "Key of %zu bytes, expected %zu",
+                                  raw.size(),
+                                  sizeof(k.value));
+
+    memcpy(&k.value, raw.data(), sizeof(k.value)); // Not necessarily aligned
+    k.id = i;
+
+    return k;
 }
 
 ostream&
@@ -235,37 +436,38 @@ class Database::Transaction
 {
     public:
         /* Methods/Member functions */
-        Transaction(const Transaction &tn);
-        Transaction(const Database &db);
+        Transaction(const Database &db, bool read_only = false);
 
         void commit();
-        lmdb::cursor cur();
-        MDB_stat stats() const;
-
-        void del(lmdb::val &key);
-        void put(lmdb::val &key, lmdb::val &val);
-        bool get(lmdb::val &key, lmdb::val &val);
+        lmdb::cursor cur(Table t);
+        MDB_stat stats(Table t) const;
+
+        bool del(Table t, const lmdb::val &key);
+        bool del(Table t, const lmdb::val &key, const lmdb::val &val);
+        bool put(Table t,
+                 const lmdb::val &key,
+                 lmdb::val &val,
+                 unsigned int flags = 0);
+        bool get(Table t, const lmdb::val &key, lmdb::val &val);
+        void drop(Table t); // Its entries, the table itself is kept
     private:
         /* Attributes/member variables */
+        boost::shared_lock<boost::shared_mutex> gate; // Held until aborted
         lmdb::txn txn;
-        lmdb::dbi dbi;
-        const lmdb::env &env;
+        const vector<MDB_dbi> &tables;
 };
 
 /*
  * Transaction (implementation)
  */
-Database::Transaction::Transaction(const Transaction &tn) :
-    txn(lmdb::txn::begin(tn.env)),
-    dbi(lmdb::dbi::open(txn)),
-    env(tn.env)
-{
-}
-
-Database::Transaction::Transaction(const Database &db) :
-    txn(lmdb::txn::begin(db.lmdb_env)),
-    dbi(lmdb::dbi::open(txn)),
-    env(db.lmdb_env)
+/*
+ * Read-only transactions never wait on, nor hold up, the writer. All wait
+ * on the map being grown, which LMDB only allows with none active.
+ */
+Database::Transaction::Transaction(const Database &db, bool read_only) :
+    gate(db.gate),
+    txn(lmdb::txn::begin(db.lmdb_env, NULL, read_only ? MDB_RDONLY : 0)),
+    tables(db.tables)
 {
 }
 
@@ -278,37 +480,56 @@ Database::Transaction::commit()
 
 inline
 lmdb::cursor
-Database::Transaction::cur()
+Database::Transaction::cur(Table t)
 {
-    return lmdb::cursor::open(txn, dbi);
+    return lmdb::cursor::open(txn, tables[t]);
 }
 
 inline
 MDB_stat
-Database::Transaction::stats() const
+Database::Transaction::stats(Table t) const
 {
-    return dbi.stat(txn);
+    MDB_stat stats;
+    lmdb::dbi_stat(txn, tables[t], &stats);
+    return stats;
 }
 
 inline
-void
-Database::Transaction::del(lmdb::val &key)
+bool
+Database::Transaction::del(Table t, const lmdb::val &key)
 {
-    dbi.del(txn, key);
+    return lmdb::dbi_del(txn, tables[t], key);
 }
 
 inline
-void
-Database::Transaction::put(lmdb::val &key, lmdb::val &val)
+bool
+Database::Transaction::del(Table t, const lmdb::val &key, const lmdb::val &val)
+{
+    return lmdb::dbi_del(txn, tables[t], key, val);
+}
+
+inline
+bool
+Database::Transaction::put(Table t,
+                           const lmdb::val &key,
+                           lmdb::val &val,
+                           unsigned int flags)
 {
-    dbi.put(txn, key, val);
+    return lmdb::dbi_put(txn, tables[t], key, val, flags);
 }
 
 inline
 bool
-Database::Transaction::get(lmdb::val &key, lmdb::val &val)
+Database::Transaction::get(Table t, const lmdb::val &key, lmdb::val &val)
+{
+    return lmdb::dbi_get(txn, tables[t], key, val);
+}
+
+inline
+void
+Database::Transaction::drop(Table t)
 {
-    return dbi.get(txn, key, val);
+    lmdb::dbi_drop(txn, tables[t]);
 }
 
 /*
@@ -321,10 +542,6 @@ template<typename Value> struct Database::Entry
     explicit Entry(const Key &k);
     explicit Entry(const Key &k, const Value &v);
 
-    template<typename Archive>
-    void
-    serialize(Archive &archive, unsigned int /* version */);
-
     /* Attributes/member variables */
     Key key;
     Value value;
@@ -363,284 +580,1763 @@ Database::Entry<Value>::Entry(const Key &k, const Value &v) :
 {
 }
 
+/*
+ * Entries to and from their tables: the key as is, the value as a flat
+ * record (see Record.hpp) and the links from the link tables
+ */
+namespace {
+
+template<typename Value> struct Storage;
+
+template<> struct Storage<Tag>
+{
+    static const size_t fields = TAG_FIELDS;
+    static const Table table = TAGS;
+    static const TypeID id = TAG_ID;
+};
+
+template<> struct Storage<Img>
+{
+    static const size_t fields = IMG_FIELDS;
+    static const Table table = IMAGES;
+    static const TypeID id = IMG_ID;
+};
+
+template<> struct Storage<Dir>
+{
+    static const size_t fields = DIR_FIELDS;
+    static const Table table = DIRS;
+    static const TypeID id = DIR_ID;
+};
+
+template<> struct Storage<Scan>
+{
+    static const size_t fields = SCAN_FIELDS;
+    static const Table table = SCANS;
+    static const TypeID id = SCAN_ID;
+};
+
+template<typename Value>
+string
+flatten(const Value &v)
+{
+    RecordWriter w(Storage<Value>::fields);
+
+    write(w, v);
+
+    return w.release();
+}
+
 template<typename Value>
-template<typename Archive>
+Value
+unflatten(const lmdb::val &flat)
+{
+    Value v;
+
+    read(Record(flat.data(), flat.size()), v);
+
+    return v;
+}
+
+/*
+ * The keys, all of the one type, linked to or from the given one
+ */
 void
-Database::Entry<Value>::serialize(Archive &archive, unsigned int /* version */)
+linked(Database::Transaction &txn,
+       Table t,
+       const Key &k,
+       enum TypeID i,
+       set<Key> &keys)
 {
-    archive & key & value & links_to & links_from;
+    lmdb::cursor cur(txn.cur(t));
+    lmdb::val lmdb_key(k.raw()), lmdb_val;
+
+    keys.clear();
+
+    if (!cur.get(lmdb_key, lmdb_val, MDB_SET))
+        return;
+
+    do
+        keys.insert(keys.end(), Key::from(lmdb_val, i)); // Sorted already
+    while (cur.get(lmdb_key, lmdb_val, MDB_NEXT_DUP));
 }
 
 /*
- * Visitor
+ * Only a Tag links to anything and only an Img is linked from anything
  */
-template<typename Impl> class Database::Visitor
+template<typename Value>
+void
+load(Database::Entry<Value> &e,
+     const lmdb::val &flat,
+     Database::Transaction &txn)
 {
-    public:
-        /* Methods/Member functions */
-        template<typename T>
-        inline
-        void operator() (Database::Entry<T> &e, Database::Transaction &t)
-        {
-            Impl &impl = static_cast<Impl&>(*this);
-            impl(e, t);
-        }
+    e.value = unflatten<Value>(flat);
 
-        template<typename T>
-        inline
-        void operator() (const Database::Entry<T> &e, Database::Transaction &t)
-        {
-            Impl &impl = static_cast<Impl&>(*this);
-            impl(e, t);
-        }
-};
+    if (Storage<Value>::id == TAG_ID)
+        linked(txn, LINKS_TO, e.key, IMG_ID, e.links_to);
+    else if (Storage<Value>::id == IMG_ID)
+        linked(txn, LINKS_FROM, e.key, TAG_ID, e.links_from);
+}
 
 /*
- * Printer (Visitor implementor)
+ * Add or remove the trigram rows of a distinct value of an index. Each row
+ * holds the index then the value, which must fit in a duplicate as a key
+ * does; the odd longer value is left out.
  */
-struct Printer : public Database::Visitor<Printer>
+void
+retrigram(Database::Transaction &txn,
+          size_t index,
+          const string &value,
+          bool add)
 {
-    /* Methods/Member functions */
-    Printer(ostream &s) : stream(s) {}
-    virtual ~Printer() {}
+    if (value.size() >= MAX_KEY_SIZE)
+        return;
 
-    template<typename T>
-    inline
-    void operator() (const Database::Entry<T> &e, Database::Transaction &t)
-    {
-        assert(e.key.id != NO_ID);
-        stream << e.key << '\t' << e.value << endl;
+    const string posting(char(index) + value);
+    vector<string> grams;
 
-        set<Key>::iterator i(e.links_to.begin()), j(e.links_to.end());
-        while (i != j) {
-            stream << "\t" << *i << endl;
-            ++i;
+    utility::trigrams(value, grams);
+
+    for (size_t i = 0 ; i < grams.size() ; ++i) {
+        lmdb::val lmdb_val(posting);
+
+        if (add)
+            txn.put(TRIGRAMS, lmdb::val(grams[i]), lmdb_val, MDB_NODUPDATA);
+        else
+            txn.del(TRIGRAMS, lmdb::val(grams[i]), lmdb_val);
+    }
+}
+
+/*
+ * Move a Tag entry from the index rows of its values before to those of its
+ * values after, each normalised and empty if not indexed. Trigrams are of
+ * distinct values, so only touched as the first entry of a value comes or
+ * the last goes.
+ */
+void
+reindex(Database::Transaction &txn,
+        const Key &k,
+        const string (&before)[INDEXES],
+        const string (&after)[INDEXES])
+{
+    for (size_t i = 0 ; i < INDEXES ; ++i) {
+        const Table t = SECONDARIES[i].table;
+        lmdb::val lmdb_val;
+
+        if (before[i] == after[i])
+            continue;
+
+        if (!before[i].empty()) {
+            txn.del(t, lmdb::val(before[i]), k.raw());
+
+            if (!txn.get(t, lmdb::val(before[i]), lmdb_val))
+                retrigram(txn, i, before[i], false);
         }
 
-        if (e.links_to.size() > 0)
-            stream << endl;
+        if (!after[i].empty()) {
+            const bool first = !txn.get(t, lmdb::val(after[i]), lmdb_val);
 
-        for (i = e.links_from.begin(), j = e.links_from.end() ; i != j ; ++i)
-            stream << "\t" << *i << endl;
+            lmdb_val = k.raw();
+            txn.put(t, lmdb::val(after[i]), lmdb_val, MDB_NODUPDATA);
 
-        if (e.links_from.size() > 0)
-            stream << endl;
+            if (first)
+                retrigram(txn, i, after[i], true);
+        }
     }
-
-    /* Attributes/member variables */
-    ostream &stream;
-};
+}
 
 /*
- * Janitor (Visitor implementor)
+ * A search key as an index holds it: no longer than a key may be, cut
+ * between characters, and without the space that may leave at its end
  */
-struct Database::Janitor : public Database::Visitor<Janitor>
+string
+index_value(boost::string_ref key)
 {
-    /* Methods/Member functions */
-    Janitor(Database &d) : db(d) {}
-    virtual ~Janitor() {}
+    if (key.size() > MAX_KEY_SIZE) {
+        size_t n = MAX_KEY_SIZE;
 
-    void operator()(); // THREAD ENTRY POINT
+        while (n > 0 && (key[n] & 0xC0) == 0x80) // A continuation byte
+            --n;
 
-    template<typename T>
-    void operator() (Database::Entry<T> &e, Database::Transaction &t);
+        key = key.substr(0, n);
 
-    /* Attributes/member variables */
-    Database &db;
-};
+        while (!key.empty() && key.back() == ' ')
+            key.remove_suffix(1);
+    }
 
+    return key.to_string();
+}
+
+/*
+ * The values a Tag record is indexed by, of its search keys
+ */
 void
-Database::Janitor::operator()() // THREAD ENTRY POINT
+indexed(const TagRecord &r, string (&values)[INDEXES])
 {
-    db.visit<Janitor>(*this);
+    for (size_t i = 0 ; i < INDEXES ; ++i)
+        values[i] = index_value(r.field(SECONDARIES[i].field));
 }
 
-template<>
+/*
+ * Within the transaction writing or removing the entry, as it is about to
+ * be, so the indexes never disagree with the entries; compared against the
+ * entry as recorded so only values that changed are touched
+ */
+template<typename Value>
 inline
 void
-Database::Janitor::operator()<Img> (Database::Entry<Img> &e,
-                                    Database::Transaction &t)
+reindex(const Database::Entry<Value> &e, Database::Transaction &txn)
 {
+    // Only Tag entries are indexed
 }
 
-template<>
-inline
+void
+reindex(const Database::Entry<Tag> &e, Database::Transaction &txn)
+{
+    string before[INDEXES], after[INDEXES];
+    lmdb::val lmdb_val;
+
+    if (txn.get(TAGS, e.key.raw(), lmdb_val))
+        indexed(TagRecord(lmdb_val.data(), lmdb_val.size()), before);
+
+    if (!e.removed) {
+        for (size_t i = 0 ; i < INDEXES ; ++i)
+            after[i] = index_value(e.value.*SECONDARIES[i].member);
+    }
+
+    reindex(txn, e.key, before, after);
+}
+
+/*
+ * The key of the Tag entry a path is the filename or an alias of, where it
+ * is not keyed by that path: the entry of a multiply linked file, keyed by
+ * an inode that can no longer be found once the path is gone. Every entry
+ * is looked at, in place; only paths of such files come to this.
+ */
+bool
+owner(Database::Transaction &txn, const string &path, Key &k)
+{
+    lmdb::cursor cur(txn.cur(TAGS));
+    lmdb::val lmdb_key, lmdb_val;
+
+    while (cur.get(lmdb_key, lmdb_val, MDB_NEXT)) {
+        const TagRecord r(lmdb_val.data(), lmdb_val.size());
+        Record::List aliases(r.aliases());
+        boost::string_ref alias;
+        bool found = r.filename() == path;
+
+        while (!found && aliases.next(alias))
+            found = alias == path;
+
+        if (found) {
+            k = Key::from(lmdb_key, TAG_ID);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * The search keys of a Tag, once per file by the thread that parsed it,
+ * for the indexes and searches to take as they are
+ */
+void
+search_keys(Tag &t)
+{
+    t.artist_key = utility::normalise(t.artist);
+    t.album_key = utility::normalise(t.album);
+    t.title_key = utility::normalise(t.title);
+    t.genre_key = utility::normalise(t.genre);
+}
+
+/*
+ * Bring the entries of an older format up to this one, in place: each Tag
+ * is given search keys, of the text it holds, and the indexes emptied to be
+ * rebuilt of them. Tags parsed as Latin-1 or without audio properties are
+ * also marked as never parsed, and the directories as never scanned, so
+ * the next scan parses every file again, incremental or not.
+ */
+void
+migrate(Database::Transaction &txn, uint32_t format)
+{
+    lmdb::cursor cur(txn.cur(TAGS));
+    lmdb::val lmdb_key, lmdb_val;
+
+    while (cur.get(lmdb_key, lmdb_val, MDB_NEXT)) {
+        Tag t;
+
+        read(TagRecord(lmdb_val.data(), lmdb_val.size()), t);
+        search_keys(t);
+
+        if (format < 4)
+            t.modified = 0;
+
+        const string val(flatten(t));
+        lmdb::val new_val(val);
+
+        txn.put(TAGS, lmdb_key, new_val);
+    }
+
+    for (size_t i = 0 ; i < INDEXES ; ++i)
+        txn.drop(SECONDARIES[i].table);
+
+    txn.drop(TRIGRAMS);
+
+    if (format < 4) {
+        txn.drop(DIRS);
+        txn.drop(SCANS);
+    }
+}
+
+/*
+ * The format recorded in META, 0 if none is
+ */
+uint32_t
+format_of(MDB_txn *txn, MDB_dbi meta)
+{
+    lmdb::val format_key(FORMAT_KEY), format_val;
+    uint32_t format = 0;
+
+    if (lmdb::dbi_get(txn, meta, format_key, format_val) &&
+        format_val.size() == sizeof(format))
+        memcpy(&format, format_val.data(), sizeof(format));
+
+    return format;
+}
+
+} // anonymous
+
+/*
+ * Visitor
+ */
+template<typename Impl> class Database::Visitor
+{
+    public:
+        /* Methods/Member functions */
+        template<typename T>
+        inline
+        void operator() (Database::Entry<T> &e, Database::Transaction &t)
+        {
+            Impl &impl = static_cast<Impl&>(*this);
+            impl(e, t);
+        }
+
+        template<typename T>
+        inline
+        void operator() (const Database::Entry<T> &e, Database::Transaction &t)
+        {
+            Impl &impl = static_cast<Impl&>(*this);
+            impl(e, t);
+        }
+};
+
+/*
+ * Printer (Visitor implementor)
+ */
+struct Printer : public Database::Visitor<Printer>
+{
+    /* Methods/Member functions */
+    Printer(ostream &s) : stream(s) {}
+    virtual ~Printer() {}
+
+    template<typename T>
+    inline
+    void operator() (const Database::Entry<T> &e, Database::Transaction &t)
+    {
+        assert(e.key.id != NO_ID);
+        stream << e.key << '\t' << e.value << endl;
+
+        set<Key>::iterator i(e.links_to.begin()), j(e.links_to.end());
+        while (i != j) {
+            stream << "\t" << *i << endl;
+            ++i;
+        }
+
+        if (e.links_to.size() > 0)
+            stream << endl;
+
+        for (i = e.links_from.begin(), j = e.links_from.end() ; i != j ; ++i)
+            stream << "\t" << *i << endl;
+
+        if (e.links_from.size() > 0)
+            stream << endl;
+    }
+
+    /* Attributes/member variables */
+    ostream &stream;
+};
+
+/*
+ * Janitor (Visitor implementor)
+ */
+struct Database::Janitor : public Database::Visitor<Janitor>
+{
+    /* Methods/Member functions */
+    Janitor(Database &d) : db(d) {}
+    virtual ~Janitor() {}
+
+    void operator()(); // THREAD ENTRY POINT
+
+    template<typename T>
+    void operator() (Database::Entry<T> &e, Database::Transaction &t);
+
+    /* Attributes/member variables */
+    Database &db;
+};
+
+/*
+ * Images are left alone, each goes with the last Tag linking to it
+ */
+void
+Database::Janitor::operator()() // THREAD ENTRY POINT
+{
+    db.transact([this] (Database::Transaction &txn) {
+        db.visit<Tag>(*this, txn);
+        db.visit<Dir>(*this, txn);
+    });
+}
+
+template<>
+inline
+void
+Database::Janitor::operator()<Dir> (Database::Entry<Dir> &e,
+                                    Database::Transaction &t)
+{
+    assert(e.key.id == DIR_ID);
+
+    if (access(e.value.path.c_str(), F_OK) == 0)
+        return;
+
+    e.removed = 1;
+    db.update(e, t);
+}
+
+template<>
+inline
 void
 Database::Janitor::operator()<Tag> (Database::Entry<Tag> &e,
                                     Database::Transaction &t)
 {
-    assert(e.key.id == TAG_ID);
+    assert(e.key.id == TAG_ID);
+
+    Tag &tag = e.value;
+    const size_t aliases = tag.aliases.size();
+
+    for (set<string>::iterator i = tag.aliases.begin() ;
+         i != tag.aliases.end() ; ) {
+        if (access(i->c_str(), F_OK) == 0)
+            ++i;
+        else
+            tag.aliases.erase(i++);
+    }
+
+    if (access(tag.filename.c_str(), F_OK) == 0) {
+        e.updated = tag.aliases.size() != aliases;
+        db.update(e, t);
+        return;
+    }
+
+    if (!tag.aliases.empty()) {
+        tag.filename = *tag.aliases.begin(); // Still linked elsewhere
+        tag.aliases.erase(tag.aliases.begin());
+        e.updated = 1;
+        db.update(e, t);
+        return;
+    }
+
+    /*
+     * Within the visiting transaction; a second write transaction from
+     * this thread would deadlock on the LMDB writer lock
+     */
+    db.remove(e, t);
+}
+
+/*
+ * Remover (interface)
+ */
+struct Database::Remover
+{
+    /* Methods/Member functions */
+    Remover(Database &d, const string &p);
+
+    void operator()(); // THREAD ENTRY POINT
+
+    /* Attributes/member variables */
+    Database &db;
+    const string path;
+};
+
+/*
+ * Remover (implementation)
+ */
+Database::Remover::Remover(Database &d, const string &p) : db(d), path(p)
+{
+}
+
+void
+Database::Remover::operator()() // THREAD ENTRY POINT
+{
+    db.transact([this] (Database::Transaction &txn) {
+        Key k(path);
+        lmdb::val lmdb_val;
+
+        if (txn.get(TAGS, k.raw(), lmdb_val) || owner(txn, path, k))
+            db.forget(k, path, txn);
+    });
+}
+
+/*
+ * Maintainer (interface)
+ */
+struct Database::Maintainer
+{
+    /* Methods/Member functions */
+    Maintainer(Database &d, const std::shared_ptr<Traverse::Batch> &b);
+
+    void operator()(); // THREAD ENTRY POINT
+    void check(vector<bool> &unchanged);
+    bool maintain(const string &path, const struct stat &info);
+    Metadata::Result native(const string &path, Change &c, Format &format);
+    bool taglib(const string &path, Change &c); // False if there is no tag
+    void identify(Change &c); // The picture, by fingerprint or digest
+
+    /* Attributes/member variables */
+    Database &db;
+    std::shared_ptr<Traverse::Batch> files; // Shared, handlers are copied
+};
+
+/*
+ * Maintainer (implementation)
+ */
+Database::Maintainer::Maintainer(Database &d,
+                                 const std::shared_ptr<Traverse::Batch> &b) :
+    db(d),
+    files(b)
+{
+}
+
+void
+Database::Maintainer::operator()() // THREAD ENTRY POINT
+{
+    vector<bool> unchanged(files->size(), false);
+
+    check(unchanged);
+
+    for (size_t i = 0 ; i < files->size() && !db.stopped ; ++i) {
+        const Traverse::Path p((*files)[i]);
+
+        if (unchanged[i] || !maintain(p.name, *p.info))
+            db.checkpoint(p.name);
+    }
+}
+
+/*
+ * Find which files are recorded, by the path given, as they are now. All
+ * in the one read-only transaction, over before any file is parsed, and
+ * reading the records in place. A rescan of an unchanged library thus
+ * neither has TagLib open the files nor waits on the LMDB writer lock.
+ */
+void
+Database::Maintainer::check(vector<bool> &unchanged)
+{
+    Database::Transaction txn(db, true);
+    Metrics &m = db.local();
+
+    for (size_t i = 0 ; i < files->size() && !db.stopped ; ++i) {
+        const Traverse::Path p((*files)[i]);
+        const Key tag_key(file_key(p.name, *p.info));
+        lmdb::val lmdb_val;
+
+        ++m.lookups;
+
+        if (!txn.get(TAGS, tag_key.raw(), lmdb_val))
+            continue;
+
+        const TagRecord r(lmdb_val.data(), lmdb_val.size());
+
+        if (r.modified() < p.info->st_mtime)
+            continue;
+
+        bool known = r.filename() == p.name;
+        Record::List aliases(r.aliases());
+        boost::string_ref alias;
+
+        while (!known && aliases.next(alias))
+            known = alias == p.name;
+
+        unchanged[i] = known;
+        m.unchanged += known;
+    }
+}
+
+/*
+ * Parse the file and hand what was found to the writer, which checkpoints
+ * it once committed. False if there was nothing to hand over.
+ */
+bool
+Database::Maintainer::maintain(const string &path, const struct stat &info)
+{
+    Change c;
+    bool found;
+
+    ++db.local().parsed;
+
+    if (db.taglib_only && sniff(path.c_str()) == MPEG_FORMAT) {
+        found = taglib(path, c);
+    } else {
+        Format format = UNKNOWN_FORMAT;
+
+        switch (native(path, c, format)) {
+            case Metadata::READ:
+                found = true;
+                break;
+            case Metadata::ABSENT:
+                found = false;
+                break;
+            case Metadata::NOT_AUDIO:
+                ++db.skipped; // As if it had not looked like audio
+                found = false;
+                break;
+            default:
+                found = format == MPEG_FORMAT && taglib(path, c);
+        }
+    }
+
+    if (!found)
+        return false;
+
+    c.path = path;
+    c.info = info;
+    c.tag.modified = info.st_mtime;
+    search_keys(c.tag);
+
+    if (!c.picture.empty()) {
+        c.img.size = c.picture.size();
+        identify(c);
+    } else {
+        c.buffer.reset();
+    }
+
+    db.write(c);
+
+    return true;
+}
+
+/*
+ * The tags and the headers of the audio alone are read, by the reader of the
+ * file's format, none of the audio itself. ID3v2 tags it cannot read,
+ * malformed or using what it does not support, are left to TagLib; there is
+ * no other reader of other formats.
+ */
+Metadata::Result
+Database::Maintainer::native(const string &path, Change &c, Format &format)
+{
+    Reads &reads = db.local().native;
+    utility::Timer t;
+    Metadata m;
+
+    t.start();
+
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (fd == -1)
+        return Metadata::ABSENT;
+
+    const Metadata::Result r = read_metadata(fd, m);
+
+    close(fd);
+    t.stop();
+
+    ++reads.files;
+    reads.bytes += m.read;
+    reads.seconds += seconds(t);
+    format = m.format;
+
+    if (r != Metadata::READ)
+        return r;
+
+    c.tag.genre = m.genre;
+    c.tag.album = m.album;
+    c.tag.title = m.title;
+    c.tag.artist = m.artist;
+    c.tag.duration = m.duration;
+    c.tag.bitrate = m.bitrate;
+    c.tag.sample_rate = m.sample_rate;
+    c.tag.channels = m.channels;
+    c.img.mimetype = m.mimetype;
+    c.buffer = m.buffer;
+    c.picture = m.picture;
+
+    return r;
+}
+
+/*
+ * Fast, TagLib reads no more of the audio than the first frame and its Xing
+ * or VBRI header either
+ */
+bool
+Database::Maintainer::taglib(const string &path, Change &c)
+{
+    Reads &reads = db.local().taglib;
+    utility::Timer t;
+
+    t.start();
+
+    CountingStream stream(path.c_str());
+    TagLib::MPEG::File f(&stream,
+                         TagLib::ID3v2::FrameFactory::instance(),
+                         true,
+                         TagLib::AudioProperties::Fast);
+    const bool found = f.isValid() && f.hasID3v2Tag();
+
+    if (found) {
+        const TagLib::ID3v2::Tag *tags = f.ID3v2Tag();
+        const TagLib::MPEG::Properties *audio = f.audioProperties();
+
+        if (audio) {
+            c.tag.duration = audio->lengthInMilliseconds();
+            c.tag.bitrate = audio->bitrate();
+            c.tag.sample_rate = audio->sampleRate();
+            c.tag.channels = audio->channels();
+        }
+
+        c.tag.genre = tags->genre().to8Bit(true);
+        c.tag.album = tags->album().to8Bit(true);
+        c.tag.title = tags->title().to8Bit(true);
+        c.tag.artist = tags->artist().to8Bit(true);
+        picture(tags, c.buffer, c.picture, c.img.mimetype);
+    }
+
+    t.stop();
+
+    ++reads.files;
+    reads.bytes += stream.read;
+    reads.seconds += seconds(t);
+
+    return found;
+}
+
+/*
+ * A picture seen before, as most are (an album's tracks share theirs), is
+ * recognised by its fingerprint and not held on to. It is hashed all the
+ * same, in one pass over the parser's buffer, as another picture may share
+ * the fingerprint; one that does is left to the writer as any new one is,
+ * and the fingerprint left to the picture first recorded under it.
+ */
+void
+Database::Maintainer::identify(Change &c)
+{
+    const char *data = c.picture.data();
+    const size_t size = c.picture.size();
+    utility::Hash128::Digest stored;
+    bool known;
+
+    c.fingerprint = fingerprint(data, size);
+
+    {
+        Transaction txn(db, true);
+        lmdb::val lmdb_key(&c.fingerprint, sizeof(c.fingerprint)), lmdb_val;
+
+        known = txn.get(PICTURES, lmdb_key, lmdb_val) &&
+                lmdb_val.size() == sizeof(stored);
+
+        if (known)
+            memcpy(&stored, lmdb_val.data(), sizeof(stored));
+    }
+
+    if (known && recognise(data, size, stored, c.image)) {
+        ++db.local().recognised;
+
+        /*
+         * Stored already, as a fingerprint is recorded only once its
+         * picture is, the writer has no use for it
+         */
+        c.buffer.reset();
+        c.picture = boost::string_ref();
+
+        return;
+    }
+
+    if (!known)
+        c.image = utility::Hash128::of(data, size);
+
+    c.hashed = !known;
+    ++db.local().hashed;
+}
+
+/*
+ * Writer (interface)
+ */
+struct Database::Writer
+{
+    /* Methods/Member functions */
+    Writer(Database &d);
+
+    void operator()(); // THREAD ENTRY POINT
+    void commit(vector<Change> &group, vector<Dir> &dirs);
+    void record(const Change &c, Database::Transaction &txn);
+
+    /* Attributes/member variables */
+    Database &db;
+};
+
+/*
+ * Writer (implementation)
+ */
+Database::Writer::Writer(Database &d) : db(d)
+{
+}
+
+/*
+ * The one thread writing what the workers parse, so they never wait on the
+ * LMDB writer lock, nor each pay for a commit. Changes are committed in
+ * groups of up to WRITE_GROUP, or whatever has arrived WRITE_LATENCY after
+ * the first of a group did if fewer; so are the records of directories.
+ */
+void
+Database::Writer::operator()() // THREAD ENTRY POINT
+{
+    Writes &w = db.writes;
+    vector<Change> group;
+    vector<Dir> dirs;
+
+    group.reserve(WRITE_GROUP);
+    dirs.reserve(WRITE_GROUP);
+
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> l(w.lock);
+
+            w.busy = false;
+            w.dequeued.notify_all();
+            w.queued.wait(l, [&w] {
+                return !w.changes.empty() || !w.dirs.empty() || w.stopping;
+            });
+
+            if (w.changes.empty() && w.dirs.empty())
+                return; // Stopping
+
+            w.queued.wait_for(l,
+                              std::chrono::milliseconds(WRITE_LATENCY),
+                              [&w] {
+                                  return w.changes.size() >= WRITE_GROUP ||
+                                         w.dirs.size() >= WRITE_GROUP ||
+                                         w.draining ||
+                                         w.stopping;
+                              });
+
+            const size_t n = std::min(w.changes.size(), WRITE_GROUP);
+            const size_t m = std::min(w.dirs.size(), WRITE_GROUP);
+
+            group.assign(std::make_move_iterator(w.changes.begin()),
+                         std::make_move_iterator(w.changes.begin() + n));
+            w.changes.erase(w.changes.begin(), w.changes.begin() + n);
+            dirs.assign(std::make_move_iterator(w.dirs.begin()),
+                        std::make_move_iterator(w.dirs.begin() + m));
+            w.dirs.erase(w.dirs.begin(), w.dirs.begin() + m);
+
+            for (size_t i = 0 ; i < n ; ++i)
+                w.bytes -= group[i].bytes;
+
+            w.busy = true;
+            w.dequeued.notify_all(); // Room in the backlog
+        }
+
+        commit(group, dirs);
+    }
+}
+
+/*
+ * Only the writer reads or writes the group sizes, until drained. The
+ * directories the changes complete are queued again, so their records
+ * are only ever committed after the changes were.
+ */
+void
+Database::Writer::commit(vector<Change> &group, vector<Dir> &dirs)
+{
+    db.transact([this, &group, &dirs] (Database::Transaction &txn) {
+        for (size_t i = 0 ; i < group.size() ; ++i)
+            record(group[i], txn);
+
+        for (size_t i = 0 ; i < dirs.size() ; ++i) {
+            const Key dir_key(dirs[i].path, DIR_ID);
+            const string val(flatten(dirs[i]));
+            lmdb::val lmdb_val(val);
+
+            txn.put(DIRS, dir_key.raw(), lmdb_val);
+        }
+
+        db.blobs.sync(); // Before the offsets recorded are
+    });
+
+    ++db.writes.commits;
+    db.writes.committed += group.size();
+    db.writes.largest = std::max(db.writes.largest, group.size());
+
+    for (size_t i = 0 ; i < group.size() ; ++i)
+        db.checkpoint(group[i].path.c_str());
+
+    group.clear();
+    dirs.clear();
+}
+
+void
+Database::Writer::record(const Change &c, Database::Transaction &txn)
+{
+    const Key tag_key(file_key(c.path, c.info));
+    Database::Entry<Tag> tag_ent(tag_key);
+    const bool found = db.lookup<Tag>(tag_ent, txn);
+    Tag &tag = tag_ent.value;
+
+    if (!found || tag.modified < c.tag.modified)
+    {
+        Key img_key;
+        img_key.value = c.image.low;
+        img_key.id = IMG_ID;
+
+        Database::Entry<Img> img_ent(img_key);
+        const bool exists = img_key.value && db.lookup<Img>(img_ent, txn);
+        BlobStore::Digest stored;
+
+        /*
+         * Keys are half the digest of a picture; the whole is kept with
+         * the picture, so another picture of the same key is told apart.
+         * Those stored inline, before there was a blob store, are not.
+         */
+        if (exists &&
+            img_ent.value.blob &&
+            db.blobs.digest(img_ent.value.blob, stored) &&
+            stored != c.image) {
+            ++db.writes.collisions;
+            img_key.value = 0;
+        }
+
+        /*
+         * Only the descriptor goes in the B-tree. Put again if the group is
+         * retried, the picture is still stored just once. One let go of as
+         * recognised is found by its digest, unless the store has lost it.
+         */
+        if (img_key.value && !exists) {
+            Img &img = img_ent.value;
+
+            img.size = c.img.size;
+            img.mimetype = c.img.mimetype;
+            img.blob = c.picture.empty() ?
+                       db.blobs.find(c.image) :
+                       db.blobs.put(c.image,
+                                    c.picture.data(),
+                                    c.picture.size());
+            img_ent.added = 1;
+
+            if (img.blob)
+                db.update<Img>(img_ent, txn);
+            else
+                img_key.value = 0;
+        }
+
+        if (img_key.value) {
+            /*
+             * Never removed, as the blob it names never is either
+             */
+            if (c.hashed) {
+                lmdb::val lmdb_val(&c.image, sizeof(c.image));
+                txn.put(PICTURES,
+                        lmdb::val(&c.fingerprint, sizeof(c.fingerprint)),
+                        lmdb_val);
+            }
+
+            /*
+             * The link alone is written, the Img itself is left as it is
+             */
+            db.attach(tag_key, img_key, txn);
+            tag_ent.links_to.insert(img_key);
+        }
+
+        tag_ent.added = tag.modified == 0;
+        tag_ent.updated = !tag_ent.added;
+
+        tag.modified = c.tag.modified;
+        tag.genre = c.tag.genre;
+        tag.album = c.tag.album;
+        tag.title = c.tag.title;
+        tag.artist = c.tag.artist;
+        tag.duration = c.tag.duration;
+        tag.bitrate = c.tag.bitrate;
+        tag.sample_rate = c.tag.sample_rate;
+        tag.channels = c.tag.channels;
+        tag.artist_key = c.tag.artist_key;
+        tag.album_key = c.tag.album_key;
+        tag.title_key = c.tag.title_key;
+        tag.genre_key = c.tag.genre_key;
+    }
+
+    if (tag.filename.empty())
+        tag.filename = c.path;
+    else if (tag.filename != c.path && tag.aliases.insert(c.path).second)
+        tag_ent.updated = !tag_ent.added; // Reached by another hard link
+
+    /*
+     * A file that gained or lost links since it was last seen has an entry
+     * under its other kind of key, which would otherwise linger
+     */
+    if (tag_ent.added) {
+        const Key other(c.info.st_nlink > 1 ? Key(c.path) : inode_key(c.info));
+        db.forget(other, c.path, txn);
+    }
+
+    db.update<Tag>(tag_ent, txn);
+}
+
+/*
+ * Linker (interface)
+ */
+struct Database::Linker
+{
+    /* Methods/Member functions */
+    Linker(Database &d, const std::shared_ptr<Paths> &p);
+
+    void operator()(); // THREAD ENTRY POINT
+    void record(Database::Transaction &txn);
+
+    /* Attributes/member variables */
+    Database &db;
+    std::shared_ptr<Paths> files; // Shared, handlers are copied
+};
+
+/*
+ * Linker (implementation)
+ */
+Database::Linker::Linker(Database &d, const std::shared_ptr<Paths> &p) :
+    db(d),
+    files(p)
+{
+}
+
+/*
+ * Only once every file has been maintained, so the entry of each is there
+ * to record its aliases against; unless it was not audio after all.
+ */
+void
+Database::Linker::operator()() // THREAD ENTRY POINT
+{
+    db.transact([this] (Database::Transaction &txn) { record(txn); });
+
+    /*
+     * Only now are the directories of the aliases done with
+     */
+    for (Paths::const_iterator i = files->begin() ; i != files->end() ; ++i) {
+        for (size_t j = 1 ; j < i->second.size() ; ++j)
+            db.checkpoint(i->second[j].c_str());
+    }
+}
+
+void
+Database::Linker::record(Database::Transaction &txn)
+{
+    Paths::const_iterator i(files->begin()), end(files->end());
+
+    for ( ; i != end ; ++i) {
+        const vector<string> &paths = i->second;
+        struct stat info;
+
+        info.st_dev = i->first.first;
+        info.st_ino = i->first.second;
+
+        Database::Entry<Tag> tag_ent(inode_key(info));
+
+        if (!db.lookup<Tag>(tag_ent, txn))
+            continue;
+
+        for (size_t j = 1 ; j < paths.size() ; ++j) {
+            if (paths[j] != tag_ent.value.filename &&
+                tag_ent.value.aliases.insert(paths[j]).second)
+                tag_ent.updated = 1;
+
+            db.forget(Key(paths[j]), paths[j], txn);
+        }
+
+        db.update<Tag>(tag_ent, txn);
+    }
+}
+
+/*
+ * RegisterPaths (implementation)
+ */
+Database::RegisterPaths::RegisterPaths(Database &d) : db(d)
+{
+}
+
+void
+Database::RegisterPaths::operator() (const Traverse::Batch &b)
+{
+    db.update(b);
+}
+
+/*
+ * CheckDirectory (implementation)
+ */
+Database::CheckDirectory::CheckDirectory(Database &d) : db(d)
+{
+}
+
+bool
+Database::CheckDirectory::operator() (const Traverse::Path &p, size_t entries)
+{
+    return db.update(p, entries);
+}
+
+/*
+ * Database  (implementation)
+ */
+Database::Database(Traverse &t, utility::ThreadPool &tp) :
+    lmdb_env(lmdb::env::create()),
+    mapsize(MAP_SIZE),
+    resizes(0),
+    transactions(0),
+    found(0),
+    text_documents(0),
+    text_changed(0),
+    text_seconds(0.0),
+    skipped(0),
+    aliased(0),
+    queue_depth(0),
+    spread(0.0),
+    files_per_second(0.0),
+    skip_unchanged(false),
+    resuming(false),
+    taglib_only(false),
+    rebuilding(false),
+    stopped(false),
+    metrics(tp.size() + 2),
+    traverser(t),
+    new_paths(*this),
+    changed_dir(*this),
+    threads(tp)
+{
+    lmdb_env.set_mapsize(MAP_SIZE);
+    lmdb_env.set_max_dbs(TABLES);
+    lmdb_env.set_max_readers(std::max(MIN_READERS,
+                                      tp.size() + t.threads() +
+                                      SPARE_READERS));
+    traverser.register_callback(&new_paths);
+    traverser.register_filter(&changed_dir); // Also checkpoints
+    writer = std::thread(Writer(*this));
+}
 
-    if (access(e.value.filename.c_str(), F_OK) == 0)
-        return;
+/*
+ * Whatever the writer was given is committed before it stops
+ */
+Database::~Database()
+{
+    {
+        lock_guard<std::mutex> l(writes.lock);
+        writes.stopping = true;
+    }
 
-    assert(e.links_from.empty()); // A Tag entry should not be linked too
+    writes.queued.notify_one();
+    writer.join();
+}
 
-    Transaction txn(t);
-    set<Key>::iterator i(e.links_to.begin()), j(e.links_to.end());
-    while (i != j) {
-        switch (i->id) {
-        case NO_ID:
-            throw utility::ValueError("Janitor::operator()",
-                                      0,
-                                      "Invalid ID (%d) in Key object",
-                                      *i);
-        case TAG_ID:
-            throw utility::ValueError("Janitor::operator()",
+/*
+ * Throws ValueError if the environment is of a newer format, or of one too
+ * old to migrate unless rebuilding. Not writable, by a tool only reading
+ * the environment, nothing is written to it: it must be of this format
+ * already, and the blob store is neither locked nor repaired, as a scan
+ * may be writing it meanwhile.
+ */
+void
+Database::open(const string &path, bool writable)
+{
+    lmdb_env.open(path.c_str(), writable ? 0 : MDB_RDONLY, 0600);
+    location = path;
+
+    /*
+     * Larger than asked for if the database has been grown before
+     */
+    MDB_envinfo info;
+    lmdb::env_info(lmdb_env, &info);
+    mapsize = info.me_mapsize;
+
+    /*
+     * Handles of named databases outlive the transaction opening them, if
+     * it commits, so are opened once and for all; read, those of another
+     * format may not be there to open
+     */
+    lmdb::txn txn(lmdb::txn::begin(lmdb_env, NULL, writable ? 0 : MDB_RDONLY));
+    uint32_t format = 0;
+
+    tables.resize(TABLES);
+
+    if (!writable) {
+        try {
+            lmdb::dbi_open(txn, TABLE_NAMES[META], 0, &tables[META]);
+            format = format_of(txn, tables[META]);
+        } catch (const lmdb::not_found_error &e) {
+            // Of no format at all
+        }
+
+        if (format != FORMAT)
+            throw utility::ValueError("Database::open",
                                       0,
-                                      "%zu <-> %zu Tag relationship unexpected",
-                                      e.key.value, *i);
-        case IMG_ID: {
-                Entry<Img> link(*i);
-                if (db.lookup(link, txn)) {
-                    link.links_from.erase(e.key);
-                    if (link.links_from.empty())
-                        link.removed = 1;
-                    else
-                        link.updated = 1;
-                    db.update(link, txn);
+                                      "%s is of format %u rather than %u, "
+                                      "run verbatim on it first",
+                                      path.c_str(),
+                                      format,
+                                      FORMAT);
+    }
+
+    for (size_t i = 0 ; i < TABLES ; ++i) {
+        lmdb::dbi_open(txn,
+                       TABLE_NAMES[i],
+                       writable ? TABLE_FLAGS[i] : TABLE_FLAGS[i] & ~MDB_CREATE,
+                       &tables[i]);
+    }
+
+    if (!writable) {
+        txn.commit();
+        blobs.open(location + "/" + BLOB_FILE, false);
+        return;
+    }
+
+    /*
+     * Entries are only ever what a scan finds, but are dropped, with the
+     * pictures and text index of them, only when asked to
+     */
+    MDB_stat tags, dirs;
+
+    format = format_of(txn, tables[META]);
+    lmdb::dbi_stat(txn, tables[TAGS], &tags);
+    lmdb::dbi_stat(txn, tables[DIRS], &dirs);
+
+    const bool empty = tags.ms_entries == 0 && dirs.ms_entries == 0;
+
+    if (format > FORMAT)
+        throw utility::ValueError("Database::open",
+                                  0,
+                                  "%s is of format %u, newer than the %u of "
+                                  "this verbatim",
+                                  path.c_str(),
+                                  format,
+                                  FORMAT);
+
+    if (format < OLDEST_FORMAT && !empty && !rebuilding)
+        throw utility::ValueError("Database::open",
+                                  0,
+                                  "%s is of format %u, too old to migrate; "
+                                  "run with -R/--rebuild to scan again from "
+                                  "scratch",
+                                  path.c_str(),
+                                  format);
+
+    if (rebuilding) {
+        for (size_t i = 0 ; i < TABLES ; ++i)
+            lmdb::dbi_drop(txn, tables[i]);
+    }
+
+    if (rebuilding || (format < OLDEST_FORMAT && empty)) {
+        lmdb::val format_key(FORMAT_KEY), format_val(&FORMAT, sizeof(FORMAT));
+        lmdb::dbi_put(txn, tables[META], format_key, format_val);
+    }
+
+    txn.commit();
+
+    if (rebuilding) {
+        unlink((location + "/" + BLOB_FILE).c_str());
+        unlink((location + "/" + INDEX_FILE).c_str());
+    } else if (format >= OLDEST_FORMAT && format < FORMAT) {
+        transact([format] (Transaction &txn) {
+            lmdb::val format_key(FORMAT_KEY),
+                      format_val(&FORMAT, sizeof(FORMAT));
+
+            migrate(txn, format);
+            txn.put(META, format_key, format_val);
+        });
+    }
+
+    blobs.open(location + "/" + BLOB_FILE);
+
+    /*
+     * Index entries recorded before there were indexes, all in one go, or
+     * the distinct values indexed before there were trigrams
+     */
+    transact([] (Transaction &txn) {
+        lmdb::val lmdb_key, lmdb_val;
+        bool empty = true;
+
+        for (size_t i = 0 ; i < INDEXES ; ++i)
+            empty = empty && txn.stats(SECONDARIES[i].table).ms_entries == 0;
+
+        if (empty) {
+            lmdb::cursor cur(txn.cur(TAGS));
+            const string none[INDEXES];
+
+            while (cur.get(lmdb_key, lmdb_val, MDB_NEXT)) {
+                string values[INDEXES];
+
+                indexed(TagRecord(lmdb_val.data(), lmdb_val.size()), values);
+                reindex(txn, Key::from(lmdb_key, TAG_ID), none, values);
+            }
+        } else if (txn.stats(TRIGRAMS).ms_entries == 0) {
+            for (size_t i = 0 ; i < INDEXES ; ++i) {
+                lmdb::cursor cur(txn.cur(SECONDARIES[i].table));
+
+                while (cur.get(lmdb_key, lmdb_val, MDB_NEXT_NODUP)) {
+                    const string value(lmdb_key.data(), lmdb_key.size());
+                    retrigram(txn, i, value, true);
                 }
             }
-            break;
         }
+    });
+}
 
-        ++i;
+/*
+ * Keys of the Tag entries of the given artist, album, genre or title, as
+ * normalised; a seek in the index then one step per match, found in key
+ * order. Returns the no. found.
+ */
+size_t
+Database::find(Index by, const string &value, vector<size_t> &keys) const
+{
+    const string normal(index_value(utility::normalise(value)));
+    Transaction txn(*this, true);
+    lmdb::cursor cur(txn.cur(SECONDARIES[by].table));
+    lmdb::val lmdb_key(normal), lmdb_val;
+
+    keys.clear();
+
+    if (normal.empty() || !cur.get(lmdb_key, lmdb_val, MDB_SET))
+        return 0;
+
+    do
+        keys.push_back(Key::from(lmdb_val, TAG_ID).value);
+    while (cur.get(lmdb_key, lmdb_val, MDB_NEXT_DUP));
+
+    return keys.size();
+}
+
+/*
+ * Indexed values close to the text, closest first, for finding what was
+ * misspelt. Candidates are the values with the most trigrams in common with
+ * the text, as trigram rows are of distinct values rather than of entries
+ * their cost grows with the vocabulary of the library, not its size; only
+ * the best of them are compared in full. Returns the no. found.
+ */
+size_t
+Database::fuzzy(const string &text, vector<Match> &matches, size_t limit) const
+{
+    const string normal(index_value(utility::normalise(text)));
+    const size_t edits = normal.size() / FUZZY_BYTES_PER_EDIT;
+    std::unordered_map<string, size_t> overlap; // Posting -> #trigrams
+    vector<std::pair<size_t, string> > candidates;
+    vector<string> grams;
+
+    matches.clear();
+
+    if (normal.empty())
+        return 0;
+
+    utility::trigrams(normal, grams);
+
+    {
+        Transaction txn(*this, true);
+        lmdb::cursor cur(txn.cur(TRIGRAMS));
+
+        for (size_t i = 0 ; i < grams.size() ; ++i) {
+            lmdb::val lmdb_key(grams[i]), lmdb_val;
+
+            if (!cur.get(lmdb_key, lmdb_val, MDB_SET))
+                continue;
+
+            do
+                ++overlap[string(lmdb_val.data(), lmdb_val.size())];
+            while (cur.get(lmdb_key, lmdb_val, MDB_NEXT_DUP));
+        }
+    }
+
+    candidates.reserve(overlap.size());
+
+    std::unordered_map<string, size_t>::const_iterator o(overlap.begin());
+
+    for ( ; o != overlap.end() ; ++o)
+        candidates.push_back(std::make_pair(o->second, o->first));
+
+    const size_t compared = std::min(candidates.size(), FUZZY_CANDIDATES);
+
+    std::partial_sort(candidates.begin(),
+                      candidates.begin() + compared,
+                      candidates.end(),
+                      [] (const std::pair<size_t, string> &a,
+                          const std::pair<size_t, string> &b) {
+                          return a.first > b.first;
+                      });
+
+    for (size_t i = 0 ; i < compared ; ++i) {
+        const string &posting(candidates[i].second);
+        const string value(posting, 1);
+        const size_t d = utility::edit_distance(normal, value);
+
+        if (d <= edits)
+            matches.push_back(Match{Index(posting[0]), value, d});
     }
 
     /*
-     * If the file doesn't exist anymore, remove the entry
+     * Closest first, then the shortest as more of it was matched
      */
-    e.removed = 1;
-    db.update(e, txn);
+    std::stable_sort(matches.begin(), matches.end(),
+                     [] (const Match &a, const Match &b) {
+                         return a.distance < b.distance ||
+                                (a.distance == b.distance &&
+                                 a.value.size() < b.value.size());
+                     });
 
-    txn.commit();
+    if (limit > 0 && matches.size() > limit)
+        matches.resize(limit);
+
+    return matches.size();
 }
 
 /*
- * Maintainer (interface)
+ * The substring index lives beside the environment, in a file of its own,
+ * and is brought up to date with the Tag entries after each scan. Only the
+ * entries whose text changed since are indexed again.
  */
-struct Database::Maintainer
+void
+Database::index_text()
 {
-    /* Methods/Member functions */
-    Maintainer(Database &d, const char *p, const time_t f);
+    const string index_path(location + "/" + INDEX_FILE);
+    SuffixArray sa;
+    vector<SuffixArray::Document> stale, seen;
+    utility::Timer t;
 
-    void operator()(); // THREAD ENTRY POINT
+    t.start();
+    sa.load(index_path);
+    text_changed = 0;
 
-    /* Attributes/member variables */
-    Database &db;
-    const string path;
-    const time_t modify_time;
-};
+    {
+        Transaction txn(*this, true);
+        lmdb::cursor cur(txn.cur(TAGS));
+        lmdb::val lmdb_key, lmdb_val;
+        SuffixArray::Fields fields(INDEXES);
+
+        while (cur.get(lmdb_key, lmdb_val, MDB_NEXT)) {
+            const Key k(Key::from(lmdb_key, TAG_ID));
+            const TagRecord r(lmdb_val.data(), lmdb_val.size());
+
+            fields[BY_ARTIST] = r.artist_key().to_string();
+            fields[BY_ALBUM] = r.album_key().to_string();
+            fields[BY_GENRE] = r.genre_key().to_string();
+            fields[BY_TITLE] = r.title_key().to_string();
+
+            if (sa.update(k.value, fields))
+                ++text_changed;
+
+            seen.push_back(k.value); // In key order, as integer keys are
+        }
+    }
+
+    sa.documents(stale);
+
+    for (size_t i = 0 ; i < stale.size() ; ++i) {
+        if (!std::binary_search(seen.begin(), seen.end(), stale[i]) &&
+            sa.remove(stale[i]))
+            ++text_changed;
+    }
+
+    sa.commit();
+    sa.save(index_path);
+    t.stop();
+
+    const utility::Timer::Duration d(t.elapsed());
+    text_seconds = d.seconds + d.nanoseconds / 1000000000.0;
+    text_documents = sa.size();
+}
 
 /*
- * Maintainer (implementation)
+ * Keys of the Tag entries whose artist, album, genre or title contains the
+ * pattern, as normalised, in key order. Returns the no. found.
  */
-Database::Maintainer::Maintainer(Database &d, const char *p, const time_t f) :
-    db(d),
-    path(p),
-    modify_time(f)
+size_t
+Database::search(const string &pattern,
+                 vector<size_t> &keys,
+                 size_t limit) const
+{
+    SuffixArray sa;
+    vector<SuffixArray::Document> found;
+
+    keys.clear();
+
+    if (!sa.load(location + "/" + INDEX_FILE))
+        return 0;
+
+    sa.find(pattern, found, limit);
+    keys.assign(found.begin(), found.end());
+
+    return keys.size();
+}
+
+bool
+Database::tag(size_t key, Tag &t) const
+{
+    Transaction txn(*this, true);
+    lmdb::val lmdb_val;
+    Key k;
+
+    k.value = key;
+    k.id = TAG_ID;
+
+    if (!txn.get(TAGS, k.raw(), lmdb_val))
+        return false;
+
+    read(TagRecord(lmdb_val.data(), lmdb_val.size()), t);
+
+    return true;
+}
+
+/*
+ * The picture is read from the blob store, unless recorded before there was
+ * one; false if it is not there either
+ */
+bool
+Database::image(size_t key, Img &i) const
 {
+    Transaction txn(*this, true);
+    lmdb::val lmdb_val;
+    boost::string_ref data;
+    Key k;
+
+    k.value = key;
+    k.id = IMG_ID;
+
+    if (!txn.get(IMAGES, k.raw(), lmdb_val))
+        return false;
+
+    read(ImgRecord(lmdb_val.data(), lmdb_val.size()), i);
+
+    if (!i.blob)
+        return true;
+
+    if (!blobs.get(i.blob, i.size, data))
+        return false;
+
+    i.data.assign(data.begin(), data.end());
+
+    return true;
 }
 
 void
-Database::Maintainer::operator()() // THREAD ENTRY POINT
+Database::update(const string &path)
 {
-    TagLib::MPEG::File f(path.c_str());
+    const Janitor j(*this);
+    threads.submit(j);
+}
 
-    if (!(f.isValid() && f.hasID3v2Tag()))
-        return;
+void
+Database::remove(const string &path)
+{
+    const Remover r(*this, path);
+    threads.submit(r);
+}
 
-    const Key tag_key(path);
-    Database::Transaction txn(db);
-    Database::Entry<Tag> tag_ent(tag_key);
+void
+Database::incremental()
+{
+    skip_unchanged = true;
+}
 
-    if (!db.lookup<Tag>(tag_ent, txn) ||
-        tag_ent.value.modified < modify_time)
-    {
-        const TagLib::ID3v2::Tag *tags = f.ID3v2Tag();
-        const Key img_key(tags);
+void
+Database::taglib()
+{
+    taglib_only = true;
+}
+
+void
+Database::rebuild()
+{
+    rebuilding = true;
+}
+
+/*
+ * Start a scan of the given roots, picking up where the last one left off
+ * if it was interrupted and was of the same roots. Directories checkpointed
+ * by that scan, and unchanged since, then have their files skipped.
+ */
+bool
+Database::begin(const vector<string> &roots)
+{
+    static const uint64_t ns = 1000000000ULL;
+    const Key scan_key(SCAN_KEY, SCAN_ID);
 
-        if (img_key) {
-            Database::Entry<Img> img_ent(img_key);
+    transact([&] (Transaction &txn) {
+        lmdb::val lmdb_val;
 
-            if (!db.lookup<Img>(img_ent, txn) &&
-                copy_img_data(tags, img_ent.value))
-                img_ent.added = 1;
+        resuming =
+            txn.get(SCANS, scan_key.raw(), lmdb_val) &&
+            (scan = unflatten<Scan>(lmdb_val)).roots == roots;
 
-            img_ent.links_from.insert(tag_key);
-            img_ent.updated = !img_ent.added;
-            tag_ent.links_to.insert(img_key);
-            db.update<Img>(img_ent, txn);
+        if (!resuming) {
+            timespec now;
+            clock_gettime(CLOCK_REALTIME, &now);
+
+            scan.generation = now.tv_sec * ns + now.tv_nsec;
+            scan.roots = roots;
         }
 
-        tag_ent.added = tag_ent.value.modified == 0;
-        tag_ent.updated = !tag_ent.added;
+        const string val(flatten(scan));
+        lmdb::val new_val(val);
 
-        tag_ent.value.filename = path;
-        tag_ent.value.modified = modify_time;
-        tag_ent.value.genre = tags->genre().to8Bit();
-        tag_ent.value.album = tags->album().to8Bit();
-        tag_ent.value.title = tags->title().to8Bit();
-        tag_ent.value.artist = tags->artist().to8Bit();
+        txn.put(SCANS, scan_key.raw(), new_val);
+    });
 
-        db.update<Tag>(tag_ent, txn);
+    {
+        lock_guard<std::mutex> l(checkpoints.lock);
+        checkpoints.directories.clear();
     }
 
-    txn.commit();
+    lock_guard<std::mutex> l(links.lock);
+    links.files.clear();
+
+    return resuming;
+}
+
+/*
+ * Stop maintaining files, including those already queued, so the pool runs
+ * dry promptly. Whatever was committed stays, as do the checkpoints.
+ */
+void
+Database::interrupt()
+{
+    stopped = true;
 }
 
 /*
- * RegisterPath (implementation)
+ * Hand the aliases of the multiply linked files to a worker, forgetting
+ * the files that turned out to have only the one path within the scan
  */
-Database::RegisterPath::RegisterPath(Database &d) : db(d)
+bool
+Database::link()
 {
+    std::shared_ptr<Paths> files(new Paths());
+
+    {
+        lock_guard<std::mutex> l(links.lock);
+
+        for (Paths::iterator i = links.files.begin() ;
+             i != links.files.end() ;
+             ++i) {
+            if (i->second.size() > 1)
+                (*files)[i->first].swap(i->second);
+        }
+
+        links.files.clear();
+    }
+
+    if (files->empty() || stopped)
+        return false;
+
+    const Linker l(*this, files);
+    threads.submit(l);
+
+    return true;
 }
 
 void
-Database::RegisterPath::operator() (const Traverse::Path &p)
+Database::end()
 {
-    db.update(p);
+    const Key scan_key(SCAN_KEY, SCAN_ID);
+
+    transact([&scan_key] (Transaction &txn) {
+        txn.del(SCANS, scan_key.raw());
+    });
 }
 
 /*
- * Database  (implementation)
+ * Sniff the files of each batch with io_uring(7), up to queue_depth files
+ * in flight per walker, rather than one blocking open() and read() apiece
  */
-Database::Database(Traverse &t, utility::ThreadPool &tp) :
-    lmdb_env(lmdb::env::create()),
-    spread(0.0),
-    metrics(tp.size() + 1),
-    traverser(t),
-    new_path(*this),
-    threads(tp)
+void
+Database::asynchronous(unsigned depth)
 {
-    lmdb_env.set_mapsize((1024 * 1024) * 64); // 64MB
-    traverser.register_callback(&new_path);
+    queue_depth = depth && utility::Ring::supported() ? depth : 0;
 }
 
-Database::~Database()
+/*
+ * Hold back up to window recognised files, across batches and walkers, and
+ * hand them to the workers in order of where their data lies on disk rather
+ * than in the order they were found. Zero disables.
+ */
+void
+Database::locality(size_t window)
 {
+    lock_guard<std::mutex> l(pending.lock);
+    pending.window = window;
+    pending.files.reserve(window);
+    pending.positions.reserve(window);
 }
 
+/*
+ * Submit whatever the locality window is holding back. Necessary at the
+ * end of each scan as the window is only ever emptied when full.
+ */
 void
-Database::open(const string &path)
+Database::flush()
 {
-    lmdb_env.open(path.c_str(), 0, 0600);
+    Traverse::Batch files;
+    vector<Position> positions;
+
+    {
+        lock_guard<std::mutex> l(pending.lock);
+        std::swap(files, pending.files);
+        positions.swap(pending.positions);
+        pending.files.reserve(pending.window);
+        pending.positions.reserve(pending.window);
+    }
+
+    submit(files, positions);
 }
 
+/*
+ * Only once the workers are done, so the backlog can only ever shrink, bar
+ * the checkpoints of directories the writer completes and queues itself
+ */
 void
-Database::update(const string &path)
+Database::drain()
 {
-    const Janitor j(*this);
-    threads.submit(j);
+    std::unique_lock<std::mutex> l(writes.lock);
+
+    writes.draining = true;
+    writes.queued.notify_one();
+    writes.dequeued.wait(l, [this] {
+        return writes.changes.empty() && writes.dirs.empty() && !writes.busy;
+    });
+    writes.draining = false;
 }
 
 void
 Database::print_metrics(ostream &stream) const
 {
-    Transaction txn(*this);
-    const MDB_stat db_stats(txn.stats());
+    Transaction txn(*this, true);
+    MDB_stat db_stats = MDB_stat();
+    const Reads &native = metrics[0].native, &taglib = metrics[0].taglib;
+
+    for (size_t i = 0 ; i < TABLES ; ++i) {
+        const MDB_stat s(txn.stats(Table(i)));
+
+        db_stats.ms_depth = std::max(db_stats.ms_depth, s.ms_depth);
+        db_stats.ms_branch_pages += s.ms_branch_pages;
+        db_stats.ms_leaf_pages += s.ms_leaf_pages;
+
+        if (i < LINKS_TO)
+            db_stats.ms_entries += s.ms_entries;
+    }
 
     stream <<
+        "verbatim[Database]: Map size =       " <<
+        mapsize / (1024 * 1024) <<
+        "MB (" <<
+        resizes <<
+        " resizes)" <<
+        endl <<
         "verbatim[Database]: Tree depth =     " <<
         db_stats.ms_depth <<
         endl <<
@@ -659,12 +2355,92 @@ Database::print_metrics(ostream &stream) const
         "verbatim[Database]: Total #updated = " <<
         metrics[0].updated <<
         endl <<
-        "verbatim[Database]: Total #lookups = " <<
-        metrics[0].lookups <<
+        "verbatim[Database]: Total #lookups = " <<
+        metrics[0].lookups <<
+        endl <<
+        "verbatim[Database]: Total #skipped = " <<
+        skipped <<
+        endl <<
+        "verbatim[Database]: Total #aliases = " <<
+        aliased <<
+        endl <<
+        "verbatim[Database]: Total #parsed =  " <<
+        metrics[0].parsed <<
+        endl <<
+        "verbatim[Database]: #unchanged =     " <<
+        metrics[0].unchanged <<
+        endl <<
+        "verbatim[Database]: #pictures =      " <<
+        metrics[0].hashed + metrics[0].recognised <<
+        " (" <<
+        metrics[0].recognised <<
+        " by fingerprint)" <<
+        endl <<
+        "verbatim[Database]: Native reads =   " <<
+        native.files <<
+        " (" <<
+        native.bytes / std::max<ssize_t>(native.files, 1) <<
+        " bytes, " <<
+        native.seconds * 1000000.0 / std::max<ssize_t>(native.files, 1) <<
+        "us per file)" <<
+        endl <<
+        "verbatim[Database]: TagLib reads =   " <<
+        taglib.files <<
+        " (" <<
+        taglib.bytes / std::max<ssize_t>(taglib.files, 1) <<
+        " bytes, " <<
+        taglib.seconds * 1000000.0 / std::max<ssize_t>(taglib.files, 1) <<
+        "us per file)" <<
+        endl <<
+        "verbatim[Database]: #commits =       " <<
+        writes.commits <<
+        " (of " <<
+        transactions <<
+        " write transactions)" <<
+        endl <<
+        "verbatim[Database]: Mean group =     " <<
+        (writes.commits ? double(writes.committed) / writes.commits : 0.0) <<
+        endl <<
+        "verbatim[Database]: Largest group =  " <<
+        writes.largest <<
+        endl <<
+        "verbatim[Database]: #collisions =    " <<
+        writes.collisions <<
+        endl <<
+        "verbatim[Database]: Writer wait =    ";
+
+    for (size_t i = 1 ; i < metrics.size() - 1 ; ++i)
+        stream << metrics[i].waited << "s ";
+
+    stream <<
+        "(per worker)" <<
+        endl <<
+        "verbatim[Database]: Files/sec =      " <<
+        files_per_second <<
+        (pending.window ? " (in disk order)" : " (in traversal order)") <<
         endl <<
         "verbatim[Database]: Total #entries = " <<
         db_stats.ms_entries <<
         endl <<
+        "verbatim[Database]: Total #links =   " <<
+        txn.stats(LINKS_TO).ms_entries <<
+        endl <<
+        "verbatim[Database]: Blob store =     " <<
+        blobs.size() / (1024 * 1024) <<
+        "MB (" <<
+        blobs.blobs() <<
+        " images, " <<
+        blobs.reused() <<
+        " reused)" <<
+        endl <<
+        "verbatim[Database]: Text index =     " <<
+        text_documents <<
+        " documents (" <<
+        text_changed <<
+        " changed, " <<
+        text_seconds <<
+        "s)" <<
+        endl <<
         "verbatim[Database]: Spread measure = ~" <<
         spread <<
         "%\n";
@@ -686,13 +2462,38 @@ Database::aggregate_metrics()
     Metrics &aggregate = metrics[0];
     vector<double> activity(metrics.size(), 0.0);
 
+    /*
+     * Summed afresh, as each wait() aggregates again (twice in watch mode)
+     * from the counters of the threads, which are never reset
+     */
+    aggregate = Metrics();
+
     for (size_t i = 1 ; i < metrics.size() ; ++i) {
+        aggregate.parsed += metrics[i].parsed;
         aggregate.added += metrics[i].added;
         aggregate.removed += metrics[i].removed;
         aggregate.updated += metrics[i].updated;
         aggregate.lookups += metrics[i].lookups;
+        aggregate.unchanged += metrics[i].unchanged;
+        aggregate.hashed += metrics[i].hashed;
+        aggregate.recognised += metrics[i].recognised;
+        aggregate.native.files += metrics[i].native.files;
+        aggregate.native.bytes += metrics[i].native.bytes;
+        aggregate.native.seconds += metrics[i].native.seconds;
+        aggregate.taglib.files += metrics[i].taglib.files;
+        aggregate.taglib.bytes += metrics[i].taglib.bytes;
+        aggregate.taglib.seconds += metrics[i].taglib.seconds;
+    }
+
+    /*
+     * Of the workers only, the writer does what they parse
+     */
+    activity.pop_back();
 
+    for (size_t i = 1 ; i < activity.size() ; ++i) {
         activity[i] =
+            metrics[i].parsed +
+            metrics[i].unchanged +
             metrics[i].added +
             metrics[i].removed +
             metrics[i].updated +
@@ -724,73 +2525,144 @@ Database::aggregate_metrics()
 
     x = wupt - sqrt(x / n);
     spread = fabs(x / wupt) * 100.0f;
+
+    /*
+     * Parse rate from the first submitted batch until the pool ran dry
+     */
+    parse_timer.stop();
+
+    const utility::Timer::Duration d(parse_timer.elapsed());
+    const double seconds = d.seconds + d.nanoseconds / 1000000000.0;
+
+    files_per_second = seconds > 0.0 ? aggregate.parsed / seconds : 0.0;
 }
 
-template<typename Impl>
-size_t
-Database::visit(Visitor<Impl> &v)
+/*
+ * Remove a Tag entry and unlink it from any Img entries it refers to,
+ * removing those too if nothing else refers to them. The caller commits.
+ */
+void
+Database::remove(Entry<Tag> &e, Transaction &txn)
 {
-    size_t visits = 0;
-    Transaction txn(*this);
-    lmdb::cursor cur(txn.cur());
-    lmdb::val lmdb_key, lmdb_val;
-
-    while (cur.get(lmdb_key, lmdb_val, MDB_NEXT)) {
-        const Key key(reconstruct<Key>(lmdb_key));
+    assert(e.links_from.empty()); // A Tag entry should not be linked too
 
-        switch (key.id) {
+    set<Key>::iterator i(e.links_to.begin()), j(e.links_to.end());
+    while (i != j) {
+        switch (i->id) {
         case NO_ID:
-            throw utility::ValueError("Database::visit",
+            throw utility::ValueError("Database::remove",
                                       0,
                                       "Invalid ID (%d) in Key object",
-                                      key.id);
-        case TAG_ID: {
-                Entry<Tag> e(reconstruct<Entry<Tag> >(lmdb_val));
-                v(e, txn);
-            }
-            break;
+                                      *i);
+        case TAG_ID:
+            throw utility::ValueError("Database::remove",
+                                      0,
+                                      "%zu <-> %zu Tag relationship unexpected",
+                                      e.key.value, *i);
+        case DIR_ID:
+        case SCAN_ID:
+            throw utility::ValueError("Database::remove",
+                                      0,
+                                      "%zu <-> %zu %s relationship unexpected",
+                                      e.key.value, i->value,
+                                      i->id == DIR_ID ? "Dir" : "Scan");
         case IMG_ID: {
-                Entry<Img> e(reconstruct<Entry<Img> >(lmdb_val));
-                v(e, txn);
+                Entry<Img> link(*i);
+                detach(e.key, *i, txn);
+                if (lookup(link, txn) && link.links_from.empty()) {
+                    link.removed = 1;
+                    update(link, txn);
+                }
             }
             break;
         }
 
-        ++visits;
+        ++i;
     }
 
-    return visits;
+    /*
+     * The file doesn't exist anymore, remove the entry
+     */
+    e.removed = 1;
+    update(e, txn);
+}
+
+/*
+ * Drop a path from the entry under the given key, removing the entry if it
+ * was the last path of it. The caller commits.
+ */
+void
+Database::forget(const Key &k, const string &path, Transaction &txn)
+{
+    Entry<Tag> e(k);
+
+    if (!lookup(e, txn))
+        return;
+
+    Tag &tag = e.value;
+
+    if (tag.aliases.erase(path) > 0) {
+        e.updated = 1;
+    } else if (tag.filename == path && !tag.aliases.empty()) {
+        tag.filename = *tag.aliases.begin();
+        tag.aliases.erase(tag.aliases.begin());
+        e.updated = 1;
+    } else if (tag.filename == path) {
+        remove(e, txn);
+        return;
+    }
+
+    update(e, txn);
+}
+
+/*
+ * Record a Tag linking to an Img, in either direction. Linking the two
+ * again is harmless. The caller commits.
+ */
+void
+Database::attach(const Key &tag, const Key &img, Transaction &txn)
+{
+    lmdb::val to(img.raw()), from(tag.raw());
+
+    txn.put(LINKS_TO, tag.raw(), to, MDB_NODUPDATA);
+    txn.put(LINKS_FROM, img.raw(), from, MDB_NODUPDATA);
+}
+
+void
+Database::detach(const Key &tag, const Key &img, Transaction &txn)
+{
+    txn.del(LINKS_TO, tag.raw(), img.raw());
+    txn.del(LINKS_FROM, img.raw(), tag.raw());
 }
 
+/*
+ * Visit every entry, one table at a time
+ */
 template<typename Impl>
 size_t
 Database::visit(Visitor<Impl> &v) const
+{
+    Transaction txn(*this, true);
+
+    return visit<Tag>(v, txn) + visit<Img>(v, txn) + visit<Dir>(v, txn);
+}
+
+/*
+ * Visit the entries of one type only, never touching those of another
+ */
+template<typename Value, typename Impl>
+size_t
+Database::visit(Visitor<Impl> &v, Transaction &txn) const
 {
     size_t visits = 0;
-    Transaction txn(*this);
-    lmdb::cursor cur(txn.cur());
+    lmdb::cursor cur(txn.cur(Storage<Value>::table));
     lmdb::val lmdb_key, lmdb_val;
 
     while (cur.get(lmdb_key, lmdb_val, MDB_NEXT)) {
-        const Key key(reconstruct<Key>(lmdb_key));
+        Entry<Value> e(Key::from(lmdb_key, Storage<Value>::id));
 
-        switch (key.id) {
-        case NO_ID:
-            throw utility::ValueError("Database::visit",
-                                      0,
-                                      "Invalid ID (%d) in Key object",
-                                      key.id);
-        case TAG_ID: {
-                const Entry<Tag> e(reconstruct<Entry<Tag> >(lmdb_val));
-                v(e, txn);
-            }
-            break;
-        case IMG_ID: {
-                const Entry<Img> e(reconstruct<Entry<Img> >(lmdb_val));
-                v(e, txn);
-            }
-            break;
-        }
+        load(e, lmdb_val, txn);
+        v(e, txn);
 
         ++visits;
     }
@@ -803,18 +2675,16 @@ inline
 bool
 Database::lookup(Entry<Value> &e, Transaction &txn)
 {
-    const string key(deconstruct<Key>(e.key));
-    lmdb::val lmdb_key(key), lmdb_val;
-    bool found = txn.get(lmdb_key, lmdb_val);
+    assert(e.key.id == Storage<Value>::id);
 
-    Metrics &m = metrics[threads.index() + 1]; // Metrics of current thread
+    lmdb::val lmdb_val;
+    const bool found = txn.get(Storage<Value>::table, e.key.raw(), lmdb_val);
+
+    Metrics &m = local();
     m.lookups++;
 
-    if (found) {
-        const Key k(e.key); // Copy for assert()
-        e = reconstruct<Entry<Value> >(lmdb_val);
-        assert(e.key == k);
-    }
+    if (found)
+        load(e, lmdb_val, txn);
 
     return found;
 }
@@ -824,19 +2694,20 @@ inline
 void
 Database::update(const Entry<Value> &e, Transaction &txn)
 {
-    assert(e.key);
+    assert(e.key && e.key.id == Storage<Value>::id);
+
+    Metrics &m = local();
 
-    Metrics &m = metrics[threads.index() + 1]; // Metrics of current thread
-    const string key(deconstruct<Key>(e.key));
-    lmdb::val lmdb_key(key);
+    if (e.added || e.updated || e.removed)
+        reindex(e, txn);
 
     if (e.added || e.updated) {
-        const string val(deconstruct<Entry<Value> >(e));
+        const string val(flatten(e.value));
         lmdb::val lmdb_val(val);
 
-        txn.put(lmdb_key, lmdb_val);
+        txn.put(Storage<Value>::table, e.key.raw(), lmdb_val);
     } else if (e.removed) {
-        txn.del(lmdb_key);
+        txn.del(Storage<Value>::table, e.key.raw()); // Links detached already
     }
 
     m.added += e.added;
@@ -844,17 +2715,399 @@ Database::update(const Entry<Value> &e, Transaction &txn)
     m.updated += e.updated;
 }
 
-inline
 void
 Database::update(const Traverse::Path &p)
 {
+    Traverse::Batch b;
+
+    b.add(p);
+    update(b, false); // A change is parsed whichever link it came by
+}
+
+/*
+ * Open each file, read the tags, add or update a DB entry (a key-value pair)
+ * but only if the leading bytes look like audio. Much cheaper to find out
+ * here than having a worker ask TagLib about every .jpg, .cue or .log.
+ * Whatever remains of the batch is then maintained by a single worker, or
+ * is held back to be reordered if there is a locality window. Only the
+ * first path found of a multiply linked file is kept, the others are left
+ * for the Linker.
+ */
+void
+Database::update(const Traverse::Batch &b, bool dedupe)
+{
+    std::shared_ptr<Traverse::Batch> files(new Traverse::Batch());
+    vector<size_t> regular;
+    vector<Format> formats;
+
+    if (stopped)
+        return;
+
+    files->reserve(b.size());
+    regular.reserve(b.size());
+
+    for (size_t i = 0 ; i < b.size() ; ++i) {
+        const Traverse::Path p(b[i]);
+
+        if (!S_ISREG(p.info->st_mode)) {
+            checkpoint(p.name); // Subdirectories carry their own
+            continue;
+        }
+
+        if (dedupe && p.info->st_nlink > 1) {
+            lock_guard<std::mutex> l(links.lock);
+            vector<string> &paths =
+                links.files[Inode(p.info->st_dev, p.info->st_ino)];
+
+            paths.push_back(p.name);
+
+            if (paths.size() > 1) {
+                ++aliased; // Checkpointed by the Linker, once recorded
+                continue;
+            }
+        }
+
+        regular.push_back(i);
+    }
+
+    formats.resize(regular.size(), UNKNOWN_FORMAT);
+
+    utility::Ring *ring = regular.empty() ? NULL : this->ring();
+
+    if (ring) {
+        vector<const char*> paths(regular.size());
+
+        for (size_t i = 0 ; i < regular.size() ; ++i)
+            paths[i] = b[regular[i]].name;
+
+        sniff(*ring, &paths[0], paths.size(), &formats[0]);
+    } else {
+        for (size_t i = 0 ; i < regular.size() ; ++i)
+            formats[i] = sniff(b[regular[i]].name);
+    }
+
+    for (size_t i = 0 ; i < regular.size() ; ++i) {
+        if (formats[i] == UNKNOWN_FORMAT) {
+            ++skipped;
+            checkpoint(b[regular[i]].name);
+        } else {
+            files->add(b[regular[i]]);
+        }
+    }
+
+    if (files->empty())
+        return;
+
+    std::call_once(parse_started, &utility::Timer::start, &parse_timer);
+
     /*
-     * Open the file, read the tags, add or update a DB entry (a key-value pair)
+     * Size the map from the no. of files the traversal has found so far,
+     * which runs well ahead of the writer, here where no transaction is open
      */
-    if (S_ISREG(p.info->st_mode)) {
-        const Maintainer m(*this, p.name, p.info->st_mtime);
+    const size_t wanted = (found += files->size()) * BYTES_PER_FILE;
+
+    if (wanted > mapsize)
+        grow(wanted);
+
+    if (pending.window == 0) {
+        const Maintainer m(*this, files);
+        threads.submit(m);
+        return;
+    }
+
+    /*
+     * Positions are looked up before taking the lock, FIEMAP can block
+     */
+    vector<Position> positions(files->size());
+    Traverse::Batch full;
+
+    for (size_t i = 0 ; i < files->size() ; ++i) {
+        const Traverse::Path p((*files)[i]);
+        positions[i].first = std::make_pair(p.info->st_dev,
+                                            position(p.name, *p.info));
+    }
+
+    {
+        lock_guard<std::mutex> l(pending.lock);
+
+        for (size_t i = 0 ; i < files->size() ; ++i) {
+            positions[i].second = pending.files.size();
+            pending.positions.push_back(positions[i]);
+            pending.files.add((*files)[i]);
+        }
+
+        if (pending.files.size() < pending.window)
+            return;
+
+        std::swap(full, pending.files);
+        positions.swap(pending.positions);
+        pending.positions.clear();
+        pending.files.reserve(pending.window);
+        pending.positions.reserve(pending.window);
+    }
+
+    submit(full, positions);
+}
+
+/*
+ * Sort a full (or flushed) window by position and split it into contiguous
+ * runs, one per worker. Workers take the runs in order so the head sweeps
+ * across the disk once per window rather than seeking back and forth.
+ */
+void
+Database::submit(const Traverse::Batch &files, vector<Position> &positions)
+{
+    if (files.empty())
+        return;
+
+    std::sort(positions.begin(), positions.end());
+
+    const size_t run = std::max<size_t>(files.size() / threads.size(), 1);
+
+    for (size_t i = 0 ; i < positions.size() ; i += run) {
+        std::shared_ptr<Traverse::Batch> b(new Traverse::Batch());
+        const size_t end = std::min(i + run, positions.size());
+
+        b->reserve(end - i);
+
+        for (size_t j = i ; j < end ; ++j)
+            b->add(files[positions[j].second]);
+
+        const Maintainer m(*this, b);
         threads.submit(m);
     }
 }
 
+/*
+ * The ring of the calling (walker) thread, created on first use, or NULL if
+ * not asynchronous or the ring could not be set up
+ */
+utility::Ring*
+Database::ring()
+{
+    static thread_local std::unique_ptr<utility::Ring> r;
+    static thread_local bool failed = false;
+
+    if (queue_depth == 0 || failed)
+        return NULL;
+
+    if (!r) {
+        try {
+            r.reset(new utility::Ring(queue_depth));
+        } catch (const utility::Exception &e) {
+            failed = true;
+        }
+    }
+
+    return r.get();
+}
+
+/*
+ * Compare a directory against its record from a previous scan. Called from
+ * the walker threads, not the pool, so the per-thread metrics are left
+ * alone. Unless it is skipped the record is not rewritten here but once all
+ * of the entries of the directory have been dealt with; a directory is thus
+ * only ever recorded as scanned once it has been, which is what allows an
+ * interrupted scan to be resumed.
+ *
+ * Note that rewriting tags in-place does not alter the modification time
+ * of the parent directory, so incremental scans are opt-in.
+ */
+bool
+Database::update(const Traverse::Path &p, size_t entries)
+{
+    static const uint64_t ns = 1000000000ULL;
+    Checkpoint c;
+    Dir &current = c.record;
+
+    current.inode = p.info->st_ino;
+    current.modified = p.info->st_mtim.tv_sec * ns + p.info->st_mtim.tv_nsec;
+    current.changed = p.info->st_ctim.tv_sec * ns + p.info->st_ctim.tv_nsec;
+    current.entries = entries;
+    current.scan = scan.generation;
+    current.path = p.name;
+
+    if (current.path.size() > 1 && current.path[current.path.size() - 1] == '/')
+        current.path.resize(current.path.size() - 1); // As checkpoint() sees it
+
+    const Key dir_key(current.path, DIR_ID);
+    lmdb::val lmdb_val;
+
+    {
+        Transaction txn(*this, true);
+
+        if (txn.get(DIRS, dir_key.raw(), lmdb_val)) {
+            const Dir previous(unflatten<Dir>(lmdb_val));
+
+            if (previous == current &&
+                (skip_unchanged ||
+                 (resuming && previous.scan == scan.generation)))
+                return false;
+        }
+    }
+
+    if (entries == 0) {
+        put(current);
+        return true;
+    }
+
+    c.outstanding = entries;
+
+    lock_guard<std::mutex> l(checkpoints.lock);
+    checkpoints.directories[current.path] = c;
+
+    return true;
+}
+
+/*
+ * One entry of the directory the path is in has been dealt with, whether
+ * maintained or found not to be audio, so write the record of the directory
+ * if it was the last. Entries that could not be stat()ed are never counted
+ * off so their directory is simply scanned again if the scan is resumed.
+ */
+void
+Database::checkpoint(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+
+    if (!slash)
+        return;
+
+    const string directory(path, slash == path ? 1 : slash - path);
+    Dir record;
+
+    {
+        lock_guard<std::mutex> l(checkpoints.lock);
+        std::unordered_map<string, Checkpoint>::iterator i =
+            checkpoints.directories.find(directory);
+
+        if (i == checkpoints.directories.end() || --i->second.outstanding > 0)
+            return;
+
+        std::swap(record, i->second.record);
+        checkpoints.directories.erase(i);
+    }
+
+    put(record);
+}
+
+/*
+ * Run the operation in a write transaction and commit it. Should the map
+ * fill up, the transaction is aborted, the map grown and the operation run
+ * again from scratch; so it must not have effects beyond the database,
+ * bar metrics.
+ */
+template<typename Operation>
+void
+Database::transact(const Operation &op)
+{
+    for (;;) {
+        const size_t size = mapsize;
+
+        try {
+            Transaction txn(*this);
+
+            op(txn);
+            txn.commit();
+            ++transactions;
+
+            return;
+        } catch (const lmdb::map_full_error &e) {
+            // Aborted, and the gate released, on the way out of the block
+        }
+
+        grow(size * 2); // Unless another thread did meanwhile
+    }
+}
+
+/*
+ * Grow the map to at least the given size, doubling it as often as needed.
+ * Waits for every transaction to end, so never call it with one open. False
+ * if the map is that large already.
+ */
+bool
+Database::grow(size_t size)
+{
+    boost::unique_lock<boost::shared_mutex> l(gate);
+    size_t next = mapsize;
+
+    if (next >= size)
+        return false;
+
+    while (next < size)
+        next *= 2;
+
+    lmdb_env.set_mapsize(next);
+    mapsize = next;
+    ++resizes;
+
+    return true;
+}
+
+/*
+ * Hand a parsed file to the writer, waiting for room if its backlog is full,
+ * of changes or of the bytes they hold; an empty backlog takes a change of
+ * any size. The writer is woken by the first change of a group and by a
+ * full group.
+ */
+void
+Database::write(Change &c)
+{
+    std::unique_lock<std::mutex> l(writes.lock);
+
+    c.bytes = sizeof(c) + c.path.size() + c.picture.size();
+
+    if (!writes.changes.empty() &&
+        (writes.changes.size() >= WRITE_BACKLOG ||
+         writes.bytes + c.bytes > WRITE_BACKLOG_BYTES)) {
+        utility::Timer t;
+
+        t.start();
+        writes.dequeued.wait(l, [this, &c] {
+            return writes.changes.empty() ||
+                   (writes.changes.size() < WRITE_BACKLOG &&
+                    writes.bytes + c.bytes <= WRITE_BACKLOG_BYTES);
+        });
+        t.stop();
+
+        const utility::Timer::Duration d(t.elapsed());
+        local().waited += d.seconds + d.nanoseconds / 1000000000.0;
+    }
+
+    writes.bytes += c.bytes;
+    writes.changes.push_back(std::move(c));
+
+    if (writes.changes.size() == 1 || writes.changes.size() == WRITE_GROUP)
+        writes.queued.notify_one();
+}
+
+/*
+ * Metrics of the calling thread, which must be a worker of the pool or the
+ * writer, each only ever touching its own
+ */
+Database::Metrics&
+Database::local()
+{
+    if (std::this_thread::get_id() == writer.get_id())
+        return metrics.back();
+
+    return metrics[threads.index() + 1];
+}
+
+/*
+ * Committed by the writer with its next group, so neither the walkers nor
+ * the workers ever take the LMDB writer lock for a checkpoint. Never waits
+ * for room, as the writer queues checkpoints itself, and each is small.
+ */
+void
+Database::put(const Dir &d)
+{
+    lock_guard<std::mutex> l(writes.lock);
+
+    writes.dirs.push_back(d);
+
+    if (writes.dirs.size() == 1 || writes.dirs.size() == WRITE_GROUP)
+        writes.queued.notify_one();
+}
+
 } // verbatim
@@ -6,33 +6,100 @@
 #define VERBATIM_DATABASE_HPP
 
 // verbatim
+#include "Tag.hpp"
+#include "Picture.hpp"
 #include "Traverse.hpp"
+#include "BlobStore.hpp"
+#include "utility/Hash.hpp"
+#include "utility/Timer.hpp"
 #include "utility/ThreadPool.hpp"
 
 // lmdb++
 #include "lmdbxx/lmdb++.h"
 
+// boost
+#include <boost/thread/shared_mutex.hpp>
+#include <boost/utility/string_ref.hpp>
+
 // libstdc++
+#include <map>
+#include <mutex>
+#include <memory>
+#include <atomic>
 #include <string>
+#include <thread>
 #include <vector>
+#include <utility>
 #include <iostream>
+#include <unordered_map>
+#include <condition_variable>
+
+// libc
+#include <sys/stat.h>
 
 namespace verbatim {
 
+struct Key; // Forward declaration only
+namespace utility { class Ring; } // Ditto
+
 class Database
 {
     public:
+        /* Type definitions */
+        enum Index
+        {
+            BY_ARTIST = 0,
+            BY_ALBUM,
+            BY_GENRE,
+            BY_TITLE
+        };
+
+        struct Match
+        {
+            Index by;
+            std::string value; // As normalised
+            size_t distance; // Edits from what was searched for
+        };
+
         /* Methods/Member functions */
         Database(Traverse &t, utility::ThreadPool &tp);
         ~Database();
 
-        void open(const std::string &path);
+        void rebuild(); // Before open(), drop every entry to scan afresh
+        void open(const std::string &path, bool writable = true);
         void update(const std::string &path);
+        void incremental(); // Skip directories unchanged since last scan
+        void taglib(); // Parse every ID3v2 tag with TagLib, for comparison
+        void asynchronous(unsigned queue_depth); // Sniff files via io_uring
+        void locality(size_t window); // Read files in on-disk order
+        void flush(); // Submit files held back by the locality window
+        void drain(); // Block until the writer has committed all it was given
+
+        bool begin(const std::vector<std::string> &roots); // True if resumed
+        void interrupt(); // Abandon the scan, leaving it to be resumed
+        void end(); // Record the scan as complete
+        bool link(); // Record the hard links found, true if work submitted
+        inline bool interrupted() const { return stopped; }
+
+        void update(const Traverse::Path &p);
+        void remove(const std::string &path);
 
         void aggregate_metrics();
         void print_metrics(std::ostream &stream) const;
 
         size_t list_entries(std::ostream &stream) const;
+        size_t find(Index by,
+                    const std::string &value,
+                    std::vector<size_t> &keys) const; // Of Tag entries
+        size_t fuzzy(const std::string &text,
+                     std::vector<Match> &matches,
+                     size_t limit = 10) const; // Values near enough to text
+        void index_text(); // Bring the substring index up to date
+        size_t search(const std::string &pattern,
+                      std::vector<size_t> &keys,
+                      size_t limit = 0) const; // Ditto, by substring
+        bool tag(size_t key, Tag &t) const; // False if there is no such entry
+        bool image(size_t key, Img &i) const; // Ditto, picture and all
     public:
         /* Forward declarations */
         class Transaction;
@@ -41,45 +108,210 @@ class Database
     private:
         /* Forward declarations */
         struct Janitor; // For cleaning stale entries
+        struct Remover; // For removing the entry of a known path
         struct Maintainer; // For maintaining new and existing entries
+        struct Linker; // For recording hard links against their entries
+        struct Writer; // For committing what the workers parsed, in groups
 
         /* Type definitions */
-        class RegisterPath : public Traverse::Callback
+        class RegisterPaths : public Traverse::BatchCallback
         {
             public:
-                RegisterPath(Database &d);
-                void operator() (const Traverse::Path &p);
+                RegisterPaths(Database &d);
+                void operator() (const Traverse::Batch &b);
             private:
                 Database &db;
         };
 
+        class CheckDirectory : public Traverse::Filter
+        {
+            public:
+                CheckDirectory(Database &d);
+                bool operator() (const Traverse::Path &p, size_t entries);
+            private:
+                Database &db;
+        };
+
+        /*
+         * Of tags read by a parser
+         */
+        struct Reads
+        {
+            ssize_t files;
+            uint64_t bytes;
+            double seconds;
+            Reads() : files(0), bytes(0), seconds(0.0) {}
+        };
+
         struct Metrics
         {
-            ssize_t lookups, added, removed, updated;
-            Metrics() : lookups(0), added(0), removed(0), updated(0) {}
+            ssize_t lookups, added, removed, updated, parsed, unchanged;
+            ssize_t hashed, recognised; // Pictures, the latter by fingerprint
+            Reads native, taglib; // The latter also of those native could not
+            double waited; // Seconds blocked on the writer's backlog
+            Metrics() :
+                lookups(0),
+                added(0),
+                removed(0),
+                updated(0),
+                parsed(0),
+                unchanged(0),
+                hashed(0),
+                recognised(0),
+                waited(0.0) {}
+        };
+
+        /*
+         * What a worker parsed of a file, left to the writer to record. The
+         * picture is in the parser's own buffer, shared rather than copied,
+         * and let go of before it is queued if already stored.
+         */
+        struct Change
+        {
+            std::string path;
+            struct stat info;
+            Tag tag;
+            Img img; // Size and type of the picture, its data is in picture
+            std::shared_ptr<const void> buffer; // Holding the picture
+            boost::string_ref picture;
+            Fingerprint fingerprint;
+            utility::Hash128::Digest image; // Of picture, 0 if there is none
+            bool hashed; // Its fingerprint is new, recorded with it
+            size_t bytes; // Held while queued, mostly of the picture
+            Change() : hashed(false), bytes(0) {}
+        };
+
+        /*
+         * The writer's backlog, and the sizes of the groups committed. The
+         * records of directories done with are committed with the changes.
+         */
+        struct Writes
+        {
+            std::mutex lock;
+            std::condition_variable queued, dequeued;
+            std::vector<Change> changes;
+            std::vector<Dir> dirs;
+            size_t bytes; // Held by the changes
+            bool busy, draining, stopping;
+            size_t commits, committed, largest;
+            size_t collisions; // Pictures of the key of another, not linked
+            Writes() :
+                bytes(0),
+                busy(false),
+                draining(false),
+                stopping(false),
+                commits(0),
+                committed(0),
+                largest(0),
+                collisions(0) {}
+        };
+
+        /*
+         * (st_dev, physical position) and index into the window's files
+         */
+        typedef std::pair<std::pair<uint64_t, uint64_t>, size_t> Position;
+
+        struct Window
+        {
+            std::mutex lock;
+            size_t window; // Of files, 0 if disabled
+            Traverse::Batch files;
+            std::vector<Position> positions;
+            Window() : window(0) {}
+        };
+
+        /*
+         * A directory whose record is only written, as a checkpoint, once
+         * every one of its entries has been dealt with
+         */
+        struct Checkpoint
+        {
+            Dir record;
+            size_t outstanding; // Entries not yet dealt with
+        };
+
+        struct Checkpoints
+        {
+            std::mutex lock;
+            std::unordered_map<std::string, Checkpoint> directories;
+        };
+
+        /*
+         * Paths of each multiply linked file seen by the scan, in order
+         * seen. Only the first is parsed, the others become its aliases.
+         */
+        typedef std::pair<dev_t, ino_t> Inode;
+        typedef std::map<Inode, std::vector<std::string> > Paths;
+
+        struct Links
+        {
+            std::mutex lock;
+            Paths files;
         };
 
         /* Attributes/member variables */
         lmdb::env lmdb_env;
+        std::vector<MDB_dbi> tables; // Named databases, see open()
+        mutable boost::shared_mutex gate; // Shared by transactions
+        std::atomic<size_t> mapsize, resizes; // Of the map, in bytes
+        std::atomic<size_t> transactions; // Write transactions committed
+        std::atomic<size_t> found; // Audio files found by the traversal
+        std::string location; // Of the environment, and the text index
+        BlobStore blobs; // Pictures, kept out of the environment
+
+        size_t text_documents, text_changed; // Of the text index, as updated
+        double text_seconds; // Spent bringing the text index up to date
 
+        std::atomic<size_t> skipped; // Files not recognised as audio
+        std::atomic<size_t> aliased; // Hard links not parsed again
+        unsigned queue_depth; // Of the per-walker rings, 0 if synchronous
         double spread; // Approximation of distribution efficiency
-        std::vector<Metrics> metrics; // Per-thread metrics
+        double files_per_second; // Parsed by TagLib
+        std::once_flag parse_started;
+        utility::Timer parse_timer;
+        Window pending;
+        Checkpoints checkpoints;
+        Links links;
+        Writes writes;
+        Scan scan; // The one in progress
+        bool skip_unchanged, resuming, taglib_only, rebuilding;
+        std::atomic<bool> stopped;
+        std::vector<Metrics> metrics; // Per-thread metrics, writer's last
 
         Traverse &traverser;
-        RegisterPath new_path;
+        RegisterPaths new_paths;
+        CheckDirectory changed_dir;
 
         utility::ThreadPool &threads;
+        std::thread writer;
 
         /* Methods/Member functions */
-        template<typename Impl> size_t visit(Visitor<Impl> &v);
         template<typename Impl> size_t visit(Visitor<Impl> &v) const;
+        template<typename Value, typename Impl>
+        size_t visit(Visitor<Impl> &v, Transaction &txn) const;
 
         /* Methods/Member functions (Entry) */
         template<typename Value> bool lookup(Entry<Value> &e, Transaction &txn);
         template<typename Value> void update(const Entry<Value> &e, Transaction &txn);
 
+        template<typename Operation> void transact(const Operation &op);
+        bool grow(size_t size);
+
+        void remove(Entry<Tag> &e, Transaction &txn);
+        void forget(const Key &k, const std::string &path, Transaction &txn);
+        void attach(const Key &tag, const Key &img, Transaction &txn);
+        void detach(const Key &tag, const Key &img, Transaction &txn);
+
         /* Methods/Member functions (Path) */
-        void update(const Traverse::Path &p);
+        void update(const Traverse::Batch &b, bool dedupe = true);
+        bool update(const Traverse::Path &p, size_t entries);
+        void checkpoint(const char *path); // An entry of a directory is done
+        void put(const Dir &d); // Left to the writer
+        void write(Change &c); // Blocks while the writer's backlog is full
+        void submit(const Traverse::Batch &files,
+                    std::vector<Position> &positions);
+        utility::Ring* ring();
+        Metrics& local(); // Metrics of the calling worker, or the writer
 
         /* Friend classes */
         template<typename Impl> friend class Visitor;
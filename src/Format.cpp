@@ -0,0 +1,293 @@
+/*
+ * vim: set smartindent autoindent expandtab tabstop=4 shiftwidth=4:
+ */
+
+// Interface
+#include "Format.hpp"
+
+// verbatim
+#include "utility/Ring.hpp"
+
+// libstdc++
+#include <vector>
+#include <algorithm>
+
+// libc
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace {
+
+typedef const unsigned char Byte;
+
+/*
+ * ID3v2 header: "ID3", a major and revision byte (never 0xFF), flags and
+ * a 28-bit synchsafe size (the MSB of each of the four bytes is clear)
+ */
+bool
+is_id3v2(Byte *b, size_t size)
+{
+    return size >= 10 &&
+           b[0] == 'I' && b[1] == 'D' && b[2] == '3' &&
+           b[3] != 0xFF && b[4] != 0xFF &&
+           ((b[6] | b[7] | b[8] | b[9]) & 0x80) == 0;
+}
+
+/*
+ * MPEG audio frame header: 11 bits of frame sync followed by a version
+ * and layer that are not the reserved values, and a valid bitrate index
+ */
+bool
+is_mpeg_frame(Byte *b, size_t size)
+{
+    return size >= 4 &&
+           b[0] == 0xFF && (b[1] & 0xE0) == 0xE0 &&
+           (b[1] & 0x18) != 0x08 && // Version 01 is reserved
+           (b[1] & 0x06) != 0x00 && // Layer 00 is reserved
+           (b[2] & 0xF0) != 0xF0;   // Bitrate index 1111 is invalid
+}
+
+bool
+is_flac(Byte *b, size_t size)
+{
+    return size >= 4 &&
+           b[0] == 'f' && b[1] == 'L' && b[2] == 'a' && b[3] == 'C';
+}
+
+/*
+ * Ogg page header: "OggS" and a stream structure version of 0
+ */
+bool
+is_ogg(Byte *b, size_t size)
+{
+    return size >= 5 &&
+           b[0] == 'O' && b[1] == 'g' && b[2] == 'g' && b[3] == 'S' &&
+           b[4] == 0;
+}
+
+/*
+ * Brands of ISO base media files: those audio may be of, iTunes' own and
+ * the generic ones of any media, and those of still images or video
+ */
+enum Brand
+{
+    OTHER_BRAND = 0,
+    AUDIO_BRAND,
+    VISUAL_BRAND
+};
+
+struct Brands
+{
+    Brand brand;
+    char fourcc[4];
+};
+
+const Brands brands[] = {
+    {AUDIO_BRAND, {'M', '4', 'A', ' '}},
+    {AUDIO_BRAND, {'M', '4', 'B', ' '}},
+    {AUDIO_BRAND, {'M', '4', 'P', ' '}},
+    {AUDIO_BRAND, {'F', '4', 'A', ' '}},
+    {AUDIO_BRAND, {'F', '4', 'B', ' '}},
+    {AUDIO_BRAND, {'m', 'p', '4', '1'}},
+    {AUDIO_BRAND, {'m', 'p', '4', '2'}},
+    {AUDIO_BRAND, {'i', 's', 'o', 'm'}},
+    {AUDIO_BRAND, {'i', 's', 'o', '2'}},
+    {AUDIO_BRAND, {'d', 'a', 's', 'h'}},
+    {AUDIO_BRAND, {'3', 'g', 'p', '4'}},
+    {AUDIO_BRAND, {'3', 'g', 'p', '5'}},
+    {AUDIO_BRAND, {'3', 'g', 'p', '6'}},
+    {VISUAL_BRAND, {'M', '4', 'V', ' '}},
+    {VISUAL_BRAND, {'M', '4', 'V', 'H'}},
+    {VISUAL_BRAND, {'M', '4', 'V', 'P'}},
+    {VISUAL_BRAND, {'m', 'i', 'f', '1'}},
+    {VISUAL_BRAND, {'m', 's', 'f', '1'}},
+    {VISUAL_BRAND, {'h', 'e', 'i', 'c'}},
+    {VISUAL_BRAND, {'h', 'e', 'i', 'x'}},
+    {VISUAL_BRAND, {'h', 'e', 'v', 'c'}},
+    {VISUAL_BRAND, {'h', 'e', 'v', 'x'}},
+    {VISUAL_BRAND, {'a', 'v', 'i', 'f'}},
+    {VISUAL_BRAND, {'a', 'v', 'i', 's'}}
+};
+
+Brand
+brand(Byte *b)
+{
+    for (size_t i = 0 ; i < sizeof(brands) / sizeof(brands[0]) ; ++i) {
+        if (memcmp(b, brands[i].fourcc, 4) == 0)
+            return brands[i].brand;
+    }
+
+    return OTHER_BRAND;
+}
+
+/*
+ * ISO base media file: a leading ftyp box, its 32-bit size first, then the
+ * major brand, a minor version and the compatible brands, as many as were
+ * read. Audio if any brand is one audio may be of and none is of images or
+ * video; whether there is a sound track is left to the MP4 reader.
+ */
+bool
+is_mp4(Byte *b, size_t size)
+{
+    if (size < 12 ||
+        b[4] != 'f' || b[5] != 't' || b[6] != 'y' || b[7] != 'p')
+        return false;
+
+    const size_t box = size_t(b[0]) << 24 | b[1] << 16 | b[2] << 8 | b[3];
+    const size_t end = std::min(size, std::max<size_t>(box, 12));
+    bool audio = false;
+
+    for (size_t at = 8 ; at + 4 <= end ; at += at == 8 ? 8 : 4) {
+        switch (brand(b + at)) {
+            case AUDIO_BRAND:
+                audio = true;
+                break;
+            case VISUAL_BRAND:
+                return false;
+            default:
+                break;
+        }
+    }
+
+    return audio;
+}
+
+/*
+ * Bytes worth reading ahead for the tag parser: all of an ID3v2 tag plus
+ * enough to find the first audio frame after it, or nothing if untagged
+ */
+size_t
+prefetch_size(Byte *b, size_t size)
+{
+    static const size_t slack = 4096;
+
+    if (!is_id3v2(b, size))
+        return 0;
+
+    return 10 + ((b[6] << 21) | (b[7] << 14) | (b[8] << 7) | b[9]) + slack;
+}
+
+struct Magic
+{
+    verbatim::Format format;
+    bool (*match)(Byte *b, size_t size);
+};
+
+/*
+ * Checked in order, first match wins
+ */
+const Magic magics[] = {
+    {verbatim::MPEG_FORMAT, &is_id3v2},
+    {verbatim::FLAC_FORMAT, &is_flac},
+    {verbatim::OGG_FORMAT, &is_ogg},
+    {verbatim::MP4_FORMAT, &is_mp4},
+    {verbatim::MPEG_FORMAT, &is_mpeg_frame}
+};
+
+} // anonymous
+
+namespace verbatim {
+
+Format
+sniff(const char *buffer, size_t size)
+{
+    Byte *b = reinterpret_cast<Byte*>(buffer);
+
+    for (size_t i = 0 ; i < sizeof(magics) / sizeof(magics[0]) ; ++i) {
+        if (magics[i].match(b, size))
+            return magics[i].format;
+    }
+
+    return UNKNOWN_FORMAT;
+}
+
+Format
+sniff(const char *path)
+{
+    char buffer[SNIFF_SIZE];
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd == -1)
+        return UNKNOWN_FORMAT;
+
+    const ssize_t n = pread(fd, buffer, SNIFF_SIZE, 0);
+    close(fd);
+
+    return n > 0 ? sniff(buffer, n) : UNKNOWN_FORMAT;
+}
+
+/*
+ * Three rounds per chunk of paths: open them all, read the leading bytes of
+ * each, then advise the tag region of those recognised. A chunk is half the
+ * queue depth as the rounds are submitted together whenever possible.
+ */
+void
+sniff(utility::Ring &ring,
+      const char *const *paths,
+      size_t n,
+      Format *formats)
+{
+    static const int flags = O_RDONLY | O_CLOEXEC;
+    const size_t chunk = std::max(ring.depth() / 2, 1U);
+    std::vector<int> fds(std::min(chunk, n));
+    std::vector<char> buffers(fds.size() * SNIFF_SIZE);
+    uint64_t i;
+    int result;
+
+    for (size_t first = 0 ; first < n ; first += chunk) {
+        const size_t count = std::min(chunk, n - first);
+        size_t queued = 0, advised = 0;
+
+        for (size_t j = 0 ; j < count ; ++j) {
+            formats[first + j] = UNKNOWN_FORMAT;
+            fds[j] = -1;
+
+            if (ring.openat(AT_FDCWD, paths[first + j], flags, j))
+                ++queued;
+        }
+
+        ring.submit(queued);
+
+        for ( ; queued > 0 && ring.reap(i, result) ; --queued)
+            fds[i] = result; // Negative errno if the open failed
+
+        for (size_t j = 0 ; j < count ; ++j) {
+            if (fds[j] >= 0 &&
+                ring.read(fds[j], &buffers[j * SNIFF_SIZE], SNIFF_SIZE, 0, j))
+                ++queued;
+        }
+
+        ring.submit(queued);
+
+        for ( ; queued > 0 && ring.reap(i, result) ; --queued) {
+            if (result > 0)
+                formats[first + i] = sniff(&buffers[i * SNIFF_SIZE], result);
+
+            if (formats[first + i] == UNKNOWN_FORMAT)
+                continue;
+
+            const size_t size =
+                prefetch_size(reinterpret_cast<Byte*>(&buffers[i * SNIFF_SIZE]),
+                              result);
+
+            if (size > 0 &&
+                ring.fadvise(fds[i], 0, size, POSIX_FADV_WILLNEED, i))
+                ++advised;
+        }
+
+        /*
+         * The advice outlives the descriptor but the request must not
+         */
+        ring.submit(advised);
+
+        for ( ; advised > 0 && ring.reap(i, result) ; --advised);
+
+        for (size_t j = 0 ; j < count ; ++j) {
+            if (fds[j] >= 0)
+                close(fds[j]);
+        }
+    }
+}
+
+} // verbatim
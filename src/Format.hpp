@@ -0,0 +1,47 @@
+/*
+ * vim: set smartindent autoindent expandtab tabstop=4 shiftwidth=4:
+ */
+
+#ifndef VERBATIM_FORMAT_HPP
+#define VERBATIM_FORMAT_HPP
+
+// libc
+#include <stddef.h>
+
+namespace verbatim {
+
+namespace utility { class Ring; } // Forward declaration only
+
+/*
+ * Audio formats recognised by their leading (magic) bytes
+ */
+enum Format
+{
+    UNKNOWN_FORMAT = 0,
+    MPEG_FORMAT = 1, // ID3v2 tagged or a bare MPEG audio frame
+    FLAC_FORMAT = 2,
+    OGG_FORMAT = 3, // Vorbis or Opus, told apart by the first packet
+    MP4_FORMAT = 4 // ISO base media file of audio, AAC or ALAC in practice
+};
+
+/*
+ * No. of leading bytes read to identify any known format, enough for the
+ * brands of all but the most unusual MP4 file
+ */
+static const size_t SNIFF_SIZE = 64;
+
+Format sniff(const char *buffer, size_t size);
+Format sniff(const char *path); // Reads at most SNIFF_SIZE bytes
+
+/*
+ * As above for many paths at once, queued on the given ring. The tag region
+ * of each recognised file is also advised to the kernel as soon to be read.
+ */
+void sniff(utility::Ring &ring,
+           const char *const *paths,
+           size_t n,
+           Format *formats);
+
+} // verbatim
+
+#endif
@@ -0,0 +1,484 @@
+/*
+ * vim: set smartindent autoindent expandtab tabstop=4 shiftwidth=4:
+ */
+
+// Interface
+#include "ID3v2.hpp"
+
+// verbatim
+#include "Metadata.hpp"
+#include "utility/Text.hpp"
+
+// libstdc++
+#include <vector>
+#include <algorithm>
+
+// libc
+#include <ctype.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+using std::string;
+using std::vector;
+
+namespace {
+
+typedef const unsigned char Byte;
+
+static const size_t HEADER_SIZE = 10; // Of the tag, as of a 2.3/2.4 frame
+
+/*
+ * Header flags
+ */
+static const unsigned TAG_UNSYNCHRONISED = 0x80;
+static const unsigned TAG_EXTENDED = 0x40; // Compressed, in 2.2
+
+/*
+ * Frame format flags, of 2.3 and 2.4 in turn
+ */
+static const unsigned V3_COMPRESSED = 0x80;
+static const unsigned V3_ENCRYPTED = 0x40;
+static const unsigned V3_GROUPED = 0x20;
+static const unsigned V4_GROUPED = 0x40;
+static const unsigned V4_COMPRESSED = 0x08;
+static const unsigned V4_ENCRYPTED = 0x04;
+static const unsigned V4_UNSYNCHRONISED = 0x02;
+static const unsigned V4_LENGTH = 0x01;
+
+enum Field
+{
+    TITLE = 0,
+    ARTIST,
+    ALBUM,
+    GENRE,
+    PICTURE,
+    FIELDS,
+    UNWANTED = FIELDS
+};
+
+/*
+ * Identifiers of the fields above, 2.3/2.4 then 2.2
+ */
+const char *const IDS[FIELDS][2] = {
+    {"TIT2", "TT2"},
+    {"TPE1", "TP1"},
+    {"TALB", "TAL"},
+    {"TCON", "TCO"},
+    {"APIC", "PIC"}
+};
+
+inline
+uint32_t
+synchsafe(Byte *b)
+{
+    return b[0] << 21 | b[1] << 14 | b[2] << 7 | b[3];
+}
+
+inline
+uint32_t
+big_endian(Byte *b, size_t n)
+{
+    uint32_t v = 0;
+
+    for (size_t i = 0 ; i < n ; ++i)
+        v = v << 8 | b[i];
+
+    return v;
+}
+
+/*
+ * Drops the zero unsynchronisation puts after each 0xFF, in place. The size
+ * left.
+ */
+size_t
+resynchronise(char *data, size_t size)
+{
+    size_t out = 0;
+
+    for (size_t i = 0 ; i < size ; ++i) {
+        data[out++] = data[i];
+
+        if (Byte(data[i]) == 0xFF && i + 1 < size && data[i + 1] == 0)
+            ++i;
+    }
+
+    return out;
+}
+
+Field
+field(const char *id, size_t size)
+{
+    const size_t version = size == 3 ? 1 : 0;
+
+    for (size_t i = 0 ; i < FIELDS ; ++i) {
+        if (memcmp(IDS[i][version], id, size) == 0)
+            return Field(i);
+    }
+
+    return UNWANTED;
+}
+
+/*
+ * Bytes up to the terminator of a string of the encoding given, which is
+ * two zero bytes at an even offset for UTF-16, one otherwise
+ */
+size_t
+terminated(const char *data, size_t size, unsigned encoding)
+{
+    if (encoding == 1 || encoding == 2) {
+        for (size_t i = 0 ; i + 1 < size ; i += 2) {
+            if (data[i] == 0 && data[i + 1] == 0)
+                return i;
+        }
+
+        return size;
+    }
+
+    return std::find(data, data + size, '\0') - data;
+}
+
+/*
+ * UTF-16 with a byte order mark (encoding 1) is big endian without one
+ */
+void
+decode(const char *data, size_t size, unsigned encoding, string &utf8)
+{
+    switch (encoding) {
+        case 0:
+            verbatim::utility::latin1_to_utf8(data, size, utf8);
+            break;
+        case 1: {
+                Byte *b = reinterpret_cast<Byte*>(data);
+                const uint32_t bom = size >= 2 ? big_endian(b, 2) : 0;
+                const bool big = bom != 0xFFFE;
+
+                if (bom == 0xFEFF || bom == 0xFFFE) {
+                    data += 2;
+                    size -= 2;
+                }
+
+                verbatim::utility::utf16_to_utf8(data, size, big, utf8);
+            }
+            break;
+        case 2:
+            verbatim::utility::utf16_to_utf8(data, size, true, utf8);
+            break;
+        default:
+            verbatim::utility::utf8_to_utf8(data, size, utf8);
+    }
+}
+
+/*
+ * The values of a text frame, empty ones left out as TagLib does
+ */
+void
+values(const char *data, size_t size, vector<string> &v)
+{
+    v.clear();
+
+    if (size == 0)
+        return;
+
+    const unsigned encoding = Byte(data[0]);
+    const size_t terminator = encoding == 1 || encoding == 2 ? 2 : 1;
+
+    for (size_t at = 1 ; at < size ; ) {
+        const size_t n = terminated(data + at, size - at, encoding);
+        string value;
+
+        decode(data + at, n, encoding, value);
+
+        if (!value.empty())
+            v.push_back(value);
+
+        at += n + terminator;
+    }
+}
+
+string
+joined(const vector<string> &v)
+{
+    string s;
+
+    for (size_t i = 0 ; i < v.size() ; ++i) {
+        if (i > 0)
+            s += ' ';
+        s += v[i];
+    }
+
+    return s;
+}
+
+/*
+ * Before 2.4 genres were referred to by number in parentheses, "(17)Rock";
+ * in 2.4 by number alone, each its own value. Numbers are named, and each
+ * genre is given only once.
+ */
+string
+genres(const vector<string> &v, unsigned version)
+{
+    vector<string> references, named;
+
+    for (size_t i = 0 ; i < v.size() ; ++i) {
+        string s(v[i]);
+
+        while (version < 4 && s.size() > 2 && s[0] == '(' && s[1] != '(') {
+            const size_t close = s.find(')');
+
+            if (close == string::npos)
+                break;
+
+            references.push_back(s.substr(1, close - 1));
+            s.erase(0, close + 1);
+        }
+
+        if (!s.empty())
+            references.push_back(s);
+    }
+
+    for (size_t i = 0 ; i < references.size() ; ++i) {
+        string &s = references[i];
+        const bool number = !s.empty() && s.size() <= 3 &&
+                            s.find_first_not_of("0123456789") == string::npos;
+
+        if (number) {
+            s = verbatim::id3v1_genre(atoi(s.c_str()));
+        }
+
+        if (std::find(named.begin(), named.end(), s) == named.end())
+            named.push_back(s);
+    }
+
+    return joined(named);
+}
+
+/*
+ * APIC: encoding, MIME type, picture type, description, then the picture;
+ * PIC, of 2.2, has a three letter image format in place of the MIME type
+ */
+void
+picture(const char *data,
+        size_t size,
+        unsigned version,
+        string &mimetype,
+        boost::string_ref &picture)
+{
+    if (size < 2)
+        return;
+
+    const unsigned encoding = Byte(data[0]);
+    size_t at = 1;
+
+    if (version == 2) {
+        if (size < 5)
+            return;
+
+        string format(data + at, 3);
+
+        for (size_t i = 0 ; i < format.size() ; ++i)
+            format[i] = tolower(Byte(format[i]));
+        mimetype = "image/" + (format == "jpg" ? string("jpeg") : format);
+        at += 3;
+    } else {
+        const size_t n = terminated(data + at, size - at, 0);
+
+        mimetype.assign(data + at, n);
+        at += n + 1;
+    }
+
+    at += 1; // Picture type
+
+    if (at >= size)
+        return;
+
+    at += terminated(data + at, size - at, encoding) +
+          (encoding == 1 || encoding == 2 ? 2 : 1);
+
+    if (at < size)
+        picture = boost::string_ref(data + at, size - at);
+}
+
+/*
+ * Frames are read in place, each in one pass; those that are wanted and
+ * unsynchronised are decoded in place first
+ */
+verbatim::Metadata::Result
+frames(verbatim::Metadata &t, char *data, size_t size)
+{
+    Byte *header = reinterpret_cast<Byte*>(data);
+    const unsigned version = header[3], flags = header[5];
+    const size_t id_size = version == 2 ? 3 : 4;
+    const size_t frame_header = version == 2 ? 6 : HEADER_SIZE;
+    bool seen[FIELDS] = {false};
+    vector<string> v;
+    size_t at = HEADER_SIZE;
+
+    if (version == 2 && (flags & TAG_EXTENDED))
+        return verbatim::Metadata::UNREADABLE; // Compressed, never defined
+
+    if (version < 4 && (flags & TAG_UNSYNCHRONISED))
+        size = HEADER_SIZE + resynchronise(data + at, size - at);
+
+    if (version > 2 && (flags & TAG_EXTENDED)) {
+        if (size < at + 4)
+            return verbatim::Metadata::UNREADABLE;
+
+        Byte *b = header + at;
+        at += version == 3 ? 4 + big_endian(b, 4) : synchsafe(b);
+    }
+
+    while (at + frame_header <= size && data[at] != 0) { // Else padding
+        Byte *b = header + at;
+        const char *id = data + at;
+
+        for (size_t i = 0 ; i < id_size ; ++i) {
+            if ((id[i] < 'A' || id[i] > 'Z') && (id[i] < '0' || id[i] > '9'))
+                return verbatim::Metadata::UNREADABLE;
+        }
+
+        /*
+         * Frames of iTunes' 2.4 tags are sized as 2.3's were
+         */
+        size_t n = version == 2 ? big_endian(b + 3, 3) :
+                   version == 3 || (b[4] | b[5] | b[6] | b[7]) & 0x80 ?
+                   big_endian(b + 4, 4) : synchsafe(b + 4);
+        const unsigned format = version == 2 ? 0 : b[9];
+
+        if (n > size - at - frame_header)
+            return verbatim::Metadata::UNREADABLE;
+
+        char *content = data + at + frame_header;
+        const Field f = field(id, id_size);
+
+        at += frame_header + n;
+
+        if (f == UNWANTED || seen[f])
+            continue;
+
+        seen[f] = true;
+
+        if (version == 3) {
+            if (format & (V3_COMPRESSED | V3_ENCRYPTED))
+                return verbatim::Metadata::UNREADABLE;
+
+            if (format & V3_GROUPED && n > 0)
+                ++content, --n;
+        } else if (version == 4) {
+            if (format & (V4_COMPRESSED | V4_ENCRYPTED))
+                return verbatim::Metadata::UNREADABLE;
+
+            const size_t skipped = (format & V4_GROUPED ? 1 : 0) +
+                                   (format & V4_LENGTH ? 4 : 0);
+
+            if (skipped > n)
+                return verbatim::Metadata::UNREADABLE;
+
+            content += skipped;
+            n -= skipped;
+
+            if ((format & V4_UNSYNCHRONISED) || (flags & TAG_UNSYNCHRONISED))
+                n = resynchronise(content, n);
+        }
+
+        if (f == PICTURE) {
+            picture(content, n, version, t.mimetype, t.picture);
+            continue;
+        }
+
+        values(content, n, v);
+
+        switch (f) {
+            case TITLE:
+                t.title = joined(v);
+                break;
+            case ARTIST:
+                t.artist = joined(v);
+                break;
+            case ALBUM:
+                t.album = joined(v);
+                break;
+            default:
+                t.genre = genres(v, version);
+        }
+    }
+
+    return verbatim::Metadata::READ;
+}
+
+/*
+ * Header: "ID3", a major version and revision byte (never 0xFF), flags and
+ * a 28-bit synchsafe size of what follows it
+ */
+verbatim::Metadata::Result
+header(Byte *b, size_t size, size_t &tag_size)
+{
+    if (size < HEADER_SIZE || b[0] != 'I' || b[1] != 'D' || b[2] != '3')
+        return verbatim::Metadata::ABSENT;
+
+    if (b[3] < 2 || b[3] > 4 || b[4] == 0xFF ||
+        ((b[6] | b[7] | b[8] | b[9]) & 0x80) != 0)
+        return verbatim::Metadata::UNREADABLE;
+
+    tag_size = HEADER_SIZE + synchsafe(b + 6);
+
+    return verbatim::Metadata::READ;
+}
+
+} // anonymous
+
+namespace verbatim {
+
+Metadata::Result
+read_id3v2(int fd, Metadata &m)
+{
+    char head[HEADER_SIZE];
+    size_t size = 0;
+
+    if (!read_at(fd, head, sizeof(head), 0, m))
+        return Metadata::ABSENT;
+
+    const Metadata::Result r =
+        header(reinterpret_cast<Byte*>(head), sizeof(head), size);
+
+    if (r != Metadata::READ)
+        return r;
+
+    m.audio = size;
+
+    const std::shared_ptr<char> tag(allocate(size));
+
+    memcpy(tag.get(), head, sizeof(head));
+
+    if (!read_at(fd, tag.get() + sizeof(head), size - sizeof(head),
+                 sizeof(head), m))
+        return Metadata::UNREADABLE; // Cut short
+
+    m.buffer = tag;
+
+    return frames(m, tag.get(), size);
+}
+
+Metadata::Result
+read_id3v2(const char *data, size_t size, Metadata &m)
+{
+    size_t tag_size = 0;
+    const Metadata::Result r =
+        header(reinterpret_cast<Byte*>(data), size, tag_size);
+
+    if (r != Metadata::READ)
+        return r;
+
+    if (tag_size > size)
+        return Metadata::UNREADABLE;
+
+    const std::shared_ptr<char> tag(allocate(tag_size));
+
+    memcpy(tag.get(), data, tag_size);
+    m.read += tag_size;
+    m.buffer = tag;
+
+    return frames(m, tag.get(), tag_size);
+}
+
+} // verbatim
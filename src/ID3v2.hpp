@@ -0,0 +1,27 @@
+/*
+ * vim: set smartindent autoindent expandtab tabstop=4 shiftwidth=4:
+ */
+
+#ifndef VERBATIM_ID3V2_HPP
+#define VERBATIM_ID3V2_HPP
+
+// verbatim
+#include "Metadata.hpp"
+
+// libc
+#include <stddef.h>
+
+namespace verbatim {
+
+/*
+ * An ID3v2.2, 2.3 or 2.4 tag at the start of a file, read without TagLib:
+ * one pread() of the header and one of the rest of the tag, nothing of the
+ * audio after it. Text is as TagLib has it (values of a frame joined by a
+ * space, genres by name) but as UTF-8. UNREADABLE tags are for TagLib.
+ */
+Metadata::Result read_id3v2(int fd, Metadata &m);
+Metadata::Result read_id3v2(const char *data, size_t size, Metadata &m);
+
+} // verbatim
+
+#endif // VERBATIM_ID3V2_HPP
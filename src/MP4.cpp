@@ -0,0 +1,321 @@
+/*
+ * vim: set smartindent autoindent expandtab tabstop=4 shiftwidth=4:
+ */
+
+// Interface
+#include "MP4.hpp"
+
+// verbatim
+#include "utility/Text.hpp"
+
+// libstdc++
+#include <string>
+#include <algorithm>
+
+// libc
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+
+using std::string;
+
+using verbatim::Metadata;
+
+namespace {
+
+typedef const unsigned char Byte;
+
+/*
+ * Well-known types of data boxes
+ */
+static const uint32_t UTF8 = 1;
+static const uint32_t UTF16 = 2; // Big endian
+static const uint32_t JPEG = 13;
+static const uint32_t PNG = 14;
+static const uint32_t BMP = 27;
+
+inline
+uint64_t
+big_endian(const char *p, size_t n)
+{
+    Byte *b = reinterpret_cast<Byte*>(p);
+    uint64_t v = 0;
+
+    for (size_t i = 0 ; i < n ; ++i)
+        v = v << 8 | b[i];
+
+    return v;
+}
+
+/*
+ * A box: its size (of the box, header and all) and type, a size of 1
+ * followed by a 64-bit size, a size of 0 to the end of its parent
+ */
+struct Box
+{
+    char type[4];
+    uint64_t content, end; // Offsets, of the file or of a buffer
+};
+
+bool
+header(const char *h, size_t available, uint64_t at, uint64_t end, Box &b)
+{
+    uint64_t size = big_endian(h, 4);
+
+    memcpy(b.type, h + 4, 4);
+    b.content = at + 8;
+
+    if (size == 1) {
+        if (available < 16)
+            return false;
+
+        size = big_endian(h + 8, 8);
+        b.content += 8;
+    } else if (size == 0) {
+        size = end - at;
+    }
+
+    if (size < b.content - at || size > end - at)
+        return false;
+
+    b.end = at + size;
+
+    return true;
+}
+
+/*
+ * The first child box of the type given, between at and end of the file,
+ * each box before it read no further than its header
+ */
+bool
+find(int fd, uint64_t at, uint64_t end, const char *type, Metadata &m, Box &b)
+{
+    while (end - at >= 8) {
+        char h[16];
+        const size_t n = end - at >= 16 ? 16 : 8;
+
+        if (!verbatim::read_at(fd, h, n, at, m) || !header(h, n, at, end, b))
+            return false;
+
+        if (memcmp(b.type, type, 4) == 0)
+            return true;
+
+        at = b.end;
+    }
+
+    return false;
+}
+
+/*
+ * Ditto, of a buffer
+ */
+bool
+find(const char *data, uint64_t at, uint64_t end, const char *type, Box &b)
+{
+    while (end - at >= 8) {
+        if (!header(data + at, end - at, at, end, b))
+            return false;
+
+        if (memcmp(b.type, type, 4) == 0)
+            return true;
+
+        at = b.end;
+    }
+
+    return false;
+}
+
+/*
+ * Each data box of an item: its type, a locale, then the value
+ */
+void
+item(const char *data, const Box &i, Metadata &m)
+{
+    Box d;
+
+    for (uint64_t at = i.content ; find(data, at, i.end, "data", d) ; ) {
+        at = d.end;
+
+        if (d.end - d.content < 8)
+            continue;
+
+        const uint32_t type = big_endian(data + d.content, 4) & 0xFFFFFF;
+        const char *value = data + d.content + 8;
+        const size_t size = d.end - d.content - 8;
+        string text;
+
+        if (memcmp(i.type, "covr", 4) == 0) {
+            if (!m.picture.empty() || size == 0)
+                continue;
+
+            m.picture = boost::string_ref(value, size);
+            m.mimetype = type == PNG ? "image/png" :
+                         type == BMP ? "image/bmp" : "image/jpeg";
+            continue;
+        }
+
+        if (memcmp(i.type, "gnre", 4) == 0) {
+            if (size >= 2 && big_endian(value, 2) > 0)
+                verbatim::append_value(
+                    m.genre, verbatim::id3v1_genre(big_endian(value, 2) - 1));
+            continue;
+        }
+
+        if (type == UTF8)
+            verbatim::utility::utf8_to_utf8(value, size, text);
+        else if (type == UTF16)
+            verbatim::utility::utf16_to_utf8(value, size, true, text);
+        else
+            continue;
+
+        if (memcmp(i.type, "\xA9nam", 4) == 0)
+            verbatim::append_value(m.title, text);
+        else if (memcmp(i.type, "\xA9" "ART", 4) == 0)
+            verbatim::append_value(m.artist, text);
+        else if (memcmp(i.type, "\xA9" "alb", 4) == 0)
+            verbatim::append_value(m.album, text);
+        else if (memcmp(i.type, "\xA9gen", 4) == 0)
+            verbatim::append_value(m.genre, text);
+    }
+}
+
+/*
+ * Of the first sound track: the timescale and duration of its media header
+ * and the channels and sample rate of its first sample entry, the bitrate
+ * of mdat over the duration. Headers alone are read, all but the few of
+ * those boxes no further than the box header. False if there is none.
+ */
+bool
+properties(int fd, const Box &moov, uint64_t end, Metadata &m)
+{
+    Box trak, mdia, hdlr, mdhd, minf, stbl, stsd, mdat;
+    char buffer[44];
+
+    for (uint64_t at = moov.content ;
+         find(fd, at, moov.end, "trak", m, trak) ;
+         at = trak.end) {
+        if (!find(fd, trak.content, trak.end, "mdia", m, mdia) ||
+            !find(fd, mdia.content, mdia.end, "hdlr", m, hdlr) ||
+            hdlr.end - hdlr.content < 12 ||
+            !verbatim::read_at(fd, buffer, 12, hdlr.content, m) ||
+            memcmp(buffer + 8, "soun", 4) != 0) // The handler type
+            continue;
+
+        /*
+         * Version and flags, then times of creation and modification, the
+         * timescale and duration, 32 bits each of version 0 and all but
+         * the timescale 64 of version 1
+         */
+        uint64_t timescale = 0, duration = 0;
+
+        if (find(fd, mdia.content, mdia.end, "mdhd", m, mdhd) &&
+            mdhd.end - mdhd.content >= 20) {
+            const size_t n = std::min<uint64_t>(mdhd.end - mdhd.content, 32);
+
+            if (!verbatim::read_at(fd, buffer, n, mdhd.content, m))
+                return true;
+
+            if (buffer[0] == 1 && n >= 32) {
+                timescale = big_endian(buffer + 20, 4);
+                duration = big_endian(buffer + 24, 8);
+            } else {
+                timescale = big_endian(buffer + 12, 4);
+                duration = big_endian(buffer + 16, 4);
+            }
+        }
+
+        /*
+         * Version, flags and a count of entries, then the entry: its box
+         * header, 8 bytes of reserved and reference, 8 of version,
+         * revision and vendor, then channels, sample size, compression and
+         * packet size of 16 bits each and a 16.16 sample rate
+         */
+        if (find(fd, mdia.content, mdia.end, "minf", m, minf) &&
+            find(fd, minf.content, minf.end, "stbl", m, stbl) &&
+            find(fd, stbl.content, stbl.end, "stsd", m, stsd) &&
+            stsd.end - stsd.content >= sizeof(buffer) &&
+            verbatim::read_at(fd, buffer, sizeof(buffer), stsd.content, m)) {
+            m.channels = big_endian(buffer + 32, 2);
+            m.sample_rate = big_endian(buffer + 40, 4) >> 16;
+        }
+
+        /*
+         * Rates of 64kHz and more don't fit, of a sound track the
+         * timescale is the sample rate
+         */
+        if (m.sample_rate == 0)
+            m.sample_rate = timescale;
+
+        if (timescale > 0)
+            m.duration = duration * 1000 / timescale;
+
+        if (m.duration > 0 && find(fd, 0, end, "mdat", m, mdat))
+            m.bitrate = (mdat.end - mdat.content) * 8 / m.duration;
+
+        return true;
+    }
+
+    return false;
+}
+
+} // anonymous
+
+namespace verbatim {
+
+/*
+ * Files without moov are malformed, those without a sound track not audio
+ * (of a generic brand, video or the like), those without meta or its ilst
+ * untagged
+ */
+Metadata::Result
+read_mp4(int fd, Metadata &m)
+{
+    struct stat info;
+    Box moov, udta, meta, ilst;
+
+    if (fstat(fd, &info) == -1)
+        return Metadata::UNREADABLE;
+
+    if (!find(fd, 0, info.st_size, "moov", m, moov))
+        return Metadata::UNREADABLE;
+
+    if (!properties(fd, moov, info.st_size, m))
+        return Metadata::NOT_AUDIO;
+
+    if (!find(fd, moov.content, moov.end, "udta", m, udta) ||
+        !find(fd, udta.content, udta.end, "meta", m, meta))
+        return Metadata::ABSENT;
+
+    const size_t size = meta.end - meta.content;
+    const std::shared_ptr<char> buffer(allocate(size));
+    const char *data = buffer.get();
+
+    if (!read_at(fd, buffer.get(), size, meta.content, m))
+        return Metadata::UNREADABLE;
+
+    /*
+     * A full box, its version and flags first, except as QuickTime writes
+     * it, where hdlr follows at once
+     */
+    const uint64_t first = size >= 8 && memcmp(data + 4, "hdlr", 4) == 0 ?
+                           0 : 4;
+
+    if (!find(data, first, size, "ilst", ilst))
+        return Metadata::ABSENT;
+
+    Box i;
+
+    for (uint64_t at = ilst.content ; at < ilst.end ; at = i.end) {
+        if (ilst.end - at < 8 || !header(data + at, ilst.end - at, at,
+                                         ilst.end, i))
+            return Metadata::UNREADABLE;
+
+        item(data, i, m);
+    }
+
+    m.buffer = buffer;
+
+    return Metadata::READ;
+}
+
+} // verbatim
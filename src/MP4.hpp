@@ -0,0 +1,23 @@
+/*
+ * vim: set smartindent autoindent expandtab tabstop=4 shiftwidth=4:
+ */
+
+#ifndef VERBATIM_MP4_HPP
+#define VERBATIM_MP4_HPP
+
+// verbatim
+#include "Metadata.hpp"
+
+namespace verbatim {
+
+/*
+ * iTunes style tags of an MP4 (M4A) file, the items of moov/udta/meta/ilst.
+ * Boxes are walked by their headers down to meta, which alone is read but
+ * for the heads of mdhd and stsd of the sound track, for its properties;
+ * the sample tables and the audio in mdat are not.
+ */
+Metadata::Result read_mp4(int fd, Metadata &m);
+
+} // verbatim
+
+#endif // VERBATIM_MP4_HPP
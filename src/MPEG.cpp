@@ -0,0 +1,238 @@
+/*
+ * vim: set smartindent autoindent expandtab tabstop=4 shiftwidth=4:
+ */
+
+// Interface
+#include "MPEG.hpp"
+
+// verbatim
+#include "ID3v2.hpp"
+
+// libstdc++
+#include <algorithm>
+
+// libc
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+
+using verbatim::Metadata;
+
+namespace {
+
+typedef const unsigned char Byte;
+
+static const size_t SEARCH_SIZE = 4096; // Of the audio, for its first frame
+
+/*
+ * From a frame header to the end of a LAME header after Xing's, at most
+ */
+static const size_t HEADERS_SIZE = 4 + 32 + 120 + 24;
+
+/*
+ * Bitrates (kbit/s) by index, of MPEG 1 layers I, II and III, then of
+ * MPEG 2 and 2.5 layer I and layers II and III. Index 0 is free format,
+ * of no bitrate to go by.
+ */
+const unsigned short BITRATES[5][15] = {
+    {0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448},
+    {0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384},
+    {0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320},
+    {0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256},
+    {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160}
+};
+
+/*
+ * Of MPEG 1, halved for MPEG 2 and quartered for 2.5
+ */
+const unsigned SAMPLE_RATES[3] = {44100, 48000, 32000};
+
+inline
+uint32_t
+big_endian32(Byte *b)
+{
+    return uint32_t(b[0]) << 24 | b[1] << 16 | b[2] << 8 | b[3];
+}
+
+struct Frame
+{
+    bool mpeg1, mono;
+    unsigned bitrate,       // kbit/s
+             sample_rate,   // Hz
+             samples,       // Per channel
+             size;          // Bytes, header and all
+};
+
+/*
+ * A frame header: 11 bits of sync, the version, layer, bitrate and sample
+ * rate, none of them reserved nor free format, then padding and the mode
+ */
+bool
+parse(Byte *b, Frame &f)
+{
+    if (b[0] != 0xFF || (b[1] & 0xE0) != 0xE0)
+        return false;
+
+    const unsigned version = b[1] >> 3 & 3,
+                   layer = 4 - (b[1] >> 1 & 3),
+                   index = b[2] >> 4,
+                   rate = b[2] >> 2 & 3,
+                   padding = b[2] >> 1 & 1;
+
+    if (version == 1 || layer == 4 || index == 0 || index == 15 || rate == 3)
+        return false;
+
+    f.mpeg1 = version == 3;
+    f.mono = b[3] >> 6 == 3;
+    f.bitrate = BITRATES[f.mpeg1 ? layer - 1 : layer == 1 ? 3 : 4][index];
+    f.sample_rate = SAMPLE_RATES[rate] >> (f.mpeg1 ? 0 : version == 2 ? 1 : 2);
+    f.samples = layer == 1 ? 384 : layer == 2 || f.mpeg1 ? 1152 : 576;
+    f.size = layer == 1 ?
+             (12 * f.bitrate * 1000 / f.sample_rate + padding) * 4 :
+             f.samples / 8 * f.bitrate * 1000 / f.sample_rate + padding;
+
+    return true;
+}
+
+/*
+ * The first frame followed by another of the same version, layer and
+ * sample rate, unless it runs past what there is to tell by: a 0xFF of
+ * padding or junk, where the audio would be, is passed over
+ */
+bool
+first(Byte *b, size_t size, size_t &at, Frame &f)
+{
+    for (at = 0 ; at + 4 <= size ; ++at) {
+        const void *sync = memchr(b + at, 0xFF, size - 3 - at);
+        Frame next;
+
+        if (!sync)
+            return false;
+
+        at = static_cast<Byte*>(sync) - b;
+
+        if (!parse(b + at, f))
+            continue;
+
+        if (at + f.size + 4 > size)
+            return true;
+
+        if (parse(b + at + f.size, next) &&
+            next.mpeg1 == f.mpeg1 &&
+            next.samples == f.samples &&
+            next.sample_rate == f.sample_rate)
+            return true;
+    }
+
+    return false;
+}
+
+} // anonymous
+
+namespace verbatim {
+
+Metadata::Result
+read_mpeg(int fd, Metadata &m)
+{
+    const Metadata::Result r = read_id3v2(fd, m);
+
+    if (r == Metadata::READ)
+        read_mpeg_properties(fd, m);
+
+    return r;
+}
+
+/*
+ * Xing (Info if CBR) follows the side information of the frame, VBRI
+ * always 32 bytes of it, with the counts of frames and bytes of the
+ * stream. LAME writes its own header 120 bytes after Xing's whatever
+ * Xing's flags, with the samples of delay and padding added by the
+ * encoder, as FFmpeg (Lavf, Lavc) does.
+ */
+bool
+read_mpeg_properties(int fd, Metadata &m)
+{
+    struct stat info;
+    char buffer[SEARCH_SIZE];
+    Byte *b = reinterpret_cast<Byte*>(buffer);
+    size_t at = 0;
+    Frame f;
+
+    if (fstat(fd, &info) == -1 || info.st_size <= m.audio)
+        return false;
+
+    size_t size = std::min<off_t>(info.st_size - m.audio, sizeof(buffer));
+
+    if (!read_at(fd, buffer, size, m.audio, m) || !first(b, size, at, f))
+        return false;
+
+    const off_t start = m.audio + at;
+
+    /*
+     * Found near the end of what was read, the headers are read again
+     */
+    if (size - at < HEADERS_SIZE && off_t(size) < info.st_size - m.audio) {
+        size = std::min<off_t>(info.st_size - start, HEADERS_SIZE);
+
+        if (!read_at(fd, buffer, size, start, m))
+            return false;
+    } else {
+        b += at;
+        size -= at;
+    }
+
+    const size_t xing = 4 + (f.mpeg1 ? (f.mono ? 17 : 32) : (f.mono ? 9 : 17));
+    const size_t vbri = 4 + 32, lame = xing + 120;
+    uint64_t frames = 0, bytes = 0, samples = 0;
+    unsigned skipped = 0; // Samples of encoder delay and padding
+
+    if (size >= xing + 8 &&
+        (memcmp(b + xing, "Xing", 4) == 0 ||
+         memcmp(b + xing, "Info", 4) == 0)) {
+        const uint32_t flags = big_endian32(b + xing + 4);
+        size_t field = xing + 8;
+
+        if (flags & 0x1 && size >= field + 4) {
+            frames = big_endian32(b + field);
+            field += 4;
+        }
+
+        if (flags & 0x2 && size >= field + 4)
+            bytes = big_endian32(b + field);
+
+        if (size >= lame + 24 &&
+            (memcmp(b + lame, "LAME", 4) == 0 ||
+             memcmp(b + lame, "Lav", 3) == 0))
+            skipped = (b[lame + 21] << 4 | b[lame + 22] >> 4) +
+                      ((b[lame + 22] & 0x0F) << 8 | b[lame + 23]);
+    } else if (size >= vbri + 18 && memcmp(b + vbri, "VBRI", 4) == 0) {
+        bytes = big_endian32(b + vbri + 10);
+        frames = big_endian32(b + vbri + 14);
+    }
+
+    m.sample_rate = f.sample_rate;
+    m.channels = f.mono ? 1 : 2;
+
+    /*
+     * Without a count of frames the stream is taken for CBR, as far as can
+     * be told without reading on. An ID3v1 or APE tag at the end is taken
+     * for audio, a few milliseconds' worth.
+     */
+    if (frames > 0) {
+        samples = frames * f.samples;
+        samples -= skipped < samples ? skipped : 0;
+        m.duration = samples * 1000 / f.sample_rate;
+
+        if (bytes == 0)
+            bytes = info.st_size - start;
+
+        m.bitrate = m.duration > 0 ? bytes * 8 / m.duration : 0;
+    } else {
+        m.bitrate = f.bitrate;
+        m.duration = uint64_t(info.st_size - start) * 8 / f.bitrate;
+    }
+
+    return true;
+}
+
+} // verbatim
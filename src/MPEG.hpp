@@ -0,0 +1,31 @@
+/*
+ * vim: set smartindent autoindent expandtab tabstop=4 shiftwidth=4:
+ */
+
+#ifndef VERBATIM_MPEG_HPP
+#define VERBATIM_MPEG_HPP
+
+// verbatim
+#include "Metadata.hpp"
+
+namespace verbatim {
+
+/*
+ * The ID3v2 tag of an MPEG audio file, then the audio properties of the
+ * first frame after it
+ */
+Metadata::Result read_mpeg(int fd, Metadata &m);
+
+/*
+ * Audio properties of the first frame at or after m.audio, within the
+ * first few KB: those of a VBR stream from the Xing, Info or VBRI header
+ * of that frame (less the encoder delay and padding of a LAME header),
+ * those of any other estimated from its bitrate and size. Nothing more of
+ * the audio is read, so it is never decoded or walked frame by frame.
+ * False if there is no frame there.
+ */
+bool read_mpeg_properties(int fd, Metadata &m);
+
+} // verbatim
+
+#endif // VERBATIM_MPEG_HPP
@@ -0,0 +1,146 @@
+/*
+ * vim: set smartindent autoindent expandtab tabstop=4 shiftwidth=4:
+ */
+
+// Interface
+#include "Metadata.hpp"
+
+// verbatim
+#include "MP4.hpp"
+#include "MPEG.hpp"
+#include "Vorbis.hpp"
+
+// libc
+#include <errno.h>
+#include <unistd.h>
+
+namespace {
+
+/*
+ * ID3v1 genres by number, as TagLib names them
+ */
+const char *const GENRES[] = {
+    "Blues", "Classic Rock", "Country", "Dance", "Disco", "Funk", "Grunge",
+    "Hip-Hop", "Jazz", "Metal", "New Age", "Oldies", "Other", "Pop", "R&B",
+    "Rap", "Reggae", "Rock", "Techno", "Industrial", "Alternative", "Ska",
+    "Death Metal", "Pranks", "Soundtrack", "Euro-Techno", "Ambient",
+    "Trip-Hop", "Vocal", "Jazz+Funk", "Fusion", "Trance", "Classical",
+    "Instrumental", "Acid", "House", "Game", "Sound Clip", "Gospel", "Noise",
+    "Alternative Rock", "Bass", "Soul", "Punk", "Space", "Meditative",
+    "Instrumental Pop", "Instrumental Rock", "Ethnic", "Gothic", "Darkwave",
+    "Techno-Industrial", "Electronic", "Pop-Folk", "Eurodance", "Dream",
+    "Southern Rock", "Comedy", "Cult", "Gangsta", "Top 40", "Christian Rap",
+    "Pop/Funk", "Jungle", "Native American", "Cabaret", "New Wave",
+    "Psychedelic", "Rave", "Showtunes", "Trailer", "Lo-Fi", "Tribal",
+    "Acid Punk", "Acid Jazz", "Polka", "Retro", "Musical", "Rock & Roll",
+    "Hard Rock", "Folk", "Folk/Rock", "National Folk", "Swing",
+    "Fast-Fusion", "Bebop", "Latin", "Revival", "Celtic", "Bluegrass",
+    "Avantgarde", "Gothic Rock", "Progressive Rock", "Psychedelic Rock",
+    "Symphonic Rock", "Slow Rock", "Big Band", "Chorus", "Easy Listening",
+    "Acoustic", "Humour", "Speech", "Chanson", "Opera", "Chamber Music",
+    "Sonata", "Symphony", "Booty Bass", "Primus", "Porn Groove", "Satire",
+    "Slow Jam", "Club", "Tango", "Samba", "Folklore", "Ballad",
+    "Power Ballad", "Rhythmic Soul", "Freestyle", "Duet", "Punk Rock",
+    "Drum Solo", "A Cappella", "Euro-House", "Dance Hall", "Goa",
+    "Drum & Bass", "Club-House", "Hardcore", "Terror", "Indie", "BritPop",
+    "Negerpunk", "Polsk Punk", "Beat", "Christian Gangsta Rap",
+    "Heavy Metal", "Black Metal", "Crossover", "Contemporary Christian",
+    "Christian Rock", "Merengue", "Salsa", "Thrash Metal", "Anime", "Jpop",
+    "Synthpop", "Abstract", "Art Rock", "Baroque", "Bhangra", "Big Beat",
+    "Breakbeat", "Chillout", "Downtempo", "Dub", "EBM", "Eclectic",
+    "Electro", "Electroclash", "Emo", "Experimental", "Garage", "Global",
+    "IDM", "Illbient", "Industro-Goth", "Jam Band", "Krautrock", "Leftfield",
+    "Lounge", "Math Rock", "New Romantic", "Nu-Breakz", "Post-Punk",
+    "Post-Rock", "Psytrance", "Shoegaze", "Space Rock", "Trop Rock",
+    "World Music", "Neoclassical", "Audiobook", "Audio Theatre",
+    "Neue Deutsche Welle", "Podcast", "Indie Rock", "G-Funk", "Dubstep",
+    "Garage Rock", "Psybient"
+};
+
+/*
+ * Readers by format, the registry read_metadata() dispatches by
+ */
+struct Registration
+{
+    verbatim::Format format;
+    verbatim::Metadata::Result (*read)(int fd, verbatim::Metadata &m);
+};
+
+const Registration readers[] = {
+    {verbatim::MPEG_FORMAT, &verbatim::read_mpeg},
+    {verbatim::FLAC_FORMAT, &verbatim::read_flac},
+    {verbatim::OGG_FORMAT, &verbatim::read_ogg},
+    {verbatim::MP4_FORMAT, &verbatim::read_mp4}
+};
+
+} // anonymous
+
+namespace verbatim {
+
+Metadata::Result
+read_metadata(int fd, Metadata &m)
+{
+    char head[SNIFF_SIZE];
+    const ssize_t n = pread(fd, head, sizeof(head), 0);
+
+    if (n <= 0)
+        return Metadata::ABSENT;
+
+    m.read += n;
+    m.format = sniff(head, n);
+
+    for (size_t i = 0 ; i < sizeof(readers) / sizeof(readers[0]) ; ++i) {
+        if (readers[i].format == m.format)
+            return readers[i].read(fd, m);
+    }
+
+    return Metadata::ABSENT;
+}
+
+bool
+read_at(int fd, char *data, size_t size, off_t offset, Metadata &m)
+{
+    while (size > 0) {
+        const ssize_t n = pread(fd, data, size, offset);
+
+        if (n == -1 && errno == EINTR)
+            continue;
+
+        if (n <= 0)
+            return false;
+
+        data += n;
+        size -= n;
+        offset += n;
+        m.read += n;
+    }
+
+    return true;
+}
+
+std::shared_ptr<char>
+allocate(size_t size)
+{
+    return std::shared_ptr<char>(new char[size], std::default_delete<char[]>());
+}
+
+const char*
+id3v1_genre(size_t number)
+{
+    static const size_t genres = sizeof(GENRES) / sizeof(GENRES[0]);
+    return number < genres ? GENRES[number] : "";
+}
+
+void
+append_value(std::string &field, const std::string &value)
+{
+    if (value.empty())
+        return;
+
+    if (!field.empty())
+        field += ' ';
+
+    field += value;
+}
+
+} // verbatim
@@ -0,0 +1,90 @@
+/*
+ * vim: set smartindent autoindent expandtab tabstop=4 shiftwidth=4:
+ */
+
+#ifndef VERBATIM_METADATA_HPP
+#define VERBATIM_METADATA_HPP
+
+// verbatim
+#include "Format.hpp"
+
+// boost
+#include <boost/utility/string_ref.hpp>
+
+// libstdc++
+#include <memory>
+#include <string>
+
+// libc
+#include <stddef.h>
+#include <sys/types.h> // For off_t
+
+namespace verbatim {
+
+/*
+ * What is recorded of a file's tags, whatever its format. Each format has
+ * a reader of its own, which reads only the blocks, pages or boxes holding
+ * the tags, never the audio. Text is UTF-8, the values of a field given
+ * more than once joined by a space. Audio properties are of the headers
+ * the format has for them, zero if there are none.
+ */
+struct Metadata
+{
+    /* Type definitions */
+    enum Result
+    {
+        READ = 0,
+        ABSENT,     // No tags where the format keeps them
+        UNREADABLE, // Malformed, or using what the reader does not support
+        NOT_AUDIO   // Of a format of other media too, and none of it audio
+    };
+
+    /* Member variables/attributes */
+    Format format;
+    std::string title, artist, album, genre;
+    std::string mimetype; // Of the picture
+    boost::string_ref picture; // The front cover, if any, else the first
+    std::shared_ptr<const void> buffer; // Holding the picture
+    unsigned duration,      // Milliseconds
+             bitrate,       // Average, kbit/s
+             sample_rate,   // Hz
+             channels;
+    off_t audio; // Offset of the audio, after any tag before it
+    size_t read; // Bytes of the file
+
+    /* Member functions/methods */
+    Metadata() :
+        format(UNKNOWN_FORMAT),
+        duration(0),
+        bitrate(0),
+        sample_rate(0),
+        channels(0),
+        audio(0),
+        read(0)
+    {
+    }
+};
+
+/*
+ * Dispatched by the format sniffed from the leading bytes of the file,
+ * ABSENT if it is of none known
+ */
+Metadata::Result read_metadata(int fd, Metadata &m);
+
+/*
+ * For the readers: all of size bytes at the offset, counted in m.read, or
+ * false; a buffer left unset, as it is read into; an ID3v1 genre by its
+ * number, empty if there is none of that number
+ */
+bool read_at(int fd, char *data, size_t size, off_t offset, Metadata &m);
+std::shared_ptr<char> allocate(size_t size);
+const char* id3v1_genre(size_t number);
+
+/*
+ * Joined to any value the field already has, as one more
+ */
+void append_value(std::string &field, const std::string &value);
+
+} // verbatim
+
+#endif // VERBATIM_METADATA_HPP
@@ -0,0 +1,53 @@
+/*
+ * vim: set smartindent autoindent expandtab tabstop=4 shiftwidth=4:
+ */
+
+// Interface
+#include "Picture.hpp"
+
+// boost
+#include <boost/crc.hpp>
+
+// libstdc++
+#include <algorithm>
+
+namespace {
+
+/*
+ * Bytes of either end of a picture its fingerprint is of
+ */
+static const size_t FINGERPRINT_SAMPLE = 4096;
+
+} // anonymous
+
+namespace verbatim {
+
+Fingerprint
+fingerprint(const char *data, size_t size)
+{
+    const size_t head = std::min(size, FINGERPRINT_SAMPLE);
+    const size_t tail = std::min(size - head, FINGERPRINT_SAMPLE);
+    boost::crc_32_type crc;
+    Fingerprint f;
+
+    crc.process_bytes(data, head);
+    crc.process_bytes(data + size - tail, tail);
+
+    f.size = size;
+    f.crc = crc.checksum();
+
+    return f;
+}
+
+bool
+recognise(const char *data,
+          size_t size,
+          const utility::Hash128::Digest &stored,
+          utility::Hash128::Digest &digest)
+{
+    digest = utility::Hash128::of(data, size);
+
+    return digest == stored;
+}
+
+} // verbatim
@@ -0,0 +1,40 @@
+/*
+ * vim: set smartindent autoindent expandtab tabstop=4 shiftwidth=4:
+ */
+
+#ifndef VERBATIM_PICTURE_HPP
+#define VERBATIM_PICTURE_HPP
+
+// verbatim
+#include "utility/Hash.hpp"
+
+// libc
+#include <stdint.h>
+#include <stddef.h>
+
+namespace verbatim {
+
+/*
+ * Size of a picture and the CRC-32 of its first and last few KB, enough to
+ * find which picture seen before this one probably is. Only probably, as
+ * two that differ in between share it; see recognise().
+ */
+struct Fingerprint
+{
+    uint64_t size, crc;
+};
+
+Fingerprint fingerprint(const char *data, size_t size);
+
+/*
+ * Hash the picture, true if it is the one whose digest was stored under
+ * its fingerprint rather than another sharing it
+ */
+bool recognise(const char *data,
+               size_t size,
+               const utility::Hash128::Digest &stored,
+               utility::Hash128::Digest &digest);
+
+} // verbatim
+
+#endif // VERBATIM_PICTURE_HPP
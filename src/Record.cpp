@@ -0,0 +1,361 @@
+/*
+ * vim: set smartindent autoindent expandtab tabstop=4 shiftwidth=4:
+ */
+
+// Interface
+#include "Record.hpp"
+
+// verbatim
+#include "utility/Exception.hpp"
+
+// libstdc++
+#include <set>
+#include <vector>
+#include <utility>
+
+// libc
+#include <assert.h>
+
+using std::set;
+using std::string;
+using std::vector;
+using boost::string_ref;
+
+namespace {
+
+static const size_t HEADER_SIZE = 4; // Magic, version and no. of fields
+
+} // anonymous
+
+namespace verbatim {
+
+/*
+ * Record (implementation)
+ */
+const uint8_t Record::MAGIC;
+const uint8_t Record::VERSION;
+
+/*
+ * Validates the whole table up front so that field() needn't. Fields added
+ * by a later version are ignored, those missing from an earlier one read
+ * as empty (or zero).
+ */
+Record::Record(const char *data, size_t size) :
+    table(data + HEADER_SIZE),
+    first(NULL),
+    length(0),
+    count(0)
+{
+    const unsigned char *b = reinterpret_cast<const unsigned char*>(data);
+
+    if (size < HEADER_SIZE || b[0] != MAGIC)
+        throw utility::ValueError("Record::Record",
+                                  0,
+                                  "Not a record (%zu bytes), the database "
+                                  "may predate the record format",
+                                  size);
+
+    if (b[1] > VERSION)
+        throw utility::ValueError("Record::Record",
+                                  0,
+                                  "Record version %u is newer than %u",
+                                  b[1],
+                                  VERSION);
+
+    count = b[2] | b[3] << 8;
+
+    if (size < HEADER_SIZE + count * 4)
+        throw utility::ValueError("Record::Record",
+                                  0,
+                                  "Truncated table of %zu fields",
+                                  count);
+
+    first = table + count * 4;
+    length = size - (first - data);
+
+    for (size_t i = 0, start = 0 ; i < count ; ++i) {
+        const size_t end = get32(table + i * 4);
+
+        if (end < start || end > length)
+            throw utility::ValueError("Record::Record",
+                                      0,
+                                      "Field %zu (%zu-%zu) out of bounds",
+                                      i,
+                                      start,
+                                      end);
+        start = end;
+    }
+}
+
+string_ref
+Record::field(size_t i) const
+{
+    if (i >= count)
+        return string_ref();
+
+    const size_t start = i == 0 ? 0 : get32(table + (i - 1) * 4),
+                 end = get32(table + i * 4);
+
+    return string_ref(first + start, end - start);
+}
+
+uint64_t
+Record::number(size_t i) const
+{
+    const string_ref f(field(i));
+    return f.size() == 8 ? get64(f.data()) : 0;
+}
+
+bool
+Record::List::next(string_ref &item)
+{
+    if (field.size() < 4)
+        return false;
+
+    const size_t size = get32(field.data());
+
+    if (size > field.size() - 4)
+        throw utility::ValueError("Record::List::next",
+                                  0,
+                                  "List item of %zu bytes overruns its field",
+                                  size);
+
+    item = string_ref(field.data() + 4, size);
+    field.remove_prefix(4 + size);
+
+    return true;
+}
+
+TagRecord::TagRecord(const char *data, size_t size) : Record(data, size)
+{
+}
+
+ImgRecord::ImgRecord(const char *data, size_t size) : Record(data, size)
+{
+}
+
+/*
+ * RecordWriter (implementation)
+ */
+RecordWriter::RecordWriter(size_t fields, size_t reserve) :
+    count(fields),
+    added(0),
+    body(HEADER_SIZE + fields * 4)
+{
+    assert(fields <= 0xFFFF);
+
+    buffer.reserve(body + reserve);
+    buffer += char(Record::MAGIC);
+    buffer += char(Record::VERSION);
+    buffer += char(fields);
+    buffer += char(fields >> 8);
+    buffer.resize(body, '\0');
+}
+
+/*
+ * Record where the field just appended ends
+ */
+void
+RecordWriter::end_field()
+{
+    assert(added < count);
+
+    const uint32_t end = buffer.size() - body;
+    char *slot = &buffer[HEADER_SIZE + added * 4];
+
+    slot[0] = char(end);
+    slot[1] = char(end >> 8);
+    slot[2] = char(end >> 16);
+    slot[3] = char(end >> 24);
+
+    ++added;
+}
+
+RecordWriter&
+RecordWriter::number(uint64_t n)
+{
+    put64(buffer, n);
+    end_field();
+    return *this;
+}
+
+RecordWriter&
+RecordWriter::bytes(const char *data, size_t size)
+{
+    buffer.append(data, size);
+    end_field();
+    return *this;
+}
+
+RecordWriter&
+RecordWriter::open_list()
+{
+    return *this; // Items are appended as they come
+}
+
+RecordWriter&
+RecordWriter::item(const char *data, size_t size)
+{
+    put32(buffer, size);
+    buffer.append(data, size);
+    return *this;
+}
+
+RecordWriter&
+RecordWriter::close_list()
+{
+    end_field();
+    return *this;
+}
+
+const string&
+RecordWriter::data() const
+{
+    assert(added == count);
+    return buffer;
+}
+
+string
+RecordWriter::release()
+{
+    assert(added == count);
+    return std::move(buffer);
+}
+
+/*
+ * Value codecs (implementation)
+ */
+void
+write(RecordWriter &w, const Tag &t)
+{
+    w.number(t.modified)
+     .bytes(t.artist)
+     .bytes(t.album)
+     .bytes(t.title)
+     .bytes(t.genre)
+     .bytes(t.filename)
+     .open_list();
+
+    for (set<string>::const_iterator i = t.aliases.begin() ;
+         i != t.aliases.end() ;
+         ++i)
+        w.item(*i);
+
+    w.close_list()
+     .number(t.duration)
+     .number(t.bitrate)
+     .number(t.sample_rate)
+     .number(t.channels)
+     .bytes(t.artist_key)
+     .bytes(t.album_key)
+     .bytes(t.title_key)
+     .bytes(t.genre_key);
+}
+
+void
+write(RecordWriter &w, const Img &i)
+{
+    w.number(i.size)
+     .bytes(i.data.empty() ? NULL : &i.data[0], i.data.size())
+     .bytes(i.mimetype)
+     .number(i.blob);
+}
+
+void
+write(RecordWriter &w, const Dir &d)
+{
+    w.number(d.inode)
+     .number(d.modified)
+     .number(d.changed)
+     .number(d.entries)
+     .number(d.scan)
+     .bytes(d.path);
+}
+
+void
+write(RecordWriter &w, const Scan &s)
+{
+    w.number(s.generation).open_list();
+
+    for (size_t i = 0 ; i < s.roots.size() ; ++i)
+        w.item(s.roots[i]);
+
+    w.close_list();
+}
+
+void
+read(const Record &r, Tag &t)
+{
+    string_ref f;
+
+    t.modified = r.number(TAG_MODIFIED);
+    f = r.field(TAG_ARTIST);
+    t.artist.assign(f.data(), f.size());
+    f = r.field(TAG_ALBUM);
+    t.album.assign(f.data(), f.size());
+    f = r.field(TAG_TITLE);
+    t.title.assign(f.data(), f.size());
+    f = r.field(TAG_GENRE);
+    t.genre.assign(f.data(), f.size());
+    f = r.field(TAG_FILENAME);
+    t.filename.assign(f.data(), f.size());
+
+    Record::List aliases(r.list(TAG_ALIASES));
+
+    t.aliases.clear();
+
+    while (aliases.next(f))
+        t.aliases.insert(string(f.data(), f.size()));
+
+    t.duration = r.number(TAG_DURATION);
+    t.bitrate = r.number(TAG_BITRATE);
+    t.sample_rate = r.number(TAG_SAMPLE_RATE);
+    t.channels = r.number(TAG_CHANNELS);
+    f = r.field(TAG_ARTIST_KEY);
+    t.artist_key.assign(f.data(), f.size());
+    f = r.field(TAG_ALBUM_KEY);
+    t.album_key.assign(f.data(), f.size());
+    f = r.field(TAG_TITLE_KEY);
+    t.title_key.assign(f.data(), f.size());
+    f = r.field(TAG_GENRE_KEY);
+    t.genre_key.assign(f.data(), f.size());
+}
+
+void
+read(const Record &r, Img &i)
+{
+    const string_ref data(r.field(IMG_DATA)), mimetype(r.field(IMG_MIMETYPE));
+
+    i.size = r.number(IMG_SIZE);
+    i.data.assign(data.begin(), data.end());
+    i.mimetype.assign(mimetype.data(), mimetype.size());
+    i.blob = r.number(IMG_BLOB);
+}
+
+void
+read(const Record &r, Dir &d)
+{
+    const string_ref path(r.field(DIR_PATH));
+
+    d.inode = r.number(DIR_INODE);
+    d.modified = r.number(DIR_MODIFIED);
+    d.changed = r.number(DIR_CHANGED);
+    d.entries = r.number(DIR_ENTRIES);
+    d.scan = r.number(DIR_SCAN);
+    d.path.assign(path.data(), path.size());
+}
+
+void
+read(const Record &r, Scan &s)
+{
+    Record::List roots(r.list(SCAN_ROOTS));
+    string_ref f;
+
+    s.generation = r.number(SCAN_GENERATION);
+    s.roots.clear();
+
+    while (roots.next(f))
+        s.roots.push_back(string(f.data(), f.size()));
+}
+
+} // verbatim
@@ -0,0 +1,264 @@
+/*
+ * vim: set smartindent autoindent expandtab tabstop=4 shiftwidth=4:
+ */
+
+#ifndef VERBATIM_RECORD_HPP
+#define VERBATIM_RECORD_HPP
+
+// verbatim
+#include "Tag.hpp"
+
+// boost
+#include <boost/utility/string_ref.hpp>
+
+// libstdc++
+#include <string>
+
+// libc
+#include <stdint.h>
+#include <stddef.h>
+
+namespace verbatim {
+
+/*
+ * The flat layout of a database value, readable in place (from an LMDB
+ * page, say) without copying or allocating:
+ *
+ *   u8  magic
+ *   u8  version
+ *   u16 no. of fields, n
+ *   u32 end offset of each field, n times, from the end of this table
+ *   ... the fields, back to back
+ *
+ * Integers are little-endian whatever the host. Numbers are 8 byte fields,
+ * strings and byte vectors are stored as is (their length is implied by
+ * the table) and lists as items each prefixed by a u32 length.
+ *
+ * A record holds the Tag, Img, Dir or Scan of an entry and nothing else;
+ * its key is the LMDB key and its links are kept in tables of their own.
+ */
+enum TagField
+{
+    TAG_MODIFIED = 0,
+    TAG_ARTIST,
+    TAG_ALBUM,
+    TAG_TITLE,
+    TAG_GENRE,
+    TAG_FILENAME,
+    TAG_ALIASES,
+    TAG_DURATION,
+    TAG_BITRATE,
+    TAG_SAMPLE_RATE,
+    TAG_CHANNELS,
+    TAG_ARTIST_KEY,
+    TAG_ALBUM_KEY,
+    TAG_TITLE_KEY,
+    TAG_GENRE_KEY,
+    TAG_FIELDS
+};
+
+enum ImgField
+{
+    IMG_SIZE = 0,
+    IMG_DATA,
+    IMG_MIMETYPE,
+    IMG_BLOB,
+    IMG_FIELDS
+};
+
+enum DirField
+{
+    DIR_INODE = 0,
+    DIR_MODIFIED,
+    DIR_CHANGED,
+    DIR_ENTRIES,
+    DIR_SCAN,
+    DIR_PATH,
+    DIR_FIELDS
+};
+
+enum ScanField
+{
+    SCAN_GENERATION = 0,
+    SCAN_ROOTS,
+    SCAN_FIELDS
+};
+
+/*
+ * Read-side view of a record. Nothing is copied, so the string_refs
+ * returned are only valid for as long as the underlying buffer is.
+ */
+class Record
+{
+    public:
+        /* Type definitions */
+        class List
+        {
+            public:
+                List(boost::string_ref f) : field(f) {}
+                bool next(boost::string_ref &item); // False once exhausted
+            private:
+                boost::string_ref field;
+        };
+
+        /* Constants */
+        static const uint8_t MAGIC = 0xB7;
+        static const uint8_t VERSION = 1;
+
+        /* Member functions/methods */
+        Record(const char *data, size_t size); // Throws ValueError if invalid
+
+        inline size_t fields() const { return count; }
+        boost::string_ref field(size_t i) const;
+        uint64_t number(size_t i) const;
+        inline List list(size_t i) const { return List(field(i)); }
+
+        static inline uint32_t
+        get32(const char *p)
+        {
+            const unsigned char *b = reinterpret_cast<const unsigned char*>(p);
+            return b[0] | b[1] << 8 | b[2] << 16 | uint32_t(b[3]) << 24;
+        }
+
+        static inline uint64_t
+        get64(const char *p)
+        {
+            return get32(p) | uint64_t(get32(p + 4)) << 32;
+        }
+    protected:
+        /* Member variables/attributes */
+        const char *table, *first; // Offsets and the fields they delimit
+        size_t length, count;
+};
+
+/*
+ * Zero-copy accessors for the fields of a Tag entry
+ */
+class TagRecord : public Record
+{
+    public:
+        TagRecord(const char *data, size_t size); // Throws ValueError
+
+        inline time_t modified() const { return number(TAG_MODIFIED); }
+        inline boost::string_ref artist() const { return field(TAG_ARTIST); }
+        inline boost::string_ref album() const { return field(TAG_ALBUM); }
+        inline boost::string_ref title() const { return field(TAG_TITLE); }
+        inline boost::string_ref genre() const { return field(TAG_GENRE); }
+        inline boost::string_ref filename() const
+        {
+            return field(TAG_FILENAME);
+        }
+        inline List aliases() const { return list(TAG_ALIASES); }
+        inline unsigned duration() const { return number(TAG_DURATION); }
+        inline unsigned bitrate() const { return number(TAG_BITRATE); }
+        inline unsigned sample_rate() const
+        {
+            return number(TAG_SAMPLE_RATE);
+        }
+        inline unsigned channels() const { return number(TAG_CHANNELS); }
+        inline boost::string_ref artist_key() const
+        {
+            return field(TAG_ARTIST_KEY);
+        }
+        inline boost::string_ref album_key() const
+        {
+            return field(TAG_ALBUM_KEY);
+        }
+        inline boost::string_ref title_key() const
+        {
+            return field(TAG_TITLE_KEY);
+        }
+        inline boost::string_ref genre_key() const
+        {
+            return field(TAG_GENRE_KEY);
+        }
+};
+
+/*
+ * Ditto for an Img entry, the picture itself included if not in the blob
+ * store; records written before there was one have no offset
+ */
+class ImgRecord : public Record
+{
+    public:
+        ImgRecord(const char *data, size_t size); // Throws ValueError
+
+        inline size_t size() const { return number(IMG_SIZE); }
+        inline boost::string_ref data() const { return field(IMG_DATA); }
+        inline boost::string_ref mimetype() const
+        {
+            return field(IMG_MIMETYPE);
+        }
+        inline uint64_t blob() const { return number(IMG_BLOB); }
+};
+
+/*
+ * Builds a record of a known no. of fields, which must all be added in
+ * order, directly into its final buffer
+ */
+class RecordWriter
+{
+    public:
+        /* Member functions/methods */
+        RecordWriter(size_t fields, size_t reserve = 0);
+
+        RecordWriter& number(uint64_t n);
+        RecordWriter& bytes(const char *data, size_t size);
+        inline RecordWriter& bytes(const std::string &s)
+        {
+            return bytes(s.data(), s.size());
+        }
+
+        /*
+         * A list field is opened, filled and closed
+         */
+        RecordWriter& open_list();
+        RecordWriter& item(const char *data, size_t size);
+        inline RecordWriter& item(const std::string &s)
+        {
+            return item(s.data(), s.size());
+        }
+        RecordWriter& close_list();
+
+        const std::string& data() const; // Once all fields are added
+        std::string release(); // Ditto, moving the buffer out
+
+        static inline void
+        put32(std::string &s, uint32_t n)
+        {
+            const char b[4] = {char(n), char(n >> 8), char(n >> 16),
+                               char(n >> 24)};
+            s.append(b, sizeof(b));
+        }
+
+        static inline void
+        put64(std::string &s, uint64_t n)
+        {
+            put32(s, uint32_t(n));
+            put32(s, uint32_t(n >> 32));
+        }
+    private:
+        /* Member functions/methods */
+        void end_field();
+
+        /* Member variables/attributes */
+        std::string buffer;
+        size_t count, added, body; // Fields expected/added, body offset
+};
+
+/*
+ * Value codecs, to and from the fields of a record
+ */
+void write(RecordWriter &w, const Tag &t);
+void write(RecordWriter &w, const Img &i);
+void write(RecordWriter &w, const Dir &d);
+void write(RecordWriter &w, const Scan &s);
+
+void read(const Record &r, Tag &t);
+void read(const Record &r, Img &i);
+void read(const Record &r, Dir &d);
+void read(const Record &r, Scan &s);
+
+} // verbatim
+
+#endif
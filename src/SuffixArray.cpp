@@ -0,0 +1,709 @@
+/*
+ * vim: set smartindent autoindent expandtab tabstop=4 shiftwidth=4:
+ */
+
+// Interface
+#include "SuffixArray.hpp"
+
+// verbatim
+#include "utility/Text.hpp"
+#include "utility/Exception.hpp"
+
+// libstdc++
+#include <utility>
+#include <algorithm>
+
+// libc
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using std::pair;
+using std::string;
+using std::vector;
+using std::make_pair;
+using std::unordered_set;
+using std::unordered_map;
+
+namespace {
+
+/*
+ * The file: a header then each array, in the order the counts are given,
+ * padded to eight bytes. In host byte order, as the LMDB environment is.
+ */
+static const char MAGIC[4] = {'V', 'S', 'A', 'X'};
+static const uint32_t VERSION = 1;
+
+struct Header
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t counts[7]; // Text, documents and suffixes of main then delta,
+                        // then the no. of documents masked
+};
+
+inline
+size_t
+padded(size_t size)
+{
+    return (size + 7) & ~size_t(7);
+}
+
+/*
+ * Suffixes tied on their first two bytes share a bucket; the end of the
+ * text sorts before any byte
+ */
+inline
+size_t
+bucket(const unsigned char *t, size_t n, size_t i)
+{
+    return (t[i] + 1) * 257 + (i + 1 < n ? t[i + 1] + 1 : 0);
+}
+
+/*
+ * Sort the suffixes of the text by prefix doubling (Larsson and Sadakane).
+ * Bucketed by their first two bytes, each group of suffixes still tied is
+ * then sorted by the rank of the suffix h bytes on, h doubling with each
+ * pass, until none are. Suffixes no longer tied are never looked at again,
+ * so text with few long repeats is sorted in a few passes.
+ */
+void
+sort_suffixes(const unsigned char *t, size_t n, vector<uint32_t> &sa)
+{
+    static const size_t BUCKETS = 257 * 257;
+    vector<uint32_t> rank(n), ends(BUCKETS + 1, 0);
+    vector<pair<uint32_t, uint32_t> > groups, split; // Ranges of sa, tied
+    vector<pair<uint32_t, uint32_t> > keyed; // (Rank h on, suffix)
+
+    sa.resize(n);
+
+    for (size_t i = 0 ; i < n ; ++i)
+        ++ends[bucket(t, n, i) + 1];
+
+    for (size_t b = 1 ; b <= BUCKETS ; ++b)
+        ends[b] += ends[b - 1];
+
+    for (size_t i = 0 ; i < n ; ++i)
+        sa[ends[bucket(t, n, i)]++] = i; // Leaves each at the end of its own
+
+    /*
+     * The rank of a suffix is the last position of its group in sa
+     */
+    for (size_t b = 0 ; b < BUCKETS ; ++b) {
+        const size_t begin = b ? ends[b - 1] : 0, end = ends[b];
+
+        for (size_t j = begin ; j < end ; ++j)
+            rank[sa[j]] = end - 1;
+
+        if (end - begin > 1)
+            groups.push_back(make_pair(begin, end));
+    }
+
+    for (size_t h = 2 ; !groups.empty() ; h *= 2) {
+        split.clear();
+
+        for (size_t g = 0 ; g < groups.size() ; ++g) {
+            const size_t begin = groups[g].first, end = groups[g].second;
+
+            keyed.clear();
+
+            for (size_t j = begin ; j < end ; ++j) {
+                const size_t i = sa[j];
+                keyed.push_back(make_pair(i + h < n ? rank[i + h] + 1 : 0, i));
+            }
+
+            std::sort(keyed.begin(), keyed.end());
+
+            /*
+             * Ranks only ever become finer, so may be updated as the pass
+             * goes; keys of this group were all taken beforehand
+             */
+            for (size_t j = 0, k = 0 ; j < keyed.size() ; j = k) {
+                for (k = j + 1 ;
+                     k < keyed.size() && keyed[k].first == keyed[j].first ;
+                     ++k);
+
+                for (size_t x = j ; x < k ; ++x) {
+                    sa[begin + x] = keyed[x].second;
+                    rank[keyed[x].second] = begin + k - 1;
+                }
+
+                if (k - j > 1)
+                    split.push_back(make_pair(begin + j, begin + k));
+            }
+        }
+
+        groups.swap(split);
+    }
+}
+
+/*
+ * Order of a suffix relative to a pattern, on no more than the length of
+ * the pattern: zero if the suffix starts with it
+ */
+inline
+int
+compare(const char *suffix, size_t size, const string &pattern)
+{
+    const size_t m = pattern.size();
+    const int c = memcmp(suffix, pattern.data(), size < m ? size : m);
+
+    return c == 0 && size < m ? -1 : c;
+}
+
+void
+put(int fd, const void *data, size_t size, const string &path)
+{
+    static const char zeros[8] = {0};
+    const char *p = static_cast<const char*>(data);
+    size_t left = size, padding = padded(size) - size;
+
+    while (left > 0 || padding > 0) {
+        const bool pad = left == 0;
+        const ssize_t n = pad ? write(fd, zeros, padding) : write(fd, p, left);
+
+        if (n == -1 && errno == EINTR)
+            continue;
+
+        if (n == -1)
+            throw verbatim::utility::FileError("SuffixArray::save",
+                                               errno,
+                                               "Failed to write %s",
+                                               path.c_str());
+
+        if (pad) {
+            padding -= n;
+        } else {
+            p += n;
+            left -= n;
+        }
+    }
+}
+
+const char*
+take(const char *base, size_t size, size_t &offset, size_t bytes)
+{
+    if (offset > size || bytes > size - offset)
+        throw verbatim::utility::ValueError("SuffixArray::load",
+                                            0,
+                                            "Truncated index (%zu bytes)",
+                                            size);
+
+    const char *p = base + offset;
+    offset += padded(bytes);
+
+    return p;
+}
+
+} // anonymous
+
+namespace verbatim {
+
+/*
+ * Segment (implementation)
+ */
+SuffixArray::Segment::Segment() :
+    owned_starts(1, 0)
+{
+    adopt();
+}
+
+/*
+ * Built from documents of normalised text, whose fields are separated by
+ * '\n'. Suffixes starting with a separator or a space are left out as no
+ * normalised pattern does.
+ */
+void
+SuffixArray::Segment::build(vector<pair<Document, string> > &docs)
+{
+    size_t size = 0;
+
+    std::sort(docs.begin(), docs.end());
+
+    for (size_t i = 0 ; i < docs.size() ; ++i)
+        size += docs[i].second.size() + 1;
+
+    if (size >= UINT32_MAX)
+        throw utility::ValueError("SuffixArray::Segment::build",
+                                  0,
+                                  "%zu bytes of text is too many to index",
+                                  size);
+
+    owned_text.clear();
+    owned_text.reserve(size);
+    owned_starts.clear();
+    owned_starts.reserve(docs.size() + 1);
+    owned_documents.clear();
+    owned_documents.reserve(docs.size());
+
+    for (size_t i = 0 ; i < docs.size() ; ++i) {
+        owned_starts.push_back(owned_text.size());
+        owned_documents.push_back(docs[i].first);
+        owned_text += docs[i].second;
+        owned_text += '\0';
+    }
+
+    owned_starts.push_back(owned_text.size());
+
+    const unsigned char *t =
+        reinterpret_cast<const unsigned char*>(owned_text.data());
+
+    sort_suffixes(t, owned_text.size(), owned_suffixes);
+
+    size_t kept = 0;
+
+    for (size_t i = 0 ; i < owned_suffixes.size() ; ++i) {
+        const char c = owned_text[owned_suffixes[i]];
+
+        if (c != '\0' && c != '\n' && c != ' ')
+            owned_suffixes[kept++] = owned_suffixes[i];
+    }
+
+    owned_suffixes.resize(kept);
+    owned_suffixes.shrink_to_fit();
+
+    adopt();
+}
+
+void
+SuffixArray::Segment::adopt()
+{
+    text = owned_text.data();
+    starts = &owned_starts[0];
+    documents = owned_documents.empty() ? NULL : &owned_documents[0];
+    suffixes = owned_suffixes.empty() ? NULL : &owned_suffixes[0];
+    text_size = owned_text.size();
+    document_count = owned_documents.size();
+    suffix_count = owned_suffixes.size();
+}
+
+string
+SuffixArray::Segment::document(size_t i) const
+{
+    return string(text + starts[i], starts[i + 1] - starts[i] - 1);
+}
+
+size_t
+SuffixArray::Segment::locate(uint32_t suffix) const
+{
+    return std::upper_bound(starts, starts + document_count + 1, suffix) -
+           starts - 1;
+}
+
+/*
+ * SuffixArray (implementation)
+ */
+SuffixArray::SuffixArray() :
+    dirty(false),
+    mapping(NULL),
+    mapping_size(0)
+{
+}
+
+SuffixArray::~SuffixArray()
+{
+    unmap();
+}
+
+/*
+ * Map an index saved earlier, replacing this one
+ */
+bool
+SuffixArray::load(const string &path)
+{
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (fd == -1 && errno == ENOENT)
+        return false;
+
+    if (fd == -1)
+        throw utility::FileError("SuffixArray::load",
+                                 errno,
+                                 "Failed to open %s",
+                                 path.c_str());
+
+    struct stat info;
+    void *m = MAP_FAILED;
+
+    if (fstat(fd, &info) == 0 && info.st_size > 0)
+        m = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    const int error = errno;
+    close(fd);
+
+    if (m == MAP_FAILED)
+        throw utility::FileError("SuffixArray::load",
+                                 error,
+                                 "Failed to map %s",
+                                 path.c_str());
+
+    unmap();
+    mapping = m;
+    mapping_size = info.st_size;
+
+    const char *base = static_cast<const char*>(mapping);
+    Header h;
+
+    if (mapping_size < sizeof(h))
+        throw utility::ValueError("SuffixArray::load",
+                                  0,
+                                  "%s is not an index",
+                                  path.c_str());
+
+    memcpy(&h, base, sizeof(h));
+
+    if (memcmp(h.magic, MAGIC, sizeof(MAGIC)) != 0 || h.version != VERSION)
+        throw utility::ValueError("SuffixArray::load",
+                                  0,
+                                  "%s is not an index of version %u",
+                                  path.c_str(),
+                                  VERSION);
+
+    for (size_t i = 0 ; i < 7 ; ++i) {
+        if (h.counts[i] > mapping_size)
+            throw utility::ValueError("SuffixArray::load",
+                                      0,
+                                      "%s is corrupt",
+                                      path.c_str());
+    }
+
+    size_t offset = sizeof(h);
+    Segment *segments[2] = {&main, &delta};
+
+    for (size_t i = 0 ; i < 2 ; ++i) {
+        Segment &s = *segments[i];
+        const uint64_t *counts = h.counts + i * 3;
+
+        s = Segment();
+        s.text_size = counts[0];
+        s.document_count = counts[1];
+        s.suffix_count = counts[2];
+        s.text = take(base, mapping_size, offset, s.text_size);
+        s.starts = reinterpret_cast<const uint32_t*>(
+            take(base, mapping_size, offset, (s.document_count + 1) * 4));
+        s.documents = reinterpret_cast<const Document*>(
+            take(base, mapping_size, offset, s.document_count * 8));
+        s.suffixes = reinterpret_cast<const uint32_t*>(
+            take(base, mapping_size, offset, s.suffix_count * 4));
+
+        if (s.starts[s.document_count] != s.text_size)
+            throw utility::ValueError("SuffixArray::load",
+                                      0,
+                                      "%s is corrupt",
+                                      path.c_str());
+    }
+
+    const Document *masked = reinterpret_cast<const Document*>(
+        take(base, mapping_size, offset, h.counts[6] * 8));
+
+    mask.clear();
+    mask.insert(masked, masked + h.counts[6]);
+    changes.clear();
+    positions.clear();
+    dirty = false;
+
+    for (size_t i = 0 ; i < delta.document_count ; ++i)
+        changes[delta.documents[i]] = delta.document(i);
+
+    return true;
+}
+
+/*
+ * Written to a temporary file first, then renamed over the old one, so a
+ * reader only ever maps a complete index. Throws FileError.
+ */
+void
+SuffixArray::save(const string &path) const
+{
+    if (dirty)
+        throw utility::LogicError("SuffixArray::save",
+                                  0,
+                                  "Changes to %s are not committed",
+                                  path.c_str());
+
+    const string temporary(path + ".tmp");
+    const int fd = open(temporary.c_str(),
+                        O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                        0644);
+
+    if (fd == -1)
+        throw utility::FileError("SuffixArray::save",
+                                 errno,
+                                 "Failed to create %s",
+                                 temporary.c_str());
+
+    const Segment *segments[2] = {&main, &delta};
+    vector<Document> masked(mask.begin(), mask.end());
+    Header h;
+
+    std::sort(masked.begin(), masked.end());
+    memcpy(h.magic, MAGIC, sizeof(MAGIC));
+    h.version = VERSION;
+
+    for (size_t i = 0 ; i < 2 ; ++i) {
+        h.counts[i * 3] = segments[i]->text_size;
+        h.counts[i * 3 + 1] = segments[i]->document_count;
+        h.counts[i * 3 + 2] = segments[i]->suffix_count;
+    }
+
+    h.counts[6] = masked.size();
+
+    try {
+        put(fd, &h, sizeof(h), temporary);
+
+        for (size_t i = 0 ; i < 2 ; ++i) {
+            const Segment &s = *segments[i];
+
+            put(fd, s.text, s.text_size, temporary);
+            put(fd, s.starts, (s.document_count + 1) * 4, temporary);
+            put(fd, s.documents, s.document_count * 8, temporary);
+            put(fd, s.suffixes, s.suffix_count * 4, temporary);
+        }
+
+        put(fd, masked.empty() ? NULL : &masked[0], masked.size() * 8,
+            temporary);
+
+        if (fsync(fd) == -1)
+            throw utility::FileError("SuffixArray::save",
+                                     errno,
+                                     "Failed to sync %s",
+                                     temporary.c_str());
+    } catch (const utility::Exception &e) {
+        close(fd);
+        unlink(temporary.c_str());
+        throw;
+    }
+
+    close(fd);
+
+    if (rename(temporary.c_str(), path.c_str()) == -1)
+        throw utility::FileError("SuffixArray::save",
+                                 errno,
+                                 "Failed to rename %s",
+                                 temporary.c_str());
+}
+
+/*
+ * Add or replace a document, to be indexed by the next commit(). Its fields
+ * are normalised by the caller, once, rather than each time it is indexed.
+ */
+bool
+SuffixArray::update(Document d, const Fields &fields)
+{
+    string text;
+
+    for (size_t i = 0 ; i < fields.size() ; ++i) {
+        if (i > 0)
+            text += '\n';
+
+        text += fields[i];
+    }
+
+    unordered_map<Document, string>::iterator c(changes.find(d));
+
+    if (c != changes.end()) {
+        if (c->second == text)
+            return false;
+
+        c->second.swap(text);
+        dirty = true;
+
+        return true;
+    }
+
+    index();
+
+    unordered_map<Document, size_t>::const_iterator p(positions.find(d));
+
+    if (p != positions.end() && mask.count(d) == 0) {
+        if (main.document(p->second) == text)
+            return false;
+
+        mask.insert(d);
+    }
+
+    changes[d].swap(text);
+    dirty = true;
+
+    return true;
+}
+
+bool
+SuffixArray::remove(Document d)
+{
+    bool removed = changes.erase(d) > 0;
+
+    index();
+
+    if (positions.count(d) > 0 && mask.insert(d).second)
+        removed = true;
+
+    dirty = dirty || removed;
+
+    return removed;
+}
+
+/*
+ * Rebuild the delta from the documents changed since main was built or, if
+ * they add up to an eighth of main or more, rebuild main from everything
+ */
+void
+SuffixArray::commit()
+{
+    if (!dirty)
+        return;
+
+    vector<pair<Document, string> > docs(changes.begin(), changes.end());
+    size_t changed = 0;
+
+    for (size_t i = 0 ; i < docs.size() ; ++i)
+        changed += docs[i].second.size() + 1;
+
+    Segment fresh;
+
+    if (changed * 8 < main.text_size) {
+        fresh.build(docs);
+        delta = std::move(fresh);
+        delta.adopt();
+        dirty = false;
+
+        return;
+    }
+
+    docs.reserve(docs.size() + main.document_count);
+
+    for (size_t i = 0 ; i < main.document_count ; ++i) {
+        if (mask.count(main.documents[i]) == 0)
+            docs.push_back(make_pair(main.documents[i], main.document(i)));
+    }
+
+    fresh.build(docs);
+    main = std::move(fresh);
+    main.adopt();
+    delta = Segment();
+    delta.adopt();
+
+    mask.clear();
+    changes.clear();
+    positions.clear();
+    dirty = false;
+
+    unmap(); // Nothing points into it any more
+}
+
+/*
+ * The documents containing the pattern, once normalised, in order of their
+ * identifiers; at most limit of them, if not zero. Returns the no. found.
+ */
+size_t
+SuffixArray::find(const string &pattern,
+                  vector<Document> &found,
+                  size_t limit) const
+{
+    const string normal(utility::normalise(pattern));
+    unordered_set<Document> seen;
+
+    found.clear();
+
+    if (normal.empty())
+        return 0;
+
+    search(delta, normal, false, limit, found, seen);
+    search(main, normal, true, limit, found, seen);
+
+    std::sort(found.begin(), found.end());
+
+    return found.size();
+}
+
+void
+SuffixArray::documents(vector<Document> &indexed) const
+{
+    indexed.clear();
+    indexed.reserve(main.document_count + changes.size());
+
+    for (size_t i = 0 ; i < main.document_count ; ++i) {
+        if (mask.count(main.documents[i]) == 0)
+            indexed.push_back(main.documents[i]);
+    }
+
+    unordered_map<Document, string>::const_iterator i(changes.begin());
+
+    for ( ; i != changes.end() ; ++i)
+        indexed.push_back(i->first);
+}
+
+size_t
+SuffixArray::size() const
+{
+    return main.document_count - mask.size() + delta.document_count;
+}
+
+/*
+ * The suffixes starting with the pattern are contiguous; two binary
+ * searches find them, then each is mapped to its document
+ */
+void
+SuffixArray::search(const Segment &s,
+                    const string &pattern,
+                    bool masked,
+                    size_t limit,
+                    vector<Document> &found,
+                    unordered_set<Document> &seen) const
+{
+    const char *text = s.text;
+    const size_t n = s.text_size;
+    const uint32_t *begin = s.suffixes, *end = begin + s.suffix_count;
+
+    const uint32_t *lower = std::lower_bound(
+        begin, end, pattern,
+        [text, n] (uint32_t suffix, const string &p) {
+            return compare(text + suffix, n - suffix, p) < 0;
+        });
+    const uint32_t *upper = std::upper_bound(
+        lower, end, pattern,
+        [text, n] (const string &p, uint32_t suffix) {
+            return compare(text + suffix, n - suffix, p) > 0;
+        });
+
+    for ( ; lower != upper ; ++lower) {
+        if (limit > 0 && found.size() >= limit)
+            return;
+
+        const Document d = s.documents[s.locate(*lower)];
+
+        if (masked && mask.count(d) > 0)
+            continue;
+
+        if (seen.insert(d).second)
+            found.push_back(d);
+    }
+}
+
+void
+SuffixArray::index()
+{
+    if (!positions.empty() || main.document_count == 0)
+        return;
+
+    positions.reserve(main.document_count);
+
+    for (size_t i = 0 ; i < main.document_count ; ++i)
+        positions[main.documents[i]] = i;
+}
+
+void
+SuffixArray::unmap()
+{
+    if (!mapping)
+        return;
+
+    munmap(mapping, mapping_size);
+    mapping = NULL;
+    mapping_size = 0;
+}
+
+} // verbatim
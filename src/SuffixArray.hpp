@@ -0,0 +1,108 @@
+/*
+ * vim: set smartindent autoindent expandtab tabstop=4 shiftwidth=4:
+ */
+
+#ifndef VERBATIM_SUFFIX_ARRAY_HPP
+#define VERBATIM_SUFFIX_ARRAY_HPP
+
+// libstdc++
+#include <string>
+#include <vector>
+#include <utility>
+#include <unordered_set>
+#include <unordered_map>
+
+// libc
+#include <stdint.h>
+#include <stddef.h>
+
+namespace verbatim {
+
+/*
+ * A generalised suffix array over the text of many documents, each a list
+ * of fields, for finding every document containing a substring in
+ * O(m log n). Fields are indexed as given, already normalised (see
+ * utility/Text.hpp) as search keys are, and patterns normalised as searched
+ * for; no match spans two fields.
+ *
+ * Documents are held in two segments: main, and a delta of whatever was
+ * added or changed since main was built. Documents of main since changed or
+ * removed are masked. The delta is rebuilt on each commit() and merged into
+ * main once it outgrows an eighth of it, so keeping the index up to date
+ * costs in proportion to what changed. Saved to a single file and mapped
+ * back from it, a loaded index only reads the pages a search touches.
+ */
+class SuffixArray
+{
+    public:
+        /* Type definitions */
+        typedef uint64_t Document; // Caller-defined identifier
+        typedef std::vector<std::string> Fields;
+
+        /* Member functions/methods */
+        SuffixArray();
+        ~SuffixArray();
+
+        bool load(const std::string &path); // False if there is no such file
+        void save(const std::string &path) const; // Once committed
+
+        bool update(Document d, const Fields &fields); // False if as indexed
+        bool remove(Document d); // False if not indexed
+        void commit(); // Index whatever was updated or removed since
+
+        size_t find(const std::string &pattern,
+                    std::vector<Document> &found,
+                    size_t limit = 0) const; // Zero for no limit
+        void documents(std::vector<Document> &indexed) const;
+        size_t size() const; // No. of documents, as of the last commit()
+    private:
+        /* Type definitions */
+        struct Segment
+        {
+            /*
+             * The arrays, wherever they are; in memory if built, otherwise
+             * mapped from a file
+             */
+            const char *text; // Fields separated by '\n', documents by '\0'
+            const uint32_t *starts; // Of each document, then the end of text
+            const Document *documents;
+            const uint32_t *suffixes;
+            size_t text_size, document_count, suffix_count;
+
+            std::string owned_text;
+            std::vector<uint32_t> owned_starts, owned_suffixes;
+            std::vector<Document> owned_documents;
+
+            Segment();
+            void build(std::vector<std::pair<Document, std::string> > &docs);
+            void adopt(); // Point at the arrays owned
+            std::string document(size_t i) const;
+            size_t locate(uint32_t suffix) const; // Document the suffix is in
+        };
+
+        /* Member functions/methods */
+        SuffixArray(const SuffixArray&); // Not copyable
+        SuffixArray& operator= (const SuffixArray&);
+
+        void search(const Segment &s,
+                    const std::string &pattern,
+                    bool masked,
+                    size_t limit,
+                    std::vector<Document> &found,
+                    std::unordered_set<Document> &seen) const;
+        void index(); // Positions of the documents of main, on demand
+        void unmap();
+
+        /* Member variables/attributes */
+        Segment main, delta;
+        std::unordered_set<Document> mask; // Documents of main superseded
+        std::unordered_map<Document, std::string> changes; // Delta, to be
+        std::unordered_map<Document, size_t> positions; // In main
+        bool dirty;
+        void *mapping;
+        size_t mapping_size;
+};
+
+} // verbatim
+
+#endif // VERBATIM_SUFFIX_ARRAY_HPP
@@ -19,6 +19,20 @@ operator<< (ostream &s, const Img &i)
     return s;
 }
 
+ostream&
+operator<< (ostream &s, const Dir &d)
+{
+    s <<
+        d.path << '\t' <<
+        d.inode << '\t' <<
+        d.modified << '\t' <<
+        d.changed << '\t' <<
+        d.entries << '\t' <<
+        d.scan;
+
+    return s;
+}
+
 ostream&
 operator<< (ostream &s, const Tag &t)
 {
@@ -28,7 +42,16 @@ operator<< (ostream &s, const Tag &t)
         t.genre << '\t' <<
         t.artist << '\t' <<
         t.album << '\t' <<
-        t.title;
+        t.title << '\t' <<
+        t.duration << '\t' <<
+        t.bitrate << '\t' <<
+        t.sample_rate << '\t' <<
+        t.channels;
+
+    for (std::set<std::string>::const_iterator i = t.aliases.begin() ;
+         i != t.aliases.end() ;
+         ++i)
+        s << '\t' << *i;
 
     return s;
 }
@@ -5,19 +5,16 @@
 #ifndef VERBATIM_TAG_HPP
 #define VERBATIM_TAG_HPP
 
-// boost serialization
-#include <boost/archive/text_oarchive.hpp>
-#include <boost/archive/text_iarchive.hpp>
-#include <boost/serialization/string.hpp>
-#include <boost/serialization/vector.hpp>
-
 // libstdc++
+#include <set>
 #include <string>
 #include <vector>
 #include <iostream>
 
 // libc
 #include <time.h> // For time_t
+#include <stdint.h>
+#include <sys/types.h> // For ino_t
 
 namespace verbatim {
 
@@ -27,22 +24,12 @@ struct Img
     typedef std::vector<char> ByteVector;
 
     size_t size;
-    ByteVector data;
+    ByteVector data; // Empty once stored in the blob store
     std::string mimetype;
+    uint64_t blob; // Offset of the data in the blob store, 0 if not there
 
     /* Member functions/methods */
-    Img() : size(0) {}
-
-    template<typename Archive>
-    void
-    serialize(Archive &archive,
-              unsigned int /* version */)
-    {
-        archive
-            & size
-            & data
-            & mimetype;
-    }
+    Img() : size(0), blob(0) {}
 };
 
 struct Tag
@@ -53,27 +40,68 @@ struct Tag
                 album,      // EP/LP/Single/Album name
                 title,      // Track title
                 genre,      // Apparent genre
-                filename;   // Source filename
+                filename,   // Source filename
+                artist_key, // Search keys, the fields above as normalised
+                album_key,  // by utility::normalise
+                title_key,
+                genre_key;
+    std::set<std::string> aliases; // Hard links to filename, if any
+    unsigned duration,      // Milliseconds, 0 if unknown as all these are
+             bitrate,       // Average, kbit/s
+             sample_rate,   // Hz
+             channels;
+
+    /* Member functions/methods */
+    Tag() :
+        modified(0),
+        duration(0),
+        bitrate(0),
+        sample_rate(0),
+        channels(0)
+    {
+    }
+};
+
+struct Dir
+{
+    /* Member variables/attributes */
+    ino_t inode;            // Inode of directory at last scan
+    uint64_t modified,      // Modification time (ns) of directory entries
+             changed;       // Status change time (ns) of directory inode
+    size_t entries;         // No. of entries (excluding . and ..)
+    uint64_t scan;          // Generation of the scan that completed it
+    std::string path;       // Source directory
 
     /* Member functions/methods */
-    Tag() : modified(0) {}
+    Dir() : inode(0), modified(0), changed(0), entries(0), scan(0) {}
 
-    template<typename Archive>
-    void
-    serialize(Archive &archive,
-              unsigned int /* version */)
+    bool
+    operator== (const Dir &other) const
     {
-        archive
-            & modified
-            & artist
-            & album
-            & title
-            & genre
-            & filename;
+        return
+            inode == other.inode &&
+            modified == other.modified &&
+            changed == other.changed &&
+            entries == other.entries;
     }
 };
 
+/*
+ * The scan in progress, if any. Present from the start of a scan until it
+ * completes, so when found at start up the previous run was interrupted.
+ */
+struct Scan
+{
+    /* Member variables/attributes */
+    uint64_t generation;            // Distinguishes one scan from the next
+    std::vector<std::string> roots; // Source directories
+
+    /* Member functions/methods */
+    Scan() : generation(0) {}
+};
+
 std::ostream& operator<< (std::ostream &s, const Img &i);
+std::ostream& operator<< (std::ostream &s, const Dir &d);
 std::ostream& operator<< (std::ostream &s, const Tag &t);
 
 } // verbatim
@@ -5,63 +5,606 @@
 // Interface
 #include "Traverse.hpp"
 
+// verbatim
+#include "utility/Ring.hpp"
+#include "utility/Exception.hpp"
+
+// libstdc++
+#include <set>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <condition_variable>
+
 // libc
-#include <ftw.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h> // For DT_* only
 #include <assert.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
 
+using std::set;
 using std::endl;
+using std::pair;
+using std::deque;
+using std::mutex;
 using std::string;
+using std::thread;
+using std::vector;
 using std::ostream;
+using std::lock_guard;
+using std::unique_lock;
+using std::unique_ptr;
 
-namespace verbatim {
+namespace {
+
+/*
+ * Record layout returned by getdents64(2). There is no glibc wrapper (prior
+ * to 2.30) so we define it here and invoke the system call directly.
+ */
+struct linux_dirent64
+{
+    ino64_t d_ino;
+    off64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[1]; // Actually d_reclen - offsetof(d_name) bytes
+};
+
+inline
+int
+getdents64(int fd, char *buffer, size_t size)
+{
+    return syscall(SYS_getdents64, fd, buffer, size);
+}
+
+inline
+bool
+is_dot_or_dotdot(const char *name)
+{
+    return name[0] == '.' &&
+           (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+}
+
+} // anonymous
 
-Traverse*
-Traverse::traverser = NULL;
+namespace verbatim {
 
-class Traverse::Dispatcher {
+/*
+ * Walker (interface)
+ *
+ * A directory is the unit of work. Each walker thread owns a queue of
+ * directories it has discovered and pops from the back of it (depth first,
+ * warm dentry cache) while idle walkers steal from the front of another's
+ * queue (breadth first, largest remaining subtrees). The traversal is over
+ * once no directory is queued or being read. Directories remember the root
+ * they were found beneath so that each root can be timed independently,
+ * even though all of them are walked at once by the same threads.
+ */
+class Traverse::Walker
+{
     public:
-        inline void operator() (const Traverse::Path &p)
+        /* Methods/Member functions */
+        Walker(Traverse &t, size_t threads);
+
+        void run(const vector<string> &paths);
+    private:
+        /* Type definitions */
+        struct Directory
         {
-            assert(Traverse::traverser != NULL);
-            Traverse::traverser->delegate.dispatch(p);
-        }
+            string path;
+            size_t root; // Index of root beneath which this was found
+            Directory() : root(0) {}
+            Directory(const string &p, size_t r) : path(p), root(r) {}
+        };
+
+        struct Queue
+        {
+            mutex lock;
+            deque<Directory> directories;
+        };
+
+        struct Root
+        {
+            std::atomic<size_t> pending, directories, files;
+            utility::Timer timer;
+            Root() : pending(0), directories(0), files(0) {}
+        };
+
+        struct Entry
+        {
+            string name;
+            unsigned char type; // DT_* or DT_UNKNOWN
+            bool wanted; // Still to be stat()ed and dispatched
+            struct stat info;
+            Entry(const char *n, unsigned char t) :
+                name(n),
+                type(t),
+                wanted(true) {}
+        };
+
+        typedef pair<dev_t, ino_t> Identity;
+
+        /* Methods/Member functions */
+        void work(size_t self); // THREAD ENTRY POINT
+        bool next(size_t self, Directory &directory);
+        void push(size_t self, const Directory &directory);
+        void done(const Directory &directory);
+        void read_directory(size_t self, const Directory &directory);
+        void stat_entries(int fd, vector<Entry> &entries);
+        void stat_entries(utility::Ring &ring, int fd, vector<Entry> &entries);
+        bool first_visit(const struct stat &info);
+        void dispatch(size_t self, const Path &p);
+        void flush(size_t self);
+
+        /* Attributes/member variables */
+        Traverse &traverser;
+        vector<Queue> queues;
+        vector<Batch> batches; // One per walker, not shared
+        vector<unique_ptr<utility::Ring> > rings; // Ditto, if asynchronous
+        const bool batching;
+        vector<Root> roots;
+
+        std::atomic<size_t> queued,  // Directories waiting in a queue
+                            pending, // Directories queued or being read
+                            directories,
+                            files,
+                            pruned,
+                            skipped;
+
+        mutex idle_lock;
+        std::condition_variable idle;
+
+        mutex visited_lock;
+        set<Identity> visited; // Symbolic links are followed, avoid cycles
 };
 
-} // verbatim
+/*
+ * Walker (implementation)
+ */
+Traverse::Walker::Walker(Traverse &t, size_t threads) :
+    traverser(t),
+    queues(threads ? threads : 1),
+    batches(queues.size()),
+    batching(!t.batch_delegate.empty()),
+    queued(0),
+    pending(0),
+    directories(0),
+    files(0),
+    pruned(0),
+    skipped(0)
+{
+    for (size_t i = 0 ; batching && i < batches.size() ; ++i)
+        batches[i].reserve(traverser.batch_size);
+
+    rings.resize(traverser.queue_depth ? queues.size() : 0);
+
+    for (size_t i = 0 ; i < rings.size() ; ++i) {
+        try {
+            rings[i].reset(new utility::Ring(traverser.queue_depth));
+        } catch (const utility::Exception &e) {
+            break; // Silently fall back to synchronous fstatat()
+        }
+    }
+}
+
+void
+Traverse::Walker::run(const vector<string> &paths)
+{
+    struct stat info;
+
+    roots = vector<Root>(paths.size());
+
+    for (size_t i = 0 ; i < paths.size() ; ++i) {
+        Root &r = roots[i];
+
+        r.timer.start();
+
+        if (stat(paths[i].c_str(), &info) == -1) {
+            r.timer.stop();
+            continue;
+        }
+
+        /*
+         * Spread the roots over the walkers up front rather than waiting
+         * for the others to steal them
+         */
+        const size_t self = i % queues.size();
+        dispatch(self, Path(paths[i].c_str(), &info));
+
+        if (S_ISDIR(info.st_mode) && first_visit(info))
+            push(self, Directory(paths[i], i));
+        else
+            r.timer.stop();
+    }
+
+    /*
+     * The calling thread is always walker zero
+     */
+    vector<unique_ptr<thread> > helpers;
+    helpers.reserve(queues.size() - 1);
+
+    for (size_t i = 1 ; i < queues.size() ; ++i)
+        helpers.push_back(unique_ptr<thread>(
+                    new thread(&Traverse::Walker::work, this, i)));
 
-namespace C {
+    work(0);
+
+    for (size_t i = 0 ; i < helpers.size() ; ++i)
+        helpers[i]->join();
+
+    assert(pending == 0);
+
+    traverser.directories = directories;
+    traverser.files = files;
+    traverser.pruned = pruned;
+    traverser.skipped = skipped;
+    traverser.requests = traverser.syscalls = 0;
+
+    for (size_t i = 0 ; i < rings.size() ; ++i) {
+        if (rings[i]) {
+            traverser.requests += rings[i]->requests();
+            traverser.syscalls += rings[i]->syscalls();
+        }
+    }
+
+    for (size_t i = 0 ; i < roots.size() ; ++i) {
+        Traverse::Root r(paths[i]);
+
+        r.directories = roots[i].directories;
+        r.files = roots[i].files;
+        r.dispatch_scan_time = roots[i].timer.elapsed();
+
+        traverser.roots.push_back(r);
+    }
+}
+
+void
+Traverse::Walker::work(size_t self) // THREAD ENTRY POINT
+{
+    Directory directory;
+
+    while (true) {
+        if (next(self, directory)) {
+            read_directory(self, directory);
+            done(directory);
+            continue;
+        }
+
+        unique_lock<mutex> l(idle_lock);
+        idle.wait(l, [this] { return queued > 0 || pending == 0; });
+
+        if (pending == 0)
+            break;
+    }
+
+    flush(self);
+}
+
+bool
+Traverse::Walker::next(size_t self, Directory &directory)
+{
+    {
+        Queue &mine = queues[self];
+        lock_guard<mutex> l(mine.lock);
+
+        if (!mine.directories.empty()) {
+            std::swap(directory, mine.directories.back());
+            mine.directories.pop_back();
+            --queued;
+            return true;
+        }
+    }
+
+    for (size_t i = 1 ; i < queues.size() ; ++i) {
+        Queue &victim = queues[(self + i) % queues.size()];
+        lock_guard<mutex> l(victim.lock);
+
+        if (!victim.directories.empty()) {
+            std::swap(directory, victim.directories.front());
+            victim.directories.pop_front();
+            --queued;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void
+Traverse::Walker::push(size_t self, const Directory &directory)
+{
+    ++roots[directory.root].pending;
+    ++pending;
+
+    {
+        Queue &mine = queues[self];
+        lock_guard<mutex> l(mine.lock);
+        mine.directories.push_back(directory);
+    }
+
+    ++queued;
+
+    if (queues.size() > 1) {
+        lock_guard<mutex> l(idle_lock);
+        idle.notify_one();
+    }
+}
 
 /*
- * See man nftw for more info.
+ * A directory has been read (and any subdirectories pushed) so if it was the
+ * last outstanding beneath its root, that root is finished
  */
-extern "C"
-int
-nftw_callback(const char *path,
-              const struct stat *sb,
-              int flags,
-              struct FTW *ftw)
+void
+Traverse::Walker::done(const Directory &directory)
 {
-    if (flags != FTW_NS) {
-        static verbatim::Traverse::Dispatcher dispatch;
-        dispatch(verbatim::Traverse::Path(path, sb));
+    Root &r = roots[directory.root];
+
+    if (--r.pending == 0)
+        r.timer.stop();
+
+    if (--pending == 0) {
+        lock_guard<mutex> l(idle_lock);
+        idle.notify_all();
+    }
+}
+
+void
+Traverse::Walker::read_directory(size_t self, const Directory &directory)
+{
+    static const size_t buffer_size = 32768;
+
+    if (traverser.stopped)
+        return; // Drains the queues without reading any further
+
+    const int fd = openat(AT_FDCWD,
+                          directory.path.c_str(),
+                          O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    if (fd == -1)
+        return; // Unreadable, the directory itself has been dispatched
+
+    char buffer[buffer_size];
+    vector<Entry> entries;
+    struct stat info;
+    int n;
+
+    if (fstat(fd, &info) == -1) {
+        close(fd);
+        return;
     }
 
-    return 0; // Returning non-zero will terminate the nftw() traversal
+    while ((n = getdents64(fd, buffer, buffer_size)) > 0) {
+        for (int i = 0 ; i < n ; ) {
+            const linux_dirent64 *d =
+                reinterpret_cast<const linux_dirent64*>(buffer + i);
+            const char *name = buffer + i + offsetof(linux_dirent64, d_name);
+
+            i += d->d_reclen;
+
+            if (!is_dot_or_dotdot(name))
+                entries.push_back(Entry(name, d->d_type));
+        }
+    }
+
+    ++directories;
+    ++roots[directory.root].directories;
+
+    /*
+     * An unchanged directory still has its subdirectories walked, they
+     * carry their own modification times, but nothing else is looked at
+     */
+    const bool unchanged =
+        traverser.filter &&
+        !(*traverser.filter)(Path(directory.path.c_str(), &info),
+                             entries.size());
+    string path(directory.path);
+
+    if (unchanged)
+        ++pruned;
+
+    if (path.empty() || path[path.size() - 1] != '/')
+        path += '/';
+
+    const size_t prefix = path.size();
+
+    for (size_t i = 0 ; unchanged && i < entries.size() ; ++i) {
+        Entry &e = entries[i];
+
+        if (e.type != DT_DIR && e.type != DT_LNK && e.type != DT_UNKNOWN) {
+            e.wanted = false;
+            ++skipped;
+        }
+    }
+
+    if (self < rings.size() && rings[self])
+        stat_entries(*rings[self], fd, entries);
+    else
+        stat_entries(fd, entries);
+
+    for (size_t i = 0 ; i < entries.size() ; ++i) {
+        const Entry &e = entries[i];
+
+        if (!e.wanted)
+            continue;
+
+        if (unchanged && !S_ISDIR(e.info.st_mode)) {
+            ++skipped;
+            continue;
+        }
+
+        path.resize(prefix);
+        path += e.name;
+
+        dispatch(self, Path(path.c_str(), &e.info));
+
+        if (S_ISDIR(e.info.st_mode)) {
+            if (first_visit(e.info))
+                push(self, Directory(path, directory.root));
+        } else {
+            ++files;
+            ++roots[directory.root].files;
+        }
+    }
+
+    close(fd);
 }
 
-} // C
+void
+Traverse::Walker::stat_entries(int fd, vector<Entry> &entries)
+{
+    for (size_t i = 0 ; i < entries.size() ; ++i) {
+        Entry &e = entries[i];
 
-namespace verbatim {
+        if (e.wanted && fstatat(fd, e.name.c_str(), &e.info, 0) == -1)
+            e.wanted = false; // Equivalent of FTW_NS, skip it
+    }
+}
+
+/*
+ * As above but with up to a queue depth of statx() requests in flight at
+ * once, which on NFS or a cold disk is the difference between paying the
+ * latency of one request per entry and one per queue depth of entries
+ */
+void
+Traverse::Walker::stat_entries(utility::Ring &ring,
+                               int fd,
+                               vector<Entry> &entries)
+{
+    static const unsigned mask = STATX_BASIC_STATS;
+    vector<struct statx> buffers(std::min<size_t>(ring.depth(),
+                                                  entries.size()));
+    vector<size_t> slots(buffers.size()); // Buffer slot -> entry
+    size_t i = 0;
+
+    while (i < entries.size()) {
+        unsigned n = 0;
+
+        for ( ; i < entries.size() && n < buffers.size() ; ++i) {
+            if (!entries[i].wanted)
+                continue;
+
+            slots[n] = i;
+
+            if (!ring.statx(fd, entries[i].name.c_str(), 0, mask,
+                            &buffers[n], n))
+                break; // Full, shouldn't happen as we never over-commit
+
+            ++n;
+        }
+
+        ring.submit(n);
+
+        uint64_t slot;
+        int result;
+
+        while (n > 0 && ring.reap(slot, result)) {
+            Entry &e = entries[slots[slot]];
+
+            if (result == 0)
+                utility::Ring::to_stat(buffers[slot], e.info);
+            else if (result == -EINVAL || result == -EOPNOTSUPP)
+                e.wanted = fstatat(fd, e.name.c_str(), &e.info, 0) == 0;
+            else
+                e.wanted = false; // Equivalent of FTW_NS, skip it
+
+            --n;
+        }
+
+        assert(n == 0);
+    }
+}
+
+bool
+Traverse::Walker::first_visit(const struct stat &info)
+{
+    const Identity id(info.st_dev, info.st_ino);
+    lock_guard<mutex> l(visited_lock);
+    return visited.insert(id).second;
+}
+
+inline
+void
+Traverse::Walker::dispatch(size_t self, const Path &p)
+{
+    traverser.delegate.dispatch(p);
+
+    if (batching) {
+        Batch &b = batches[self];
+
+        b.add(p);
+
+        if (b.size() >= traverser.batch_size)
+            flush(self);
+    }
+}
+
+void
+Traverse::Walker::flush(size_t self)
+{
+    Batch &b = batches[self];
+
+    if (b.empty())
+        return;
+
+    traverser.batch_delegate.dispatch(b);
+    b.clear();
+}
+
+/*
+ * Batch (implementation)
+ */
+void
+Traverse::Batch::add(const Path &p)
+{
+    offsets.push_back(names.size());
+    names.append(p.name);
+    names.push_back('\0');
+    infos.push_back(*p.info);
+}
+
+void
+Traverse::Batch::clear()
+{
+    names.clear();
+    offsets.clear();
+    infos.clear();
+}
+
+void
+Traverse::Batch::reserve(size_t n)
+{
+    names.reserve(n * 64); // Rough guess of average path length
+    offsets.reserve(n);
+    infos.reserve(n);
+}
 
 /* Methods/Member functions */
-Traverse::Traverse()
+Traverse::Traverse(size_t w, size_t b) :
+    filter(NULL),
+    walkers(w),
+    batch_size(b ? b : 1),
+    directories(0),
+    files(0),
+    pruned(0),
+    skipped(0),
+    queue_depth(0),
+    requests(0),
+    syscalls(0),
+    stopped(false)
 {
-    Traverse::traverser = this; // Bind
 }
 
 Traverse::~Traverse()
 {
-    Traverse::traverser = NULL; // Unbind
 }
 
 void
@@ -70,13 +613,54 @@ Traverse::register_callback(Callback *callback)
     delegate.connect(callback, &Callback::operator());
 }
 
+void
+Traverse::register_callback(BatchCallback *callback)
+{
+    batch_delegate.connect(callback, &BatchCallback::operator());
+}
+
+/*
+ * Have each walker stat() directory entries with io_uring(7), with up to
+ * queue_depth requests in flight, if the kernel allows. Zero disables.
+ */
+void
+Traverse::asynchronous(unsigned depth)
+{
+    queue_depth = depth && utility::Ring::supported() ? depth : 0;
+}
+
+void
+Traverse::register_filter(Filter *f)
+{
+    filter = f;
+}
+
+/*
+ * Safe to call from any thread. Directories still queued are abandoned
+ * unread, as are those of any later scan.
+ */
+void
+Traverse::stop()
+{
+    stopped = true;
+}
+
 void
 Traverse::scan(const string &path)
+{
+    scan(vector<string>(1, path));
+}
+
+void
+Traverse::scan(const vector<string> &paths)
 {
     utility::Timer t;
+    Walker w(*this, walkers);
+
+    roots.clear();
 
     t.start();
-    nftw(path.c_str(), &C::nftw_callback, 256, 0);
+    w.run(paths);
     t.stop();
 
     dispatch_scan_time = t.elapsed();
@@ -90,8 +674,51 @@ Traverse::print_metrics(ostream &stream) const
         dispatch_scan_time.seconds <<
         "s " <<
         dispatch_scan_time.nanoseconds <<
-        "ns\n";
+        "ns\n" <<
+        "verbatim[Traverse]: #walkers =      " <<
+        walkers <<
+        endl <<
+        "verbatim[Traverse]: #directories =  " <<
+        directories <<
+        endl <<
+        "verbatim[Traverse]: #files =        " <<
+        files <<
+        endl <<
+        "verbatim[Traverse]: #unchanged =    " <<
+        pruned <<
+        endl <<
+        "verbatim[Traverse]: #skipped =      " <<
+        skipped <<
+        endl;
+
+    if (queue_depth)
+        stream <<
+            "verbatim[Traverse]: Queue depth =   " <<
+            queue_depth <<
+            endl <<
+            "verbatim[Traverse]: #requests =     " <<
+            requests <<
+            endl <<
+            "verbatim[Traverse]: #syscalls =     " <<
+            syscalls <<
+            endl;
+
+    for (size_t i = 0 ; i < roots.size() ; ++i) {
+        const Root &r = roots[i];
+
+        stream <<
+            "verbatim[Traverse]: " <<
+            r.path <<
+            ": Dispatch time = " <<
+            r.dispatch_scan_time.seconds <<
+            "s " <<
+            r.dispatch_scan_time.nanoseconds <<
+            "ns, #directories = " <<
+            r.directories <<
+            ", #files = " <<
+            r.files <<
+            endl;
+    }
 }
 
 } // verbatim
-
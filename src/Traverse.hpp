@@ -10,7 +10,9 @@
 #include "utility/Delegate.hpp"
 
 // libstdc++
+#include <atomic>
 #include <string>
+#include <vector>
 #include <iostream>
 
 // libc
@@ -30,31 +32,100 @@ class Traverse
             Path(const char *s, const struct stat *t) : name(s), info(t) {}
         };
 
+        /*
+         * Callbacks are invoked from each walker thread so must be thread
+         * safe when the traversal is run with more than one walker.
+         */
         struct Callback : public utility::Observer {
             virtual ~Callback() {}
             virtual void operator() (const Path&) = 0;
         };
 
-        class Dispatcher; // Forward declaration only (for friend declaration)
+        /*
+         * A block of paths. Unlike a Path, whose pointers are only valid for
+         * the duration of the callback, a Batch owns copies of the names and
+         * stat buffers; Paths taken from it are valid until it is modified.
+         */
+        class Batch {
+            public:
+                inline size_t size() const { return infos.size(); }
+                inline bool empty() const { return infos.empty(); }
+                inline Path operator[] (size_t i) const
+                {
+                    return Path(names.data() + offsets[i], &infos[i]);
+                }
+
+                void add(const Path &p);
+                void clear();
+                void reserve(size_t n);
+            private:
+                std::string names; // NUL separated
+                std::vector<size_t> offsets;
+                std::vector<struct stat> infos;
+        };
+
+        /*
+         * As Callback, but invoked with up to batch_size Paths at a time
+         * to amortise the cost of dispatch (and whatever the observer does
+         * per invocation) over many paths.
+         */
+        struct BatchCallback : public utility::Observer {
+            virtual ~BatchCallback() {}
+            virtual void operator() (const Batch&) = 0;
+        };
+
+        /*
+         * Consulted once per directory, after its entries have been read but
+         * before any are dispatched. Returning false declares the directory
+         * unchanged; its non-directory entries are then neither stat()ed nor
+         * dispatched while its subdirectories are still walked.
+         */
+        struct Filter : public utility::Observer {
+            virtual ~Filter() {}
+            virtual bool operator() (const Path &directory, size_t entries) = 0;
+        };
+
+        class Walker; // Forward declaration only (for friend declaration)
 
         /* Methods/Member functions */
-        Traverse();
+        Traverse(size_t walkers = 1, size_t batch_size = 256);
         ~Traverse();
 
         void register_callback(Callback *callback);
+        void register_callback(BatchCallback *callback);
+        void register_filter(Filter *filter);
+        void asynchronous(unsigned queue_depth);
         void scan(const std::string &path);
+        void scan(const std::vector<std::string> &paths); // Concurrently
+        void stop();
         void print_metrics(std::ostream &stream) const;
+
+        inline size_t threads() const { return walkers; }
     private:
+        /* Type definitions */
+        struct Root
+        {
+            std::string path;
+            size_t directories, files;
+            utility::Timer::Duration dispatch_scan_time;
+            Root(const std::string &p) : path(p), directories(0), files(0) {}
+        };
+
         /* Attributes/member variables */
-        static Traverse *traverser; // Required for libc func ptr callback :(
+        Filter *filter;
+        std::vector<Root> roots;
+        size_t walkers, batch_size, directories, files, pruned, skipped;
+        unsigned queue_depth;
+        size_t requests, syscalls; // Of io_uring, if asynchronous
+        std::atomic<bool> stopped;
         utility::Timer::Duration dispatch_scan_time;
         utility::Delegate<const Path&, void> delegate;
+        utility::Delegate<const Batch&, void> batch_delegate;
 
         /* Friend class declarations */
-        friend class Dispatcher;
+        friend class Walker;
 };
 
 } // verbatim
 
 #endif
-
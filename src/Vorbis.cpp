@@ -0,0 +1,536 @@
+/*
+ * vim: set smartindent autoindent expandtab tabstop=4 shiftwidth=4:
+ */
+
+// Interface
+#include "Vorbis.hpp"
+
+// verbatim
+#include "utility/Text.hpp"
+
+// libstdc++
+#include <string>
+#include <vector>
+#include <algorithm>
+
+// libc
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+
+using std::string;
+using std::vector;
+
+using verbatim::Metadata;
+
+namespace {
+
+typedef const unsigned char Byte;
+
+/*
+ * FLAC metadata block types
+ */
+static const unsigned STREAMINFO = 0;
+static const unsigned VORBIS_COMMENT = 4;
+static const unsigned PICTURE = 6;
+static const unsigned INVALID = 127;
+
+static const uint32_t FRONT_COVER = 3; // Picture type, as of ID3v2 APIC
+
+static const size_t OGG_HEADER_SIZE = 27; // Before the segment table
+
+/*
+ * Of the end of an Ogg file, for the last page: most are of a few KB, none
+ * more than 64KB
+ */
+static const size_t OGG_TAIL_SIZE = 8192;
+static const size_t OGG_PAGE_SIZE = 65307;
+
+static const unsigned OPUS_SAMPLE_RATE = 48000; // Whatever it was encoded of
+
+inline
+uint32_t
+big_endian(const char *p, size_t n)
+{
+    Byte *b = reinterpret_cast<Byte*>(p);
+    uint32_t v = 0;
+
+    for (size_t i = 0 ; i < n ; ++i)
+        v = v << 8 | b[i];
+
+    return v;
+}
+
+inline
+uint32_t
+little_endian32(const char *p)
+{
+    Byte *b = reinterpret_cast<Byte*>(p);
+    return b[0] | b[1] << 8 | b[2] << 16 | uint32_t(b[3]) << 24;
+}
+
+/*
+ * Duration, from a count of samples, and the average bitrate of the bytes
+ * of audio over it
+ */
+void
+properties(uint64_t samples, uint64_t bytes, Metadata &m)
+{
+    if (m.sample_rate == 0)
+        return;
+
+    m.duration = samples * 1000 / m.sample_rate;
+
+    if (m.duration > 0)
+        m.bitrate = bytes * 8 / m.duration;
+}
+
+/*
+ * STREAMINFO: block sizes and frame sizes, then 20 bits of sample rate,
+ * 3 of channels less one, 5 of bits per sample less one and 36 of samples
+ */
+void
+streaminfo(const char *data, size_t size, Metadata &m, uint64_t &samples)
+{
+    Byte *b = reinterpret_cast<Byte*>(data);
+
+    if (size < 18)
+        return;
+
+    m.sample_rate = b[10] << 12 | b[11] << 4 | b[12] >> 4;
+
+    if (m.sample_rate == 0) // Invalid, as is the rest
+        return;
+
+    m.channels = (b[12] >> 1 & 0x07) + 1;
+    samples = uint64_t(b[13] & 0x0F) << 32 | big_endian(data + 14, 4);
+}
+
+/*
+ * Bytes decoded in place, padding and anything not of the alphabet
+ * skipped. The size left.
+ */
+size_t
+base64_decode(char *data, size_t size)
+{
+    static const char alphabet[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    signed char values[256];
+    uint32_t bits = 0;
+    size_t n = 0, out = 0;
+
+    memset(values, -1, sizeof(values));
+
+    for (size_t i = 0 ; i < 64 ; ++i)
+        values[Byte(alphabet[i])] = i;
+
+    for (size_t i = 0 ; i < size ; ++i) {
+        const signed char v = values[Byte(data[i])];
+
+        if (v < 0)
+            continue;
+
+        bits = bits << 6 | v;
+
+        if (++n % 4 == 0) {
+            data[out++] = bits >> 16;
+            data[out++] = bits >> 8;
+            data[out++] = bits;
+        }
+    }
+
+    if (n % 4 == 2) {
+        data[out++] = bits >> 4;
+    } else if (n % 4 == 3) {
+        data[out++] = bits >> 10;
+        data[out++] = bits >> 2;
+    }
+
+    return out;
+}
+
+/*
+ * A PICTURE block: type, MIME type, description, dimensions and colours,
+ * then the picture, each length prefixed and all big endian. Taken unless
+ * the one already found is a front cover, or this one is not either. The
+ * buffer is of the block.
+ */
+bool
+picture(const char *data,
+        size_t size,
+        const std::shared_ptr<const void> &buffer,
+        Metadata &m,
+        bool &front)
+{
+    size_t at = 0;
+
+    if (size < 8)
+        return false;
+
+    const uint32_t type = big_endian(data, 4);
+    const size_t mime = big_endian(data + 4, 4);
+
+    at = 8;
+
+    if (mime > size - at || size - at - mime < 4)
+        return false;
+
+    const string mimetype(data + at, mime);
+    at += mime;
+
+    const size_t description = big_endian(data + at, 4);
+    at += 4;
+
+    if (description > size - at || size - at - description < 20)
+        return false;
+
+    at += description + 16; // Width, height, depth and colours
+
+    const size_t length = big_endian(data + at, 4);
+    at += 4;
+
+    if (length > size - at)
+        return false;
+
+    if (length == 0 || front || (!m.picture.empty() && type != FRONT_COVER))
+        return true;
+
+    m.picture = boost::string_ref(data + at, length);
+    m.mimetype = mimetype;
+    m.buffer = buffer;
+    front = type == FRONT_COVER;
+
+    return true;
+}
+
+/*
+ * "KEY=value", the key of any case
+ */
+bool
+is(const char *comment, size_t size, const char *key)
+{
+    const size_t n = strlen(key);
+    return size > n && comment[n] == '=' && strncasecmp(comment, key, n) == 0;
+}
+
+/*
+ * A vendor string, then a count of comments, each length prefixed, all
+ * little endian. Framing, of Vorbis, and what follows is ignored.
+ */
+bool
+comments(const char *data, size_t size, Metadata &m, bool &front)
+{
+    static const char *const fields[] = {"TITLE", "ARTIST", "ALBUM", "GENRE"};
+    string *values[] = {&m.title, &m.artist, &m.album, &m.genre};
+    static const char picture_key[] = "METADATA_BLOCK_PICTURE";
+    size_t at = 0;
+
+    if (size < 4 || little_endian32(data) > size - 4)
+        return false;
+
+    at = 4 + little_endian32(data);
+
+    if (size - at < 4)
+        return false;
+
+    uint32_t count = little_endian32(data + at);
+
+    for (at += 4 ; count > 0 ; --count) {
+        if (size - at < 4 || little_endian32(data + at) > size - at - 4)
+            return false;
+
+        const char *comment = data + at + 4;
+        const size_t n = little_endian32(data + at);
+
+        at += 4 + n;
+
+        for (size_t i = 0 ; i < sizeof(fields) / sizeof(fields[0]) ; ++i) {
+            const size_t key = strlen(fields[i]);
+
+            if (is(comment, n, fields[i])) {
+                string value;
+
+                verbatim::utility::utf8_to_utf8(comment + key + 1,
+                                                n - key - 1,
+                                                value);
+                verbatim::append_value(*values[i], value);
+            }
+        }
+
+        if (!front && is(comment, n, picture_key)) {
+            const size_t key = sizeof(picture_key) - 1;
+            const std::shared_ptr<char> block(verbatim::allocate(n - key - 1));
+
+            memcpy(block.get(), comment + key + 1, n - key - 1);
+
+            const size_t decoded = base64_decode(block.get(), n - key - 1);
+
+            if (!picture(block.get(), decoded, block, m, front))
+                return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * The granule position of the last page of the stream, of samples whether
+ * Vorbis or Opus, searched for backwards from the end of the file. Only
+ * if not in the last few KB are the last 64KB read.
+ */
+bool
+last_granule(int fd,
+             off_t from,
+             off_t end,
+             uint32_t serial,
+             Metadata &m,
+             uint64_t &granule)
+{
+    const size_t sizes[] = {OGG_TAIL_SIZE, OGG_PAGE_SIZE};
+    vector<char> tail;
+
+    for (size_t i = 0 ; i < 2 ; ++i) {
+        const size_t n = std::min<off_t>(sizes[i], end - from);
+
+        if (n <= tail.size() || n < OGG_HEADER_SIZE)
+            break;
+
+        tail.resize(n);
+
+        if (!verbatim::read_at(fd, &tail[0], n, end - n, m))
+            return false;
+
+        for (size_t at = n - OGG_HEADER_SIZE + 1 ; at-- > 0 ; ) {
+            if (memcmp(&tail[at], "OggS", 4) != 0 || tail[at + 4] != 0 ||
+                little_endian32(&tail[at + 14]) != serial)
+                continue;
+
+            granule = little_endian32(&tail[at + 6]) |
+                      uint64_t(little_endian32(&tail[at + 10])) << 32;
+
+            if (granule != ~uint64_t(0)) // Of no packet ending on the page
+                return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * The packet a page's segments are added to. A segment of less than 255
+ * bytes ends its packet.
+ */
+void
+segments(const vector<char> &page,
+         const unsigned char *lacing,
+         size_t n,
+         vector<char> *packets,
+         size_t &complete)
+{
+    size_t at = 0;
+
+    for (size_t i = 0 ; i < n && complete < 2 ; ++i) {
+        packets[complete].insert(packets[complete].end(),
+                                 page.begin() + at,
+                                 page.begin() + at + lacing[i]);
+        at += lacing[i];
+
+        if (lacing[i] < 255)
+            ++complete;
+    }
+}
+
+/*
+ * The identification header: of Vorbis, its version, channels, sample rate
+ * and maximum, nominal and minimum bitrates (bit/s) after the signature;
+ * of Opus, its version, channels, samples of pre-skip and the sample rate
+ * of what was encoded. The duration is of the last page, or if there is no
+ * page of audio to be found of the nominal bitrate.
+ */
+void
+identification(int fd,
+               const vector<char> &packet,
+               uint32_t serial,
+               Metadata &m)
+{
+    const bool opus = packet[0] == 'O';
+    struct stat info;
+    uint64_t granule = 0;
+    unsigned skip = 0, nominal = 0;
+
+    if (packet.size() < (opus ? 19 : 28) ||
+        fstat(fd, &info) == -1 ||
+        info.st_size <= m.audio)
+        return;
+
+    const uint64_t bytes = info.st_size - m.audio;
+
+    if (opus) {
+        m.channels = Byte(packet[9]);
+        m.sample_rate = OPUS_SAMPLE_RATE;
+        skip = Byte(packet[10]) | Byte(packet[11]) << 8;
+    } else {
+        const int32_t bitrate = little_endian32(&packet[20]);
+
+        m.channels = Byte(packet[11]);
+        m.sample_rate = little_endian32(&packet[12]);
+        nominal = bitrate > 0 ? bitrate / 1000 : 0;
+    }
+
+    if (last_granule(fd, m.audio, info.st_size, serial, m, granule) &&
+        granule > skip) {
+        properties(granule - skip, bytes, m);
+    } else if (nominal > 0) {
+        m.bitrate = nominal;
+        m.duration = bytes * 8 / nominal;
+    }
+}
+
+} // anonymous
+
+namespace verbatim {
+
+Metadata::Result
+read_flac(int fd, Metadata &m)
+{
+    char header[4];
+    off_t at = sizeof(header);
+    bool last = false, commented = false, front = false;
+    uint64_t samples = 0;
+    struct stat info;
+
+    if (!read_at(fd, header, sizeof(header), 0, m) ||
+        memcmp(header, "fLaC", 4) != 0)
+        return Metadata::ABSENT;
+
+    while (!last) {
+        if (!read_at(fd, header, sizeof(header), at, m))
+            return Metadata::UNREADABLE;
+
+        const unsigned type = Byte(header[0]) & 0x7F;
+        const size_t size = big_endian(header + 1, 3);
+
+        last = Byte(header[0]) & 0x80;
+        at += sizeof(header);
+
+        if (type == INVALID)
+            return Metadata::UNREADABLE;
+
+        if (type == STREAMINFO && m.sample_rate == 0) {
+            char block[18];
+            const size_t n = std::min(size, sizeof(block));
+
+            if (!read_at(fd, block, n, at, m))
+                return Metadata::UNREADABLE;
+
+            streaminfo(block, n, m, samples);
+        }
+
+        if ((type == VORBIS_COMMENT && !commented) ||
+            (type == PICTURE && !front)) {
+            const std::shared_ptr<char> block(allocate(size));
+
+            if (!read_at(fd, block.get(), size, at, m))
+                return Metadata::UNREADABLE;
+
+            const bool valid = type == PICTURE ?
+                               picture(block.get(), size, block, m, front) :
+                               comments(block.get(), size, m, front);
+
+            if (!valid)
+                return Metadata::UNREADABLE;
+
+            commented = commented || type == VORBIS_COMMENT;
+        }
+
+        at += size;
+    }
+
+    m.audio = at;
+
+    if (fstat(fd, &info) == 0 && info.st_size > at)
+        properties(samples, info.st_size - at, m);
+
+    return commented || !m.picture.empty() ? Metadata::READ :
+                                             Metadata::ABSENT;
+}
+
+/*
+ * Pages of other streams multiplexed with the first are passed over
+ */
+Metadata::Result
+read_ogg(int fd, Metadata &m)
+{
+    vector<char> packets[2], page;
+    size_t complete = 0;
+    uint32_t serial = 0;
+    off_t at = 0;
+
+    while (complete < 2) {
+        char header[OGG_HEADER_SIZE];
+        unsigned char lacing[255];
+
+        if (!read_at(fd, header, sizeof(header), at, m) ||
+            memcmp(header, "OggS", 4) != 0 || header[4] != 0)
+            return at == 0 ? Metadata::ABSENT : Metadata::UNREADABLE;
+
+        const size_t n = Byte(header[26]);
+        size_t size = 0;
+
+        if (!read_at(fd, reinterpret_cast<char*>(lacing), n, at + 27, m))
+            return Metadata::UNREADABLE;
+
+        for (size_t i = 0 ; i < n ; ++i)
+            size += lacing[i];
+
+        if (at == 0)
+            serial = little_endian32(header + 14);
+
+        if (little_endian32(header + 14) == serial) {
+            page.resize(size);
+
+            if (size > 0 && !read_at(fd, &page[0], size, at + 27 + n, m))
+                return Metadata::UNREADABLE;
+
+            segments(page, lacing, n, packets, complete);
+        }
+
+        at += sizeof(header) + n + size;
+    }
+
+    /*
+     * The comments follow a signature of their packet, by codec
+     */
+    static const char *const codecs[][2] = {
+        {"\x01vorbis", "\x03vorbis"},
+        {"OpusHead", "OpusTags"}
+    };
+    const vector<char> &first = packets[0], &second = packets[1];
+
+    for (size_t i = 0 ; i < sizeof(codecs) / sizeof(codecs[0]) ; ++i) {
+        const size_t signature = strlen(codecs[i][0]);
+        bool front = false;
+
+        if (first.size() < signature ||
+            memcmp(&first[0], codecs[i][0], signature) != 0)
+            continue;
+
+        if (second.size() < signature ||
+            memcmp(&second[0], codecs[i][1], signature) != 0 ||
+            !comments(&second[0] + signature,
+                      second.size() - signature,
+                      m,
+                      front))
+            return Metadata::UNREADABLE;
+
+        m.audio = at;
+        identification(fd, first, serial, m);
+
+        return Metadata::READ;
+    }
+
+    return Metadata::UNREADABLE; // FLAC, Speex, Theora and the like
+}
+
+} // verbatim
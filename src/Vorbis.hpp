@@ -0,0 +1,30 @@
+/*
+ * vim: set smartindent autoindent expandtab tabstop=4 shiftwidth=4:
+ */
+
+#ifndef VERBATIM_VORBIS_HPP
+#define VERBATIM_VORBIS_HPP
+
+// verbatim
+#include "Metadata.hpp"
+
+namespace verbatim {
+
+/*
+ * Vorbis comments, TITLE=..., and their picture, of FLAC: the metadata
+ * blocks before the audio frames are walked by their headers and only the
+ * STREAMINFO, VORBIS_COMMENT and PICTURE blocks read
+ */
+Metadata::Result read_flac(int fd, Metadata &m);
+
+/*
+ * Ditto, of Ogg Vorbis or Opus: the pages of the first two packets
+ * of the stream, identification and comments, and the last page, for the
+ * duration. A picture is the base64 of a PICTURE block as a
+ * METADATA_BLOCK_PICTURE comment.
+ */
+Metadata::Result read_ogg(int fd, Metadata &m);
+
+} // verbatim
+
+#endif // VERBATIM_VORBIS_HPP
@@ -0,0 +1,294 @@
+/*
+ * vim: set smartindent autoindent expandtab tabstop=4 shiftwidth=4:
+ */
+
+// Interface
+#include "Watch.hpp"
+
+// verbatim
+#include "utility/Exception.hpp"
+
+// libstdc++
+#include <set>
+
+// libc
+#include <poll.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <assert.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+using std::set;
+using std::cerr;
+using std::endl;
+using std::string;
+using std::vector;
+using std::ostream;
+using std::lock_guard;
+
+namespace {
+
+/*
+ * Events of interest on each watched directory. Content changes are only
+ * acted upon once the writer has closed the file.
+ */
+static const uint32_t WATCH_MASK = IN_CLOSE_WRITE |
+                                   IN_MOVED_TO |
+                                   IN_MOVED_FROM |
+                                   IN_CREATE |
+                                   IN_DELETE |
+                                   IN_ONLYDIR;
+
+/*
+ * Self-pipe used to wake poll() from a signal handler. Signals may be
+ * delivered to any thread so this is the only safe way to interrupt run().
+ */
+int signal_pipe[2] = {-1, -1};
+
+} // anonymous
+
+namespace C {
+
+extern "C"
+void
+watch_signal_handler(int /* signal */)
+{
+    const char c = 0;
+    const int e = errno;
+
+    if (write(signal_pipe[1], &c, 1) == -1) {
+        // Nothing we can do (safely) here
+    }
+
+    errno = e;
+}
+
+} // C
+
+namespace verbatim {
+
+/*
+ * AddDirectory (implementation)
+ */
+Watch::AddDirectory::AddDirectory(Watch &w) : watch(w)
+{
+}
+
+void
+Watch::AddDirectory::operator() (const Traverse::Path &p)
+{
+    if (S_ISDIR(p.info->st_mode))
+        watch.add(p.name);
+}
+
+/*
+ * Watch (implementation)
+ */
+Watch::Watch(Traverse &t, Database &d) :
+    fd(inotify_init1(IN_NONBLOCK | IN_CLOEXEC)),
+    traverser(t),
+    database(d),
+    new_directory(*this)
+{
+    if (fd == -1)
+        throw utility::FileError("Watch::Watch",
+                                 errno,
+                                 "Failed to initialise inotify");
+
+    traverser.register_callback(&new_directory);
+}
+
+Watch::~Watch()
+{
+    close(fd);
+}
+
+void
+Watch::run(const vector<string> &roots)
+{
+    struct sigaction action, old_int, old_term;
+
+    if (pipe2(signal_pipe, O_NONBLOCK | O_CLOEXEC) == -1)
+        throw utility::FileError("Watch::run",
+                                 errno,
+                                 "Failed to create signal pipe");
+
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = 0;
+    action.sa_handler = &C::watch_signal_handler;
+
+    sigaction(SIGINT, &action, &old_int);
+    sigaction(SIGTERM, &action, &old_term);
+
+    {
+        lock_guard<std::mutex> l(lock);
+
+        if (metrics.failed > 0)
+            cerr <<
+                "verbatim[Watch]: " <<
+                metrics.failed <<
+                " directories are not watched (see " <<
+                "/proc/sys/fs/inotify/max_user_watches)\n";
+    }
+
+    while (true) {
+        struct pollfd fds[2] = {
+            {fd, POLLIN, 0},
+            {signal_pipe[0], POLLIN, 0}
+        };
+
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR)
+                continue;
+
+            throw utility::FileError("Watch::run",
+                                     errno,
+                                     "Failed to poll for inotify events");
+        }
+
+        if (fds[1].revents)
+            break; // Signalled to stop
+
+        if (fds[0].revents)
+            read_events(roots);
+    }
+
+    sigaction(SIGINT, &old_int, NULL);
+    sigaction(SIGTERM, &old_term, NULL);
+
+    close(signal_pipe[0]);
+    close(signal_pipe[1]);
+    signal_pipe[0] = signal_pipe[1] = -1;
+}
+
+void
+Watch::print_metrics(ostream &stream) const
+{
+    lock_guard<std::mutex> l(lock);
+
+    stream <<
+        "verbatim[Watch]: #directories =    " <<
+        directories.size() <<
+        endl <<
+        "verbatim[Watch]: #events =         " <<
+        metrics.events <<
+        endl <<
+        "verbatim[Watch]: #updated paths =  " <<
+        metrics.updated <<
+        endl <<
+        "verbatim[Watch]: #removed paths =  " <<
+        metrics.removed <<
+        endl <<
+        "verbatim[Watch]: #rescanned dirs = " <<
+        metrics.rescanned <<
+        endl;
+}
+
+void
+Watch::add(const string &path)
+{
+    const int wd = inotify_add_watch(fd, path.c_str(), WATCH_MASK);
+    lock_guard<std::mutex> l(lock);
+
+    if (wd == -1)
+        ++metrics.failed;
+    else
+        directories[wd] = path; // Same inode, same wd, so a rename updates it
+}
+
+/*
+ * Drain all pending events, coalescing them per path so that the database
+ * sees only the final state of each (a file written then deleted within the
+ * same batch is only removed, for example).
+ */
+void
+Watch::read_events(const vector<string> &roots)
+{
+    static const size_t buffer_size = 64 * (sizeof(inotify_event) + NAME_MAX);
+    char buffer[buffer_size]
+        __attribute__ ((aligned(__alignof__(inotify_event))));
+    set<string> updates, removals, rescans;
+    bool janitor = false;
+    ssize_t n;
+
+    while ((n = read(fd, buffer, buffer_size)) > 0) {
+        for (ssize_t i = 0 ; i < n ; ) {
+            const inotify_event *e =
+                reinterpret_cast<const inotify_event*>(buffer + i);
+            string path;
+
+            i += sizeof(inotify_event) + e->len;
+            ++metrics.events;
+
+            if (e->mask & IN_Q_OVERFLOW) {
+                /*
+                 * Events were lost, fall back to a complete pass
+                 */
+                rescans.insert(roots.begin(), roots.end());
+                janitor = true;
+                continue;
+            }
+
+            {
+                lock_guard<std::mutex> l(lock);
+
+                if (e->mask & IN_IGNORED) {
+                    directories.erase(e->wd);
+                    continue;
+                }
+
+                const std::map<int, string>::const_iterator d =
+                    directories.find(e->wd);
+
+                if (d == directories.end() || e->len == 0)
+                    continue;
+
+                path = d->second + '/' + e->name;
+            }
+
+            if (e->mask & IN_ISDIR) {
+                if (e->mask & (IN_CREATE | IN_MOVED_TO))
+                    rescans.insert(path);
+                else if (e->mask & (IN_DELETE | IN_MOVED_FROM))
+                    janitor = true; // Entries of a whole subtree went stale
+
+                continue;
+            }
+
+            if (e->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+                removals.erase(path);
+                updates.insert(path);
+            } else if (e->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                updates.erase(path);
+                removals.insert(path);
+            }
+        }
+    }
+
+    for (set<string>::iterator i = removals.begin() ; i != removals.end() ; ++i)
+        database.remove(*i);
+
+    for (set<string>::iterator i = updates.begin() ; i != updates.end() ; ++i) {
+        struct stat info;
+
+        if (stat(i->c_str(), &info) == 0)
+            database.update(Traverse::Path(i->c_str(), &info));
+    }
+
+    if (!rescans.empty()) // Also adds watches on any new subdirectories
+        traverser.scan(vector<string>(rescans.begin(), rescans.end()));
+
+    database.flush(); // Don't leave updates waiting on the locality window
+
+    if (janitor)
+        database.update(roots.front());
+
+    metrics.removed += removals.size();
+    metrics.updated += updates.size();
+    metrics.rescanned += rescans.size();
+}
+
+} // verbatim
@@ -0,0 +1,73 @@
+/*
+ * vim: set smartindent autoindent expandtab tabstop=4 shiftwidth=4:
+ */
+
+#ifndef VERBATIM_WATCH_HPP
+#define VERBATIM_WATCH_HPP
+
+// verbatim
+#include "Traverse.hpp"
+#include "Database.hpp"
+
+// libstdc++
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <iostream>
+
+namespace verbatim {
+
+/*
+ * Keeps the database current after an initial scan by following inotify(7)
+ * events on every directory that scan (or a later one) dispatched.
+ */
+class Watch
+{
+    public:
+        /* Methods/Member functions */
+        Watch(Traverse &t, Database &d);
+        ~Watch();
+
+        void run(const std::vector<std::string> &roots); // Until SIGINT/SIGTERM
+        void print_metrics(std::ostream &stream) const;
+    private:
+        /* Type definitions */
+        class AddDirectory : public Traverse::Callback
+        {
+            public:
+                AddDirectory(Watch &w);
+                void operator() (const Traverse::Path &p);
+            private:
+                Watch &watch;
+        };
+
+        struct Metrics
+        {
+            size_t events, updated, removed, rescanned, failed;
+            Metrics() :
+                events(0),
+                updated(0),
+                removed(0),
+                rescanned(0),
+                failed(0) {}
+        };
+
+        /* Attributes/member variables */
+        int fd;
+        Metrics metrics;
+        mutable std::mutex lock; // Guards directories and failed
+        std::map<int, std::string> directories; // Watch descriptor -> path
+
+        Traverse &traverser;
+        Database &database;
+        AddDirectory new_directory;
+
+        /* Methods/Member functions */
+        void add(const std::string &path);
+        void read_events(const std::vector<std::string> &roots);
+};
+
+} // verbatim
+
+#endif
@@ -0,0 +1,192 @@
+/*
+ * vim: set smartindent autoindent expandtab tabstop=4 shiftwidth=4:
+ */
+
+// verbatim
+#include "BlobStore.hpp"
+
+// libstdc++
+#include <string>
+#include <fstream>
+
+// libc
+#include <stdlib.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+using std::string;
+
+using verbatim::BlobStore;
+using verbatim::utility::Hash128;
+
+namespace {
+
+/*
+ * Forget where what was synced ends, as files written before it was
+ * recorded never knew
+ */
+void
+unknown(const char *path)
+{
+    const int fd = open(path, O_WRONLY);
+    const uint64_t end = 0;
+
+    assert(fd != -1);
+    assert(pwrite(fd, &end, sizeof(end), 8) == sizeof(end));
+    close(fd);
+}
+
+/*
+ * Of the file, in this process
+ */
+size_t
+mappings(const char *path)
+{
+    std::ifstream maps("/proc/self/maps");
+    string line;
+    size_t n = 0;
+
+    while (std::getline(maps, line)) {
+        if (line.find(path) != string::npos)
+            ++n;
+    }
+
+    return n;
+}
+
+} // anonymous
+
+int main()
+{
+    char path[] = "/tmp/verbatim-blob-store-XXXXXX";
+    const int fd = mkstemp(path);
+    const string front(100000, 'f'), back("back cover");
+    const BlobStore::Digest one(1, 1), two(2, 2), other(1, 2);
+    BlobStore::Offset first, second;
+    BlobStore::Digest digest;
+    boost::string_ref data;
+
+    assert(fd != -1);
+    close(fd);
+
+    /*
+     * Stored once per digest, and read back in place
+     */
+    {
+        BlobStore bs;
+
+        bs.open(path);
+        first = bs.put(one, front.data(), front.size());
+        second = bs.put(two, back.data(), back.size());
+        assert(bs.put(one, front.data(), front.size()) == first);
+        assert(bs.blobs() == 2 && bs.reused() == 1);
+        assert(bs.find(two) == second && bs.find(other) == 0);
+        bs.sync();
+
+        assert(bs.digest(second, digest) && digest == two);
+
+        assert(bs.get(first, front.size(), data) && data == front);
+        assert(bs.get(second, back.size(), data) && data == back);
+        assert(!bs.get(second, back.size() + 1, data)); // Not what is there
+        assert(!bs.get(bs.size() + 8, 1, data));
+    }
+
+    /*
+     * Found again from the file alone, a torn tail dropped
+     */
+    {
+        const int tail = open(path, O_WRONLY | O_APPEND);
+
+        assert(tail != -1);
+        assert(write(tail, "torn", 4) == 4);
+        close(tail);
+
+        BlobStore bs;
+
+        bs.open(path);
+        assert(bs.blobs() == 2 && bs.size() % 8 == 0);
+        assert(bs.put(two, back.data(), back.size()) == second);
+        assert(bs.get(first, front.size(), data) && data == front);
+
+        /*
+         * Half a digest in common is not the same blob
+         */
+        assert(bs.put(other, back.data(), back.size()) != second);
+        assert(bs.blobs() == 3);
+    }
+
+    /*
+     * Only what was synced is trusted, and a reader never truncates what a
+     * writer may be appending
+     */
+    {
+        BlobStore bs, reader;
+        struct stat info;
+        size_t size;
+
+        bs.open(path);
+        assert(bs.blobs() == 2); // The third was never synced
+        bs.put(other, back.data(), back.size());
+        bs.sync();
+        size = bs.size();
+        bs.put(BlobStore::Digest(3, 3), front.data(), front.size());
+
+        reader.open(path, false);
+        assert(reader.blobs() == 3 && reader.size() == size);
+        assert(reader.get(first, front.size(), data) && data == front);
+        assert(stat(path, &info) == 0 && size_t(info.st_size) > size);
+    }
+
+    /*
+     * Without a record of what was synced, of a file written before there
+     * was one, blobs are found by their content
+     */
+    {
+        const BlobStore::Digest real(Hash128::of(back.data(), back.size()));
+        BlobStore bs;
+
+        unknown(path);
+        bs.open(path);
+        assert(bs.blobs() == 0); // Their digests were made up
+        bs.put(real, back.data(), back.size());
+        bs.sync();
+        unknown(path);
+        bs.open(path);
+        assert(bs.blobs() == 1 && bs.find(real) != 0);
+    }
+
+    /*
+     * Growing while read, the file is mapped only a few times over
+     */
+    {
+        BlobStore bs;
+        BlobStore::Offset o;
+
+        bs.open(path);
+
+        for (uint64_t i = 1 ; i <= 1000 ; ++i) {
+            o = bs.put(BlobStore::Digest(i, 0), front.data(), front.size());
+            assert(bs.digest(o, digest) && digest == BlobStore::Digest(i, 0));
+            assert(bs.get(o, front.size(), data) && data == front);
+        }
+
+        assert(mappings(path) < 16);
+    }
+
+    /*
+     * Read, a missing store is an empty one and is not created
+     */
+    {
+        BlobStore bs;
+
+        unlink(path);
+        bs.open(path, false);
+        assert(bs.blobs() == 0 && access(path, F_OK) == -1);
+    }
+
+    unlink(path);
+
+    return 0;
+}
@@ -0,0 +1,127 @@
+/*
+ * vim: set smartindent autoindent expandtab tabstop=4 shiftwidth=4:
+ */
+
+// verbatim
+#include "Format.hpp"
+#include "utility/Ring.hpp"
+
+// libc
+#include <stdlib.h>
+#include <assert.h>
+#include <unistd.h>
+
+int main(int argc, char *argv[])
+{
+    using verbatim::sniff;
+    using verbatim::MPEG_FORMAT;
+    using verbatim::FLAC_FORMAT;
+    using verbatim::OGG_FORMAT;
+    using verbatim::MP4_FORMAT;
+    using verbatim::UNKNOWN_FORMAT;
+
+    {
+        const char id3[] = {'I', 'D', '3', 4, 0, 0, 0, 0, 0x10, 0x7F};
+        assert(sniff(id3, sizeof(id3)) == MPEG_FORMAT);
+        assert(sniff(id3, 3) == UNKNOWN_FORMAT); // Truncated
+    }
+
+    {
+        const char bad_size[] = {'I', 'D', '3', 3, 0, 0, 0, 0, '\x80', 0};
+        assert(sniff(bad_size, sizeof(bad_size)) == UNKNOWN_FORMAT);
+    }
+
+    {
+        const char frame[] = {'\xFF', '\xFB', '\x90', '\x64'}; // MPEG1 L3
+        const char reserved[] = {'\xFF', '\xE9', '\x90', '\x64'};
+        assert(sniff(frame, sizeof(frame)) == MPEG_FORMAT);
+        assert(sniff(reserved, sizeof(reserved)) == UNKNOWN_FORMAT);
+    }
+
+    {
+        const char flac[] = {'f', 'L', 'a', 'C', 0, 0, 0, 0x22};
+        const char ogg[] = {'O', 'g', 'g', 'S', 0, 2};
+        const char mp4[] = {0, 0, 0, 0x10, 'f', 't', 'y', 'p',
+                            'M', '4', 'A', ' ', 0, 0, 0, 0};
+        assert(sniff(flac, sizeof(flac)) == FLAC_FORMAT);
+        assert(sniff(ogg, sizeof(ogg)) == OGG_FORMAT);
+        assert(sniff(mp4, sizeof(mp4)) == MP4_FORMAT);
+        assert(sniff(mp4, 11) == UNKNOWN_FORMAT); // Truncated
+    }
+
+    /*
+     * Of ISO base media files, only those audio may be of
+     */
+    {
+        const char mp42[] = {0, 0, 0, 0x18, 'f', 't', 'y', 'p',
+                             'm', 'p', '4', '2', 0, 0, 0, 0,
+                             'i', 's', 'o', 'm', 'm', 'p', '4', '2'};
+        const char m4b[] = {0, 0, 0, 0x14, 'f', 't', 'y', 'p',
+                            'X', 'Y', 'Z', '1', 0, 0, 0, 0,
+                            'M', '4', 'B', ' '};
+        const char heic[] = {0, 0, 0, 0x18, 'f', 't', 'y', 'p',
+                             'h', 'e', 'i', 'c', 0, 0, 0, 0,
+                             'm', 'i', 'f', '1', 'h', 'e', 'i', 'c'};
+        const char avif[] = {0, 0, 0, 0x1C, 'f', 't', 'y', 'p',
+                             'a', 'v', 'i', 'f', 0, 0, 0, 0,
+                             'a', 'v', 'i', 'f', 'm', 'i', 'f', '1',
+                             'm', 'i', 'a', 'f'};
+        const char m4v[] = {0, 0, 0, 0x18, 'f', 't', 'y', 'p',
+                            'M', '4', 'V', ' ', 0, 0, 0, 0,
+                            'M', '4', 'V', ' ', 'm', 'p', '4', '2'};
+        const char qt[] = {0, 0, 0, 0x14, 'f', 't', 'y', 'p',
+                           'q', 't', ' ', ' ', 0, 0, 0, 0,
+                           'q', 't', ' ', ' '};
+        assert(sniff(mp42, sizeof(mp42)) == MP4_FORMAT);
+        assert(sniff(m4b, sizeof(m4b)) == MP4_FORMAT);
+        assert(sniff(heic, sizeof(heic)) == UNKNOWN_FORMAT);
+        assert(sniff(avif, sizeof(avif)) == UNKNOWN_FORMAT);
+        assert(sniff(m4v, sizeof(m4v)) == UNKNOWN_FORMAT);
+        assert(sniff(qt, sizeof(qt)) == UNKNOWN_FORMAT);
+        assert(sniff(m4b, 16) == UNKNOWN_FORMAT); // Brands past what was read
+    }
+
+    {
+        const char jpeg[] = {'\xFF', '\xD8', '\xFF', '\xE0', 0, 0x10};
+        const char text[] = "FILE \"x.wav\" WAVE";
+        assert(sniff(jpeg, sizeof(jpeg)) == UNKNOWN_FORMAT);
+        assert(sniff(text, sizeof(text)) == UNKNOWN_FORMAT);
+    }
+
+    assert(sniff("/nonexistent/file.mp3") == UNKNOWN_FORMAT);
+
+    if (verbatim::utility::Ring::supported()) {
+        const char id3[] = {'I', 'D', '3', 4, 0, 0, 0, 0, 0x10, 0x7F};
+        const char jpeg[] = {'\xFF', '\xD8', '\xFF', '\xE0', 0, 0x10};
+        char audio[] = "/tmp/verbatim_formatXXXXXX",
+             image[] = "/tmp/verbatim_formatXXXXXX";
+        const int a = mkstemp(audio), i = mkstemp(image);
+
+        assert(a != -1 && i != -1);
+
+        const ssize_t n = write(a, id3, sizeof(id3)),
+                      m = write(i, jpeg, sizeof(jpeg));
+
+        assert(n == sizeof(id3) && m == sizeof(jpeg));
+        close(a);
+        close(i);
+
+        /*
+         * A queue depth of 2 forces a chunk per path
+         */
+        const char *paths[] = {audio, "/nonexistent/file.mp3", image, audio};
+        verbatim::Format formats[4];
+        verbatim::utility::Ring ring(2);
+
+        sniff(ring, paths, 4, formats);
+        assert(formats[0] == MPEG_FORMAT);
+        assert(formats[1] == UNKNOWN_FORMAT);
+        assert(formats[2] == UNKNOWN_FORMAT);
+        assert(formats[3] == MPEG_FORMAT);
+
+        unlink(audio);
+        unlink(image);
+    }
+
+    return 0;
+}
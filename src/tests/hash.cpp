@@ -0,0 +1,137 @@
+/*
+ * vim: set smartindent autoindent expandtab tabstop=4 shiftwidth=4:
+ */
+
+// verbatim
+#include "utility/Hash.hpp"
+#include "utility/Timer.hpp"
+
+// libstdc++
+#include <set>
+#include <string>
+#include <vector>
+#include <utility>
+#include <iostream>
+
+// libc
+#include <stdlib.h>
+#include <assert.h>
+
+using std::set;
+using std::cout;
+using std::endl;
+using std::pair;
+using std::string;
+using std::vector;
+using std::make_pair;
+
+using verbatim::utility::Hash;
+using verbatim::utility::Hash128;
+using verbatim::utility::Timer;
+
+namespace {
+
+double
+megabytes_per_second(const Timer &t, size_t bytes)
+{
+    const Timer::Duration d(t.elapsed());
+    return bytes / (1024.0 * 1024.0) /
+           (d.seconds + d.nanoseconds / 1000000000.0);
+}
+
+} // anonymous
+
+int main(int argc, char *argv[])
+{
+    const size_t megabytes = argc > 1 ? atoi(argv[1]) : 64;
+    string data(4096, '\0');
+
+    for (size_t i = 0, x = 1 ; i < data.size() ; ++i, x = x * 69069 + 1)
+        data[i] = x >> 24;
+
+    /*
+     * The same digest whatever the engine and however the input is split
+     */
+    for (size_t len = 0 ; len <= 2048 ; len += len < 200 ? 1 : 61) {
+        const Hash128::Digest d(Hash128::of(data.data(), len));
+        Hash128 scalar(true), pieces;
+
+        assert(scalar.update(data.data(), len).digest() == d);
+
+        for (size_t at = 0, step = 1 ; at < len ; at += step, step += 7)
+            pieces.update(data.data() + at, std::min(step, len - at));
+
+        assert(pieces.digest() == d);
+    }
+
+    /*
+     * Distinct for near identical input: each single bit flip, and every
+     * length of the same bytes
+     */
+    {
+        set<pair<uint64_t, uint64_t> > seen;
+        string flipped(data, 0, 100);
+
+        for (size_t i = 0 ; i < flipped.size() * 8 ; ++i) {
+            flipped[i / 8] ^= 1 << (i % 8);
+            const Hash128::Digest d(Hash128::of(flipped.data(),
+                                                flipped.size()));
+            assert(seen.insert(make_pair(d.low, d.high)).second);
+            flipped[i / 8] ^= 1 << (i % 8);
+        }
+
+        const string zeros(1024, '\0');
+
+        for (size_t len = 0 ; len <= zeros.size() ; ++len) {
+            const Hash128::Digest d(Hash128::of(zeros.data(), len));
+            assert(seen.insert(make_pair(d.low, d.high)).second);
+        }
+    }
+
+    /*
+     * Throughput over a picture sized buffer, and over path sized keys
+     */
+    const string picture(1024 * 1024, 'p');
+    const string path("/music/Boards of Canada/Music Has the Right to "
+                      "Children/10 Roygbiv.mp3");
+    const size_t paths = megabytes * 1024 * 1024 / path.size();
+    uint64_t sum = 0;
+    Timer t;
+
+    t.start();
+    for (size_t i = 0 ; i < megabytes ; ++i)
+        sum += Hash::fnv(picture.c_str(), picture.size());
+    t.stop();
+    cout << "hash[fnv64]: Pictures =      "
+         << megabytes_per_second(t, megabytes * picture.size()) << "MB/s\n";
+
+    t.start();
+    for (size_t i = 0 ; i < megabytes ; ++i)
+        sum += Hash128(true).update(picture.data(), picture.size()).digest().low;
+    t.stop();
+    cout << "hash[scalar]: Pictures =     "
+         << megabytes_per_second(t, megabytes * picture.size()) << "MB/s\n";
+
+    t.start();
+    for (size_t i = 0 ; i < megabytes ; ++i)
+        sum += Hash128::of(picture.data(), picture.size()).low;
+    t.stop();
+    cout << "hash[" << Hash128::engine() << "]: Pictures =       "
+         << megabytes_per_second(t, megabytes * picture.size()) << "MB/s\n";
+
+    t.start();
+    for (size_t i = 0 ; i < paths ; ++i)
+        sum += Hash::fnv(path.c_str(), path.size());
+    t.stop();
+    cout << "hash[fnv64]: Paths =         "
+         << megabytes_per_second(t, paths * path.size()) << "MB/s\n";
+
+    t.start();
+    for (size_t i = 0 ; i < paths ; ++i)
+        sum += Hash()(path.data(), path.size());
+    t.stop();
+    cout << "hash[" << Hash128::engine() << "]: Paths =          "
+         << megabytes_per_second(t, paths * path.size()) << "MB/s\n";
+
+    return sum == 0; // Keeps the loops from being optimised away
+}
@@ -0,0 +1,692 @@
+/*
+ * vim: set smartindent autoindent expandtab tabstop=4 shiftwidth=4:
+ */
+
+// verbatim
+#include "MP4.hpp"
+#include "ID3v2.hpp"
+#include "Vorbis.hpp"
+#include "Metadata.hpp"
+#include "utility/Timer.hpp"
+
+// libstdc++
+#include <string>
+#include <iostream>
+#include <algorithm>
+
+// libc
+#include <stdlib.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+using std::cout;
+using std::string;
+
+using verbatim::Metadata;
+using verbatim::read_id3v2;
+using verbatim::read_metadata;
+using verbatim::utility::Timer;
+
+namespace {
+
+string
+synchsafe(size_t n)
+{
+    string s(4, '\0');
+
+    for (size_t i = 0 ; i < 4 ; ++i)
+        s[i] = (n >> (7 * (3 - i))) & 0x7F;
+
+    return s;
+}
+
+string
+big_endian(size_t n, size_t bytes)
+{
+    string s(bytes, '\0');
+
+    for (size_t i = 0 ; i < bytes ; ++i)
+        s[i] = (n >> (8 * (bytes - 1 - i))) & 0xFF;
+
+    return s;
+}
+
+string
+frame(unsigned version, const string &id, const string &content,
+      char format = 0)
+{
+    if (version == 2)
+        return id + big_endian(content.size(), 3) + content;
+
+    return id +
+           (version == 3 ? big_endian(content.size(), 4) :
+                           synchsafe(content.size())) +
+           string(1, '\0') + string(1, format) + content;
+}
+
+string
+tag(unsigned version, const string &frames, char flags = 0,
+    size_t padding = 16)
+{
+    return string("ID3") + char(version) + '\0' + flags +
+           synchsafe(frames.size() + padding) + frames +
+           string(padding, '\0');
+}
+
+/*
+ * A zero after each 0xFF that is followed by zero or 0xE0 and up, as the
+ * frames of a 2.3 tag are escaped all together
+ */
+string
+unsynchronised(const string &s)
+{
+    string escaped;
+
+    for (size_t i = 0 ; i < s.size() ; ++i) {
+        escaped += s[i];
+
+        if (s[i] == '\xFF' &&
+            (i + 1 == s.size() || s[i + 1] == 0 ||
+             (s[i + 1] & 0xE0) == 0xE0))
+            escaped += '\0';
+    }
+
+    return escaped;
+}
+
+/*
+ * A picture with a 0xFF followed by zero, as unsynchronisation escapes
+ */
+const string PICTURE("\xFF\xD8\xFF\x00\x10JFIF", 9);
+
+string
+little_endian(size_t n, size_t bytes)
+{
+    string s(bytes, '\0');
+
+    for (size_t i = 0 ; i < bytes ; ++i)
+        s[i] = (n >> (8 * i)) & 0xFF;
+
+    return s;
+}
+
+/*
+ * Of comments each ended by a new line
+ */
+string
+vorbis_comments(const string &terminated)
+{
+    string s(little_endian(6, 4) + "vendor"), all;
+    size_t count = 0;
+
+    for (size_t at = 0 ; at < terminated.size() ; ++count) {
+        const size_t end = terminated.find('\n', at);
+
+        all += little_endian(end - at, 4) + terminated.substr(at, end - at);
+        at = end + 1;
+    }
+
+    return s + little_endian(count, 4) + all;
+}
+
+string
+picture_block(size_t type, const string &mimetype, const string &data)
+{
+    return big_endian(type, 4) +
+           big_endian(mimetype.size(), 4) + mimetype +
+           big_endian(0, 4) + string(16, '\0') +
+           big_endian(data.size(), 4) + data;
+}
+
+string
+block(unsigned type, const string &content, bool last = false)
+{
+    return char(type | (last ? 0x80 : 0)) + big_endian(content.size(), 3) +
+           content;
+}
+
+string
+base64(const string &s)
+{
+    static const char alphabet[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    string out;
+
+    for (size_t i = 0 ; i < s.size() ; i += 3) {
+        uint32_t bits = (unsigned char)s[i] << 16;
+
+        if (i + 1 < s.size())
+            bits |= (unsigned char)s[i + 1] << 8;
+
+        if (i + 2 < s.size())
+            bits |= (unsigned char)s[i + 2];
+
+        out += alphabet[bits >> 18 & 0x3F];
+        out += alphabet[bits >> 12 & 0x3F];
+        out += i + 1 < s.size() ? alphabet[bits >> 6 & 0x3F] : '=';
+        out += i + 2 < s.size() ? alphabet[bits & 0x3F] : '=';
+    }
+
+    return out;
+}
+
+/*
+ * Pages of at most four segments, so the packets span pages, with a page
+ * of another stream after the first
+ */
+string
+ogg(const string &first, const string &second, const string &third)
+{
+    const string packets[] = {first, second, third};
+    string segments, lacing, pages;
+    size_t sequence = 0;
+
+    for (size_t p = 0 ; p < 3 ; ++p) {
+        size_t at = 0;
+
+        do {
+            const size_t n = std::min(packets[p].size() - at, size_t(255));
+
+            lacing += char(n);
+            segments += packets[p].substr(at, n);
+            at += n;
+
+            if (n < 255)
+                break;
+        } while (true);
+    }
+
+    for (size_t l = 0, at = 0 ; l < lacing.size() ; l += 4, ++sequence) {
+        const string table(lacing.substr(l, 4));
+        size_t size = 0;
+
+        for (size_t i = 0 ; i < table.size() ; ++i)
+            size += (unsigned char)table[i];
+
+        pages += "OggS" + string(1, '\0') + string(1, '\0') +
+                 string(8, '\0') + little_endian(1, 4) +
+                 little_endian(sequence, 4) + string(4, '\0') +
+                 char(table.size()) + table + segments.substr(at, size);
+        at += size;
+
+        if (sequence == 0)
+            pages += "OggS" + string(1, '\0') + string(1, '\x02') +
+                     string(8, '\0') + little_endian(2, 4) +
+                     string(8, '\0') + char(1) + char(3) + "xyz";
+    }
+
+    return pages;
+}
+
+/*
+ * The last page of a stream, of the granule position given and some audio
+ */
+string
+last_page(uint32_t serial, uint64_t granule)
+{
+    return "OggS" + string(1, '\0') + string(1, '\x04') +
+           little_endian(granule, 8) + little_endian(serial, 4) +
+           string(8, '\0') + char(40) + string(40, '\xFA') +
+           string(40 * 250, '\0');
+}
+
+/*
+ * An MPEG 1 layer III frame of 128kbit/s at 44.1kHz, stereo, of the
+ * content given after the header; 417 bytes
+ */
+string
+mpeg_frame(const string &content = "")
+{
+    return string("\xFF\xFB\x90\x00", 4) + content +
+           string(417 - 4 - content.size(), '\0');
+}
+
+string
+box(const char *type, const string &content)
+{
+    return big_endian(content.size() + 8, 4) + string(type, 4) + content;
+}
+
+static const unsigned UTF8 = 1;
+
+string
+data(unsigned type, const string &value)
+{
+    return box("data", big_endian(type, 4) + string(4, '\0') + value);
+}
+
+/*
+ * A track of the handler type given, then whatever else its media holds
+ */
+string
+track(const char *handler, const string &media)
+{
+    return box("trak", box("mdia", box("hdlr", string(8, '\0') + handler +
+                                               string(13, '\0')) +
+                                   media));
+}
+
+/*
+ * A temporary file of the content given, removed once out of scope
+ */
+struct File
+{
+    char path[32];
+    int fd;
+
+    File(const string &content)
+    {
+        strcpy(path, "/tmp/verbatim_metadataXXXXXX");
+        fd = mkstemp(path);
+        assert(fd != -1);
+
+        const ssize_t n = write(fd, content.data(), content.size());
+
+        assert(n == ssize_t(content.size()));
+    }
+
+    ~File()
+    {
+        close(fd);
+        unlink(path);
+    }
+};
+
+/*
+ * Bytes read and time taken per file, of tags followed by 4MB of audio
+ */
+void
+measure(const char *format, const string &tags, size_t files)
+{
+    File f(tags + string(4 * 1024 * 1024, '\xFB'));
+    size_t read = 0;
+    Timer timer;
+
+    timer.start();
+    for (size_t i = 0 ; i < files ; ++i) {
+        Metadata m;
+
+        assert(read_metadata(f.fd, m) == Metadata::READ);
+        assert(m.picture.size() == 64 * 1024);
+        read += m.read;
+    }
+    timer.stop();
+
+    const Timer::Duration d(timer.elapsed());
+
+    cout << "metadata[" << format << "]: Read/file = " << read / files
+         << " of " << tags.size() + 4 * 1024 * 1024 << " bytes, "
+         << (d.seconds * 1e6 + d.nanoseconds / 1e3) / files << "us\n";
+}
+
+} // anonymous
+
+int main(int argc, char *argv[])
+{
+    /*
+     * 2.3: Latin-1 and UTF-16 with a BOM, genre by reference, the first of
+     * two pictures
+     */
+    {
+        const string frames =
+            frame(3, "TIT2", string("\0Bj\xF6rk", 6)) +
+            frame(3, "TPE1", string("\x01\xFF\xFE" "A\0b\0", 7)) +
+            frame(3, "TALB", string("\0Homogenic\0", 11)) +
+            frame(3, "TCON", string("\0(17)(52)Rock", 13)) +
+            frame(3, "APIC", string("\0image/png\0\x03\0", 13) + PICTURE) +
+            frame(3, "APIC", string("\0image/gif\0\x03\0", 13) + "GIF");
+        const string t(tag(3, frames));
+        Metadata id3;
+
+        assert(read_id3v2(t.data(), t.size(), id3) == Metadata::READ);
+        assert(id3.title == "Bj\xC3\xB6rk");
+        assert(id3.artist == "Ab");
+        assert(id3.album == "Homogenic");
+        assert(id3.genre == "Rock Electronic");
+        assert(id3.mimetype == "image/png");
+        assert(id3.picture == PICTURE);
+        assert(id3.read == t.size());
+    }
+
+    /*
+     * 2.3, unsynchronised as a whole; 2.4, frame by frame, with several
+     * values and a genre by number
+     */
+    {
+        const string escaped("\xFF\x00\xD8\xFF\x00\x00\x10JFIF", 11);
+        const string frames3 =
+            frame(3, "TIT2", string("\0Title", 6)) +
+            frame(3, "APIC", string("\0image/jpeg\0\x03\0", 14) + PICTURE);
+        const string t3(tag(3, unsynchronised(frames3), '\x80'));
+        Metadata id3;
+
+        assert(read_id3v2(t3.data(), t3.size(), id3) == Metadata::READ);
+        assert(id3.title == "Title");
+        assert(id3.picture == PICTURE);
+
+        const string frames4 =
+            frame(4, "TPE1", string("\x03One\0Two\0", 9)) +
+            frame(4, "TCON", string("\x00" "17\0Rock\0", 9)) +
+            frame(4, "APIC", string("\0image/jpeg\0\x03\0", 14) + escaped,
+                  '\x02');
+        const string t4(tag(4, frames4));
+        Metadata v4;
+
+        assert(read_id3v2(t4.data(), t4.size(), v4) == Metadata::READ);
+        assert(v4.artist == "One Two");
+        assert(v4.genre == "Rock");
+        assert(v4.picture == PICTURE);
+    }
+
+    /*
+     * 2.2: three letter frames, PIC with an image format
+     */
+    {
+        const string frames =
+            frame(2, "TT2", string("\x02\0H\0i", 5)) +
+            frame(2, "PIC", string("\0JPG\x03\0", 6) + PICTURE);
+        const string t(tag(2, frames));
+        Metadata id3;
+
+        assert(read_id3v2(t.data(), t.size(), id3) == Metadata::READ);
+        assert(id3.title == "Hi");
+        assert(id3.mimetype == "image/jpeg");
+        assert(id3.picture == PICTURE);
+    }
+
+    /*
+     * Left to TagLib: oversized frames, invalid identifiers, compressed
+     * frames and tags cut short
+     */
+    {
+        Metadata id3;
+        const string oversized(tag(3, "TIT2" + big_endian(1000, 4) +
+                                      string("\0\0\0x", 4)));
+        const string invalid(tag(3, frame(3, "tit2", string("\0x", 2))));
+        const string compressed(tag(4, frame(4, "TIT2", "\0x", '\x08')));
+        const string full(tag(3, frame(3, "TIT2", string("\0x", 2))));
+
+        assert(read_id3v2(oversized.data(), oversized.size(), id3) ==
+               Metadata::UNREADABLE);
+        assert(read_id3v2(invalid.data(), invalid.size(), id3) ==
+               Metadata::UNREADABLE);
+        assert(read_id3v2(compressed.data(), compressed.size(), id3) ==
+               Metadata::UNREADABLE);
+        assert(read_id3v2(full.data(), full.size() - 1, id3) ==
+               Metadata::UNREADABLE);
+        assert(read_id3v2("RIFF\0\0\0\0WAVE", 12, id3) == Metadata::ABSENT);
+    }
+
+    /*
+     * FLAC: comments of any case, several values of a field, the front
+     * cover rather than the first picture
+     */
+    {
+        const string comments(vorbis_comments("title=Roygbiv\n"
+                                              "ARTIST=Boards\n"
+                                              "Artist=of Canada\n"
+                                              "GENRE=IDM\n"));
+        const string flac =
+            string("fLaC") +
+            block(0, string(34, '\0')) + // STREAMINFO
+            block(6, picture_block(4, "image/gif", "GIF")) +
+            block(1, string(100, '\0')) + // PADDING
+            block(4, comments) +
+            block(6, picture_block(3, "image/png", PICTURE), true);
+        File f(flac);
+        Metadata m;
+
+        assert(read_metadata(f.fd, m) == Metadata::READ);
+        assert(m.format == verbatim::FLAC_FORMAT);
+        assert(m.title == "Roygbiv");
+        assert(m.artist == "Boards of Canada");
+        assert(m.genre == "IDM");
+        assert(m.mimetype == "image/png");
+        assert(m.picture == PICTURE);
+        assert(m.read < flac.size()); // Nor the padding
+
+        File truncated(flac.substr(0, flac.size() - 1));
+        Metadata t;
+
+        assert(read_metadata(truncated.fd, t) == Metadata::UNREADABLE);
+    }
+
+    /*
+     * Ogg: Vorbis, and Opus with a picture as a comment; the comments span
+     * pages, and a page of another stream is passed over
+     */
+    {
+        const string comments("\x03vorbis" +
+                              vorbis_comments("TITLE=Olson\nALBUM=Music\n") +
+                              '\x01');
+        File vorbis(ogg(string("\x01vorbis", 7) + string(23, '\0'),
+                        comments,
+                        "\x05vorbis setup"));
+        Metadata m;
+
+        assert(read_metadata(vorbis.fd, m) == Metadata::READ);
+        assert(m.format == verbatim::OGG_FORMAT);
+        assert(m.title == "Olson" && m.album == "Music");
+        assert(m.picture.empty());
+
+        const string cover(string(600, 'c') + PICTURE);
+        const string picture("METADATA_BLOCK_PICTURE=" +
+                             base64(picture_block(3, "image/jpeg", cover)));
+        const string tags("OpusTags" +
+                          vorbis_comments("TITLE=Opus\n" + picture + '\n'));
+        File opus(ogg("OpusHead" + string(11, '\0'), tags, ""));
+        Metadata o;
+
+        assert(read_metadata(opus.fd, o) == Metadata::READ);
+        assert(o.title == "Opus");
+        assert(o.mimetype == "image/jpeg");
+        assert(o.picture == cover);
+    }
+
+    /*
+     * MP4: items of ilst, text and genre by number, found past mdat
+     */
+    {
+        const string ilst =
+            box("\xA9nam", data(UTF8, "Everything In Its Right Place")) +
+            box("\xA9" "ART", data(UTF8, "Radiohead")) +
+            box("gnre", data(0, string("\0\x12", 2))) + // Rock, plus one
+            box("covr", data(14, PICTURE));
+        const string meta(string(4, '\0') +
+                          box("hdlr", string(25, '\0')) +
+                          box("ilst", ilst));
+        const string moov =
+            box("moov", box("mvhd", string(1000, '\0')) +
+                        track("soun", "") +
+                        box("udta", box("meta", meta)));
+        const string mp4 = box("ftyp", "M4A " + string(4, '\0')) +
+                           box("mdat", string(4096, '\xAA')) + moov;
+        File f(mp4);
+        Metadata m;
+
+        assert(read_metadata(f.fd, m) == Metadata::READ);
+        assert(m.format == verbatim::MP4_FORMAT);
+        assert(m.title == "Everything In Its Right Place");
+        assert(m.artist == "Radiohead");
+        assert(m.genre == "Rock");
+        assert(m.mimetype == "image/png" && m.picture == PICTURE);
+        assert(m.read < mp4.size() - 4096); // Nor mdat, nor mvhd
+
+        File broken(mp4.substr(0, mp4.size() - 1));
+        Metadata b;
+
+        assert(read_metadata(broken.fd, b) == Metadata::UNREADABLE);
+    }
+
+    /*
+     * Audio properties of MPEG: of Xing and LAME headers, the first frame
+     * found past junk, even at the end of what is first read; of VBRI; of
+     * the first frame alone
+     */
+    {
+        const string t(tag(3, frame(3, "TIT2", string("\0x", 2))));
+        const string xing(string(32, '\0') + "Xing" + big_endian(0x0F, 4) +
+                          big_endian(1000, 4) + big_endian(400000, 4) +
+                          string(104, '\0') + "LAME3.100" +
+                          string(12, '\0') + "\x24\x03\xE8");
+        const string vbri(string(32, '\0') + "VBRI" + string(6, '\0') +
+                          big_endian(300000, 4) + big_endian(500, 4));
+        const size_t junk[] = {2, 4000};
+        string frames;
+
+        for (size_t i = 0 ; i < 99 ; ++i)
+            frames += mpeg_frame();
+
+        for (size_t i = 0 ; i < 2 ; ++i) {
+            File f(t + string(junk[i], '\0') + mpeg_frame(xing) + frames);
+            Metadata m;
+
+            assert(read_metadata(f.fd, m) == Metadata::READ);
+            assert(m.title == "x");
+            assert(m.duration == (1000 * 1152 - 576 - 1000) * 1000 / 44100);
+            assert(m.bitrate == 400000 * 8 / m.duration);
+            assert(m.sample_rate == 44100 && m.channels == 2);
+            assert(m.read < t.size() + 8192); // Of 45KB of audio
+        }
+
+        File v(t + mpeg_frame(vbri) + frames);
+        Metadata m;
+
+        assert(read_metadata(v.fd, m) == Metadata::READ);
+        assert(m.duration == 500 * 1152 * 1000 / 44100);
+        assert(m.bitrate == 300000 * 8 / m.duration);
+
+        File cbr(t + mpeg_frame() + frames);
+        Metadata c;
+
+        assert(read_metadata(cbr.fd, c) == Metadata::READ);
+        assert(c.bitrate == 128);
+        assert(c.duration == 100 * 417 * 8 / 128);
+    }
+
+    /*
+     * FLAC of STREAMINFO, Ogg of the last page, MP4 of the sound track
+     */
+    {
+        const string streaminfo(string(10, '\0') + "\x0A\xC4\x42\xF0" +
+                                big_endian(441000, 4) + string(16, '\0'));
+        const string audio(12500, '\xFF');
+        File flac("fLaC" + block(0, streaminfo) +
+                  block(4, vorbis_comments("TITLE=x\n"), true) + audio);
+        Metadata m;
+
+        assert(read_metadata(flac.fd, m) == Metadata::READ);
+        assert(m.duration == 10000 && m.bitrate == 10);
+        assert(m.sample_rate == 44100 && m.channels == 2);
+
+        File bare("fLaC" + block(0, streaminfo, true) + audio);
+        Metadata b;
+
+        assert(read_metadata(bare.fd, b) == Metadata::ABSENT); // Untagged
+
+        const string identification(string("\x01vorbis", 7) +
+                                    string(4, '\0') + '\x02' +
+                                    little_endian(44100, 4) +
+                                    string(4, '\0') +
+                                    little_endian(128000, 4) +
+                                    string(4, '\0') + "\xB8\x01");
+        const string headers(ogg(identification,
+                                 "\x03vorbis" + vorbis_comments("") + '\x01',
+                                 "\x05vorbis"));
+        File vorbis(headers + last_page(1, 441000) + last_page(2, 9));
+        Metadata v;
+
+        assert(read_metadata(vorbis.fd, v) == Metadata::READ);
+        assert(v.duration == 10000);
+        assert(v.bitrate == (2 * last_page(1, 0).size()) * 8 / 10000);
+        assert(v.sample_rate == 44100 && v.channels == 2);
+
+        File nominal(headers);
+        Metadata n;
+
+        assert(read_metadata(nominal.fd, n) == Metadata::READ);
+        assert(n.bitrate == 128);
+
+        const string head("OpusHead\x01\x02" + little_endian(312, 2) +
+                          little_endian(44100, 4) + string(3, '\0'));
+        File opus(ogg(head, "OpusTags" + vorbis_comments(""), "") +
+                  last_page(1, 480312));
+        Metadata o;
+
+        assert(read_metadata(opus.fd, o) == Metadata::READ);
+        assert(o.duration == 10000);
+        assert(o.sample_rate == 48000 && o.channels == 2);
+
+        const string entry(box("mp4a", string(6, '\0') + big_endian(1, 2) +
+                                       string(8, '\0') + big_endian(2, 2) +
+                                       big_endian(16, 2) + string(4, '\0') +
+                                       big_endian(44100 << 16, 4)));
+        const string mdhd(string(12, '\0') + big_endian(44100, 4) +
+                          big_endian(441000, 4) + string(4, '\0'));
+        const string video(track("vide", ""));
+        const string sound(
+            track("soun", box("mdhd", mdhd) +
+                          box("minf", box("stbl", box("stsd",
+                              string(4, '\0') + big_endian(1, 4) + entry)))));
+        const string udta(box("udta", box("meta", string(4, '\0') +
+                              box("ilst", box("\xA9nam", data(UTF8, "x"))))));
+        File mp4(box("ftyp", "M4A " + string(4, '\0')) +
+                 box("moov", video + sound + udta) +
+                 box("mdat", audio));
+        Metadata a;
+
+        assert(read_metadata(mp4.fd, a) == Metadata::READ);
+        assert(a.duration == 10000 && a.bitrate == 10);
+        assert(a.sample_rate == 44100 && a.channels == 2);
+
+        File untagged(box("ftyp", "M4A " + string(4, '\0')) +
+                      box("moov", sound) +
+                      box("mdat", audio));
+        Metadata u;
+
+        assert(read_metadata(untagged.fd, u) == Metadata::ABSENT);
+
+        /*
+         * Of a generic brand, a video without sound is not audio at all
+         */
+        File film(box("ftyp", "isom" + string(4, '\0') + "mp42") +
+                  box("moov", video + udta) +
+                  box("mdat", audio));
+        Metadata f;
+
+        assert(read_metadata(film.fd, f) == Metadata::NOT_AUDIO);
+    }
+
+    /*
+     * Of a file, only the tags are read: bytes and time per file, of each
+     * format
+     */
+    {
+        const size_t files = argc > 1 ? atoi(argv[1]) : 2000;
+        const string cover(64 * 1024, 'p');
+        const string id3(tag(4,
+                             frame(4, "TIT2", string("\0Title", 6)) +
+                             frame(4, "APIC",
+                                   string("\0image/jpeg\0\x03\0", 14) + cover),
+                             0, 2048));
+        const string flac("fLaC" +
+                          block(0, string(34, '\0')) +
+                          block(4, vorbis_comments("TITLE=Title\n")) +
+                          block(6, picture_block(3, "image/jpeg", cover)) +
+                          block(1, string(8192, '\0'), true));
+        const string mp4(box("ftyp", "M4A " + string(4, '\0')) +
+                         box("moov",
+                             track("soun", string(256 * 1024, '\0')) +
+                             box("udta", box("meta", string(4, '\0') +
+                                 box("ilst", box("covr", data(13, cover)))))));
+
+        measure("id3v2", id3, files);
+        measure("flac", flac, files);
+        measure("mp4", mp4, files);
+    }
+
+    return 0;
+}
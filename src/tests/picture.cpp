@@ -0,0 +1,57 @@
+/*
+ * vim: set smartindent autoindent expandtab tabstop=4 shiftwidth=4:
+ */
+
+// verbatim
+#include "Picture.hpp"
+
+// libstdc++
+#include <string>
+
+// libc
+#include <assert.h>
+
+using std::string;
+
+int main()
+{
+    using verbatim::Fingerprint;
+    using verbatim::fingerprint;
+    using verbatim::recognise;
+    using verbatim::utility::Hash128;
+
+    /*
+     * Of the same size, head and tail, differing only in the middle, as a
+     * cover re-encoded or with its metadata edited may
+     */
+    string first(64 * 1024, 'x'), second(first);
+    Hash128::Digest digest;
+
+    second[second.size() / 2] = 'y';
+
+    const Fingerprint a(fingerprint(first.data(), first.size()));
+    const Fingerprint b(fingerprint(second.data(), second.size()));
+    const Hash128::Digest stored(Hash128::of(first.data(), first.size()));
+
+    assert(a.size == b.size && a.crc == b.crc);
+
+    /*
+     * So the one stored under the fingerprint is told apart from the other
+     */
+    assert(recognise(first.data(), first.size(), stored, digest));
+    assert(digest == stored);
+    assert(!recognise(second.data(), second.size(), stored, digest));
+    assert(digest == Hash128::of(second.data(), second.size()));
+
+    /*
+     * Smaller than either end sampled, all of it is
+     */
+    {
+        const string small("a small picture"), other("a small pictura");
+
+        assert(fingerprint(small.data(), small.size()).crc !=
+               fingerprint(other.data(), other.size()).crc);
+    }
+
+    return 0;
+}
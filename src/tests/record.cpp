@@ -0,0 +1,165 @@
+/*
+ * vim: set smartindent autoindent expandtab tabstop=4 shiftwidth=4:
+ */
+
+// verbatim
+#include "Tag.hpp"
+#include "Record.hpp"
+#include "utility/Timer.hpp"
+#include "utility/Exception.hpp"
+
+// libstdc++
+#include <string>
+#include <iostream>
+
+// libc
+#include <stdlib.h>
+#include <assert.h>
+
+using std::cout;
+using std::endl;
+using std::string;
+
+using verbatim::Tag;
+using verbatim::Record;
+using verbatim::TagRecord;
+using verbatim::RecordWriter;
+using verbatim::utility::Timer;
+
+namespace {
+
+string
+flatten(const Tag &t)
+{
+    RecordWriter w(verbatim::TAG_FIELDS);
+
+    write(w, t);
+
+    return w.release();
+}
+
+double
+nanoseconds(const Timer &t, size_t n)
+{
+    const Timer::Duration d(t.elapsed());
+    return (d.seconds * 1000000000.0 + d.nanoseconds) / n;
+}
+
+} // anonymous
+
+int main(int argc, char *argv[])
+{
+    const size_t n = argc > 1 ? atoi(argv[1]) : 100000;
+    Tag tag;
+
+    tag.modified = 1234567890;
+    tag.artist = "Boards of Canada";
+    tag.album = "Music Has the Right to Children";
+    tag.title = "Roygbiv";
+    tag.genre = "Electronic";
+    tag.filename = "/music/Boards of Canada/Music Has the Right to Children/"
+                   "10 Roygbiv.mp3";
+    tag.aliases.insert("/music/Compilations/Warp 10+3/02 Roygbiv.mp3");
+    tag.duration = 151000;
+    tag.bitrate = 192;
+    tag.sample_rate = 44100;
+    tag.channels = 2;
+    tag.artist_key = "boards of canada";
+    tag.album_key = "music has the right to children";
+    tag.title_key = "roygbiv";
+    tag.genre_key = "electronic";
+
+    /*
+     * Round trip, and the same fields in place
+     */
+    {
+        const string flat(flatten(tag));
+        const TagRecord r(flat.data(), flat.size());
+        Record::List aliases(r.aliases());
+        boost::string_ref alias;
+        Tag copy;
+
+        read(r, copy);
+        assert(copy.modified == tag.modified);
+        assert(copy.artist == tag.artist && copy.album == tag.album);
+        assert(copy.title == tag.title && copy.genre == tag.genre);
+        assert(copy.filename == tag.filename && copy.aliases == tag.aliases);
+        assert(copy.duration == tag.duration && copy.bitrate == tag.bitrate);
+        assert(copy.sample_rate == tag.sample_rate);
+        assert(copy.channels == tag.channels);
+        assert(copy.artist_key == tag.artist_key);
+        assert(copy.album_key == tag.album_key);
+        assert(copy.title_key == tag.title_key);
+        assert(copy.genre_key == tag.genre_key);
+
+        assert(r.modified() == tag.modified);
+        assert(r.title() == tag.title);
+        assert(r.filename() == tag.filename);
+        assert(r.duration() == tag.duration);
+        assert(r.artist_key() == tag.artist_key);
+        assert(r.genre_key() == tag.genre_key);
+        assert(aliases.next(alias) && alias == *tag.aliases.begin());
+        assert(!aliases.next(alias));
+        assert(r.field(r.fields() + 1).empty()); // Unknown fields are empty
+    }
+
+    /*
+     * Rejected rather than misread
+     */
+    {
+        const string flat(flatten(tag));
+        string junk(flat);
+        bool thrown = false;
+
+        junk[0] = ~junk[0]; // Not the magic byte
+
+        try {
+            Record r(flat.data(), flat.size() - 1); // Last field truncated
+        } catch (const verbatim::utility::ValueError &e) {
+            thrown = true;
+        }
+
+        assert(thrown);
+        thrown = false;
+
+        try {
+            Record r(junk.data(), junk.size());
+        } catch (const verbatim::utility::ValueError &e) {
+            thrown = true;
+        }
+
+        assert(thrown);
+    }
+
+    /*
+     * Microbenchmark: encoding, decoding everything and reading one field
+     */
+    Timer t;
+    size_t bytes = 0;
+    string flat_value(flatten(tag));
+
+    t.start();
+    for (size_t i = 0 ; i < n ; ++i)
+        bytes += flatten(tag).size();
+    t.stop();
+    cout << "record[Flat]: encode =       " << nanoseconds(t, n) << "ns\n";
+
+    t.start();
+    for (size_t i = 0 ; i < n ; ++i) {
+        const Record r(flat_value.data(), flat_value.size());
+        Tag copy;
+        read(r, copy);
+        bytes += copy.title.size();
+    }
+    t.stop();
+    cout << "record[Flat]: decode =       " << nanoseconds(t, n) << "ns\n";
+
+    t.start();
+    for (size_t i = 0 ; i < n ; ++i)
+        bytes += TagRecord(flat_value.data(), flat_value.size()).title().size();
+    t.stop();
+    cout << "record[Flat]: in place =     " << nanoseconds(t, n) << "ns\n";
+    cout << "record[Flat]: size =         " << flat_value.size() << endl;
+
+    return bytes == 0; // Keeps the loops from being optimised away
+}
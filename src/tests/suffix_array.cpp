@@ -2,135 +2,220 @@
  * vim: set smartindent autoindent expandtab tabstop=4 shiftwidth=4:
  */
 
+// verbatim
+#include "SuffixArray.hpp"
+#include "utility/Text.hpp"
+#include "utility/Timer.hpp"
+
 // libstdc++
-#include <limits>
-#include <vector>
 #include <string>
+#include <vector>
 #include <iostream>
 #include <algorithm>
 
 // libc
-#include <stdint.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <unistd.h>
 
-// stl
 using std::cout;
 using std::endl;
-using std::sort;
-using std::vector;
 using std::string;
-using std::ostream;
-using std::lower_bound;
-using std::numeric_limits;
-
-typedef size_t Integer;
-static const size_t digits = numeric_limits<Integer>::digits;
+using std::vector;
 
-struct Suffix
-{
-    /*
-     * n:      The number or integer suffix
-     * index:  The index or offset of this suffix relative to source integer
-     * lcp:    The longest common prefix (shared with an immediate predecessor)
-     */
+using verbatim::SuffixArray;
+using verbatim::utility::Timer;
+using verbatim::utility::normalise;
 
-    Integer n;
-    size_t index, lcp;
+namespace {
 
-    Suffix(Integer i = 0,
-           size_t j = 0,
-           size_t k = 0) : n(i), index(j), lcp(k) {}
+/*
+ * As Database passes them, search keys
+ */
+SuffixArray::Fields
+fields(const char *artist,
+       const char *album,
+       const char *genre,
+       const char *title)
+{
+    SuffixArray::Fields f;
 
-    bool operator< (Integer other) const { return n < other; }
-    bool operator< (const Suffix &other) const { return n < other.n; }
-};
+    f.push_back(normalise(artist));
+    f.push_back(normalise(album));
+    f.push_back(normalise(genre));
+    f.push_back(normalise(title));
 
-inline
-void
-print_as_bin(ostream &s, Integer n)
-{
-    for (uint8_t i = 1 ; i <= digits ; ++i) {
-        const uint16_t bit = n & (1 << (digits - i)) ? 1 : 0;
-        s << bit;
-    }
+    return f;
 }
 
-inline
+/*
+ * Of as many documents as were found, or none
+ */
 size_t
-lzc(Integer n) // Leading Zero Count
+found(const SuffixArray &sa, const string &pattern, SuffixArray::Document d)
 {
-    static const Integer max = numeric_limits<Integer>::max();
-    static const uint8_t shift = digits - 1;
-    size_t leading_zeros = 0;
+    vector<SuffixArray::Document> documents;
 
-    /*
-     * I'm expecting the compiler to unroll this loop when built with -O[1-3]
-     */
-    while (n && static_cast<Integer>(~(n >> shift)) == max) {
-        ++leading_zeros;
-        n <<= 1;
-    }
+    sa.find(pattern, documents);
 
-    return leading_zeros;
-}
+    if (documents.size() == 1 && documents[0] == d)
+        return 1;
 
-ostream& operator<< (ostream &os, const Suffix &s)
-{
-    const string x(reinterpret_cast<const char*>(&s.n), digits / 8);
-
-    print_as_bin(os, s.n);
-    os
-        << '\t'
-        << s.index
-        << '\t'
-        << x
-        << '\t'
-        << s.lcp;
-
-    return os;
+    return documents.empty() ? 0 : documents.size() + 1;
 }
 
-void
-compute_suffix_array(const Integer n)
+/*
+ * Fields of made up words, somewhat like tags
+ */
+SuffixArray::Fields
+synthetic(size_t i)
 {
-    vector<Suffix> v;
-    v.reserve(digits);
+    static const char *syllables[] = {
+        "ka", "lo", "mi", "ne", "su", "ta", "ri", "bo", "ze", "qu", "ph", "an"
+    };
+    SuffixArray::Fields f(4);
+
+    for (size_t j = 0, x = i * 2654435761u ; j < f.size() ; ++j) {
+        for (size_t k = 0 ; k < 6 + j * 2 ; ++k, x = x * 6364136223846793005u
+                                                     + 1442695040888963407u) {
+            f[j] += syllables[(x >> 33) % 12];
+
+            if ((x >> 40) % 4 == 0)
+                f[j] += ' ';
+        }
 
-    for (uint8_t i = 1 ; i <= digits ; ++i) {
-        const Integer trunc = n << (digits - i);
+        f[j] = normalise(f[j]);
+    }
 
-        if (!trunc)
-            continue; // Ignore 0
+    return f;
+}
 
-        vector<Suffix>::iterator b(v.begin()),
-                                 e(v.end()),
-                                 j(lower_bound(b, e, trunc));
+double
+seconds(const Timer &t)
+{
+    const Timer::Duration d(t.elapsed());
+    return d.seconds + d.nanoseconds / 1000000000.0;
+}
 
-        if (j == e || trunc < j->n) {
-            const size_t x = j - b, p = x ? lzc(trunc ^ v[x - 1].n) : 0;
+} // anonymous
 
-            j = (v.insert(j, Suffix(trunc, digits - i, p))) + 1;
-            j->lcp = lzc(trunc ^ j->n);
-        }
+int main(int argc, char *argv[])
+{
+    const size_t n = argc > 1 ? atoi(argv[1]) : 20000;
 
-        if ((trunc >> (digits - i)) == n)
-            break; // Bail early, don't cycle through all bits
+    /*
+     * Substrings of any field, case and white space aside, but never
+     * spanning two
+     */
+    {
+        SuffixArray sa;
+        vector<SuffixArray::Document> documents;
+
+        sa.update(1, fields("Boards of Canada", "Geogaddi", "Electronic",
+                            "Music Is Math"));
+        sa.update(2, fields("Aphex Twin", "Drukqs", "Electronic", "Avril 14th"));
+        sa.update(3, fields("The Beatles", "Abbey Road", "Rock", "Something"));
+        sa.commit();
+
+        assert(sa.size() == 3);
+        assert(found(sa, "canada", 1) == 1);
+        assert(found(sa, "IS  MATH ", 1) == 1);
+        assert(found(sa, "twin", 2) == 1);
+        assert(found(sa, "road", 3) == 1);
+        assert(found(sa, "geogaddi electronic", 1) == 0);
+        assert(found(sa, "nothing like it", 1) == 0);
+
+        assert(sa.find("electronic", documents) == 2);
+        assert(documents[0] == 1 && documents[1] == 2);
+        assert(sa.find("e", documents, 1) == 1);
+
+        /*
+         * Changes are found as soon as committed, whether merged or not
+         */
+        assert(!sa.update(3, fields("the beatles", "abbey road", "rock",
+                                    "something")));
+        assert(sa.update(3, fields("The Beatles", "Abbey Road", "Rock",
+                                   "Come Together")));
+        assert(sa.remove(2));
+        assert(!sa.remove(4));
+        sa.commit();
+
+        assert(sa.size() == 2);
+        assert(found(sa, "together", 3) == 1);
+        assert(found(sa, "something", 3) == 0);
+        assert(found(sa, "twin", 2) == 0);
+        assert(found(sa, "abbey", 3) == 1);
+
+        /*
+         * Saved then mapped back, changes and all
+         */
+        char path[] = "/tmp/verbatim-suffix-array-XXXXXX";
+        const int fd = mkstemp(path);
+
+        assert(fd != -1);
+        close(fd);
+
+        sa.save(path);
+
+        SuffixArray loaded;
+
+        assert(loaded.load(path));
+        assert(loaded.size() == 2);
+        assert(found(loaded, "together", 3) == 1);
+        assert(found(loaded, "twin", 2) == 0);
+        assert(found(loaded, "canada", 1) == 1);
+
+        assert(loaded.update(4, fields("Squarepusher", "Hard Normal Daddy",
+                                       "Electronic", "Beep Street")));
+        loaded.commit();
+        assert(found(loaded, "street", 4) == 1);
+        assert(found(loaded, "geogaddi", 1) == 1);
+
+        unlink(path);
+        assert(!loaded.load(path));
     }
-    
+
     /*
-     * Print our suffix array for n
+     * Benchmark: building, incremental updates and queries
      */
-    cout << Suffix(n, 0, 0) << endl; // Source/input integer
-    for (size_t i = 0 ; i < v.size() ; ++i)
-        cout << v[i] << endl;
-}
+    SuffixArray sa;
+    Timer t;
+    size_t matches = 0;
+
+    t.start();
+    for (size_t i = 0 ; i < n ; ++i)
+        sa.update(i, synthetic(i));
+    sa.commit();
+    t.stop();
+    cout << "suffix_array: Build =        " << seconds(t) << "s ("
+         << n << " documents)" << endl;
+
+    t.start();
+    for (size_t i = 0 ; i < n / 100 ; ++i)
+        sa.update(i * 100, synthetic(n + i));
+    sa.commit();
+    t.stop();
+    cout << "suffix_array: Update =       " << seconds(t) << "s ("
+         << n / 100 << " documents)" << endl;
+
+    if (n >= 100) {
+        vector<SuffixArray::Document> documents;
+
+        sa.find(synthetic(n)[3], documents);
+        assert(std::find(documents.begin(), documents.end(), 0) !=
+               documents.end());
+    }
 
-int main(int argc, char *argv[])
-{
-    while(++argv && *argv) {
-        const Integer n = reinterpret_cast<Integer>(*argv);
-        compute_suffix_array(n);
+    t.start();
+    for (size_t i = 0 ; i < 1000 ; ++i) {
+        vector<SuffixArray::Document> documents;
+        const string field(synthetic(i * 7)[i % 4]);
+
+        matches += sa.find(field.substr(field.size() / 3, 8), documents);
     }
+    t.stop();
+    cout << "suffix_array: Query =        " << seconds(t) * 1000.0
+         << "ms (1000 queries, " << matches << " matches)" << endl;
 
-    return 0;
+    return matches == 0;
 }
-
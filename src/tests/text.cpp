@@ -0,0 +1,213 @@
+/*
+ * vim: set smartindent autoindent expandtab tabstop=4 shiftwidth=4:
+ */
+
+// verbatim
+#include "utility/Text.hpp"
+#include "utility/Timer.hpp"
+
+// libstdc++
+#include <string>
+#include <vector>
+#include <iostream>
+
+// libc
+#include <stdlib.h>
+#include <assert.h>
+
+using std::cout;
+using std::string;
+using std::vector;
+
+using verbatim::utility::trigrams;
+using verbatim::utility::normalise;
+using verbatim::utility::edit_distance;
+using verbatim::utility::utf16_to_utf8;
+using verbatim::utility::utf8_to_utf8;
+using verbatim::utility::latin1_to_utf8;
+using verbatim::utility::Timer;
+
+namespace {
+
+/*
+ * Megabytes of text a second
+ */
+double
+throughput(const Timer &t, size_t bytes)
+{
+    const Timer::Duration d(t.elapsed());
+    return bytes / (d.seconds * 1e6 + d.nanoseconds / 1e3);
+}
+
+} // anonymous
+
+int main(int argc, char *argv[])
+{
+    /*
+     * Case and white space aside
+     */
+    assert(normalise("  The \t Beatles\n") == "the beatles");
+    assert(normalise("ABBA", 2) == "ab");
+    assert(normalise("   ").empty());
+
+    /*
+     * Accents and case aside, of any script folded, composed or not, and
+     * a block at a time as much as can be
+     */
+    assert(normalise("Bj\xC3\xB6rk") == "bjork");
+    assert(normalise("STRA\xC3\x9F" "E") == "strasse");
+    assert(normalise("Beyonce\xCC\x81") == "beyonce");
+    assert(normalise("\xC5\x81\xC3\x93" "D\xC5\xB9") == "lodz");
+    assert(normalise("\xCE\x9A\xCE\xAC\xCF\x81\xCF\x82") ==
+           "\xCE\xBA\xCE\xB1\xCF\x81\xCF\x83");
+    assert(normalise("\xD0\x9A\xD0\x98\xD0\x9D\xD0\x9E") ==
+           "\xD0\xBA\xD0\xB8\xD0\xBD\xD0\xBE");
+    assert(normalise("\xEF\xBC\xA1\xEF\xBC\xA2") == "ab");
+    assert(normalise("a\xC2\xA0\xC2\xA0" "b") == "a b");
+    assert(normalise("THE QUICK BROWN FOX, AGAIN AND AGAIN") ==
+           "the quick brown fox, again and again");
+    assert(normalise("ABCDEFGHIJKLMNOPQRSTUVWXYZ@[`{") ==
+           "abcdefghijklmnopqrstuvwxyz@[`{");
+    assert(normalise(" ABCDEFGHIJKLMNOPQ") == "abcdefghijklmnopq");
+    assert(normalise("ABCDEFGHIJKLMNO   ") == "abcdefghijklmno");
+    assert(normalise("A B C D E F G H  I J K L M N O P Q") ==
+           "a b c d e f g h i j k l m n o p q");
+    assert(normalise(string("\xE6\x97\xA5\xE6\x9C\xAC"), 4) == "\xE6\x97\xA5");
+
+    {
+        const string mixed("  Sigur R\xC3\xB3s \xE2\x80\x93 "
+                           "\xC3\x81g\xC3\xA6tis Byrjun  (REMASTERED 1999)\t");
+
+        assert(normalise(mixed) ==
+               "sigur ros \xE2\x80\x93 agaetis byrjun (remastered 1999)");
+        assert(normalise(normalise(mixed)) == normalise(mixed));
+    }
+
+    /*
+     * Distinct, sorted and padded
+     */
+    {
+        vector<string> grams;
+
+        trigrams("abab", grams);
+        assert(grams.size() == 4);
+        assert(grams[0] == " ab" && grams[1] == "ab ");
+        assert(grams[2] == "aba" && grams[3] == "bab");
+
+        trigrams("a", grams);
+        assert(grams.size() == 1 && grams[0] == " a ");
+    }
+
+    /*
+     * Against the closest substring of the text
+     */
+    assert(edit_distance("beatles", "the beatles") == 0);
+    assert(edit_distance("beatls", "the beatles") == 1);
+    assert(edit_distance("baetles", "the beatles") == 2);
+    assert(edit_distance("radiohead", "radiohed") == 1);
+    assert(edit_distance("abc", "") == 3);
+    assert(edit_distance("", "anything") == 0);
+
+    /*
+     * To UTF-8, from either byte order and across the BMP
+     */
+    {
+        string utf8;
+
+        latin1_to_utf8("Bj\xF6rk", 5, utf8);
+        assert(utf8 == "Bj\xC3\xB6rk");
+
+        const char big[] = {0, 'A', '\x00', '\xE9', '\xD8', '\x3D',
+                            '\xDE', '\x00', 0};
+        const char little[] = {'A', 0, '\xE9', 0, '\x3D', '\xD8',
+                               '\x00', '\xDE'};
+
+        utf8.clear();
+        utf16_to_utf8(big, sizeof(big), true, utf8); // Odd byte ignored
+        assert(utf8 == "A\xC3\xA9\xF0\x9F\x98\x80");
+
+        utf8.clear();
+        utf16_to_utf8(little, sizeof(little), false, utf8);
+        assert(utf8 == "A\xC3\xA9\xF0\x9F\x98\x80");
+
+        utf8.clear();
+        utf16_to_utf8(little, 6, false, utf8); // Unpaired high surrogate
+        assert(utf8 == "A\xC3\xA9\xEF\xBF\xBD");
+    }
+
+    /*
+     * Blocks of ASCII either side of what isn't, as is appended to
+     */
+    {
+        const string ascii("Music Has the Right to Children ");
+        const string latin1(ascii + "Bj\xF6rk " + ascii);
+        string utf8("> "), utf16;
+
+        latin1_to_utf8(latin1.data(), latin1.size(), utf8);
+        assert(utf8 == "> " + ascii + "Bj\xC3\xB6rk " + ascii);
+
+        for (size_t i = 0 ; i < latin1.size() ; ++i)
+            utf16 += string(1, '\0') + latin1[i];
+
+        utf8.clear();
+        utf16_to_utf8(utf16.data(), utf16.size(), true, utf8);
+        assert(utf8 == ascii + "Bj\xC3\xB6rk " + ascii);
+    }
+
+    /*
+     * UTF-8 as it is, but for what is not well formed: cut short, overlong,
+     * a surrogate or a stray continuation byte
+     */
+    {
+        const string valid("\xE6\x97\xA5\xE6\x9C\xAC and \xF0\x9F\x98\x80, "
+                           "all of it valid UTF-8");
+        string utf8;
+
+        utf8_to_utf8(valid.data(), valid.size(), utf8);
+        assert(utf8 == valid);
+
+        utf8.clear();
+        utf8_to_utf8("\xC3(\xC0\xAF\xED\xA0\x80\x80\xE6\x97", 10, utf8);
+
+        string replaced("\xEF\xBF\xBD(");
+
+        for (size_t i = 0 ; i < 8 ; ++i)
+            replaced += "\xEF\xBF\xBD";
+
+        assert(utf8 == replaced);
+    }
+
+    /*
+     * Throughput of tag sized text, of ASCII as most is
+     */
+    {
+        const size_t n = argc > 1 ? atoi(argv[1]) : 200000;
+        const string text("Boards of Canada - Music Has the Right to Children");
+        string utf16, utf8;
+        size_t bytes = 0;
+        Timer t;
+
+        for (size_t i = 0 ; i < text.size() ; ++i)
+            utf16 += string(1, text[i]) + '\0';
+
+        t.start();
+        for (size_t i = 0 ; i < n ; ++i) {
+            utf8.clear();
+            utf16_to_utf8(utf16.data(), utf16.size(), false, utf8);
+            bytes += utf8.size();
+        }
+        t.stop();
+
+        cout << "text[UTF-16]: MB/s =       " << throughput(t, bytes) << '\n';
+
+        bytes = 0;
+        t.start();
+        for (size_t i = 0 ; i < n ; ++i)
+            bytes += normalise(text).size();
+        t.stop();
+
+        cout << "text[Normalise]: MB/s =    " << throughput(t, bytes) << '\n';
+    }
+
+    return 0;
+}
@@ -0,0 +1,51 @@
+/*
+ * vim: set smartindent autoindent expandtab tabstop=4 shiftwidth=4:
+ */
+
+// verbatim
+#include "utility/ThreadPool.hpp"
+
+// libstdc++
+#include <atomic>
+
+// libc
+#include <assert.h>
+
+namespace {
+
+struct Count {
+    std::atomic<int> &n;
+    Count(std::atomic<int> &x) : n(x) {}
+    void operator()() const { ++n; }
+};
+
+} // anonymous
+
+int main()
+{
+    using verbatim::utility::ThreadPool;
+
+    std::atomic<int> n(0);
+    ThreadPool pool(2);
+
+    /*
+     * Everything submitted before waiting has run once it returns
+     */
+    for (int i = 0 ; i < 100 ; ++i)
+        pool.submit(Count(n));
+
+    pool.wait();
+    assert(n == 100);
+
+    /*
+     * And the pool still runs what is submitted afterwards
+     */
+    pool.submit(Count(n));
+    pool.wait();
+    assert(n == 101);
+
+    pool.wait();
+    assert(n == 101);
+
+    return 0;
+}
@@ -6,8 +6,14 @@
 #include "Traverse.hpp"
 
 // libstdc++
+#include <mutex>
+#include <atomic>
 #include <iostream>
 
+// libc
+#include <assert.h>
+#include <stdlib.h>
+
 using std::cout;
 using std::cerr;
 using std::endl;
@@ -25,10 +31,12 @@ class RegisterPath : public verbatim::Traverse::Callback
 
         void operator() (const verbatim::Traverse::Path &p)
         {
+            std::lock_guard<std::mutex> l(lock);
             cout << p.name << endl;
             ++tally;
         }
     private:
+        std::mutex lock;
         size_t tally;
 };
 
@@ -52,7 +60,57 @@ class AggregateSize : public verbatim::Traverse::Callback
                 size += p.info->st_size;
         }
     private:
-        size_t size;
+        std::atomic<size_t> size;
+};
+
+/*
+ * Batched traversal callback
+ */
+class CountBatches : public verbatim::Traverse::BatchCallback
+{
+    public:
+        CountBatches() : batches(0), paths(0) {}
+        ~CountBatches()
+        {
+            cout << "Received " << paths << " paths in "
+                 << batches << " batches\n";
+        }
+
+        void operator() (const verbatim::Traverse::Batch &b)
+        {
+            assert(!b.empty());
+
+            for (size_t i = 0 ; i < b.size() ; ++i)
+                assert(b[i].name && b[i].info);
+
+            ++batches;
+            paths += b.size();
+        }
+    private:
+        std::atomic<size_t> batches, paths;
+};
+
+/*
+ * Traversal filter, every directory is considered changed
+ */
+class CountDirectories : public verbatim::Traverse::Filter
+{
+    public:
+        CountDirectories() : directories(0), entries(0) {}
+        ~CountDirectories()
+        {
+            cout << "Filtered " << directories << " directories of "
+                 << entries << " entries\n";
+        }
+
+        bool operator() (const verbatim::Traverse::Path &p, size_t n)
+        {
+            ++directories;
+            entries += n;
+            return true;
+        }
+    private:
+        std::atomic<size_t> directories, entries;
 };
 
 } // anonymous
@@ -66,13 +124,26 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    Traverse t;
+    /*
+     * Optional no. of walkers, batch size and io_uring queue depth
+     */
+    Traverse t(argv[2] ? atoi(argv[2]) : 1,
+               argv[2] && argv[3] ? atoi(argv[3]) : 256);
     RegisterPath callback1;
     AggregateSize callback2;
+    CountBatches callback3;
+    CountDirectories filter;
 
     t.register_callback(&callback1);
     t.register_callback(&callback2);
+    t.register_callback(&callback3);
+    t.register_filter(&filter);
+
+    if (argv[2] && argv[3] && argv[4])
+        t.asynchronous(atoi(argv[4]));
+
     t.scan(argv[1]);
+    t.print_metrics(cout);
 
     return 0;
 }
@@ -36,6 +36,8 @@ class Delegate
             observers.push_back(std::make_pair(o, static_cast<Method>(m)));
         }
 
+        inline bool empty() const { return observers.empty(); }
+
         inline void dispatch(const In &i, Out &o)
         {
             typename Observers::iterator b(observers.begin()),
@@ -73,6 +75,8 @@ class Delegate<In, void>
             observers.push_back(std::make_pair(o, static_cast<Method>(m)));
         }
 
+        inline bool empty() const { return observers.empty(); }
+
         inline void dispatch(const In &i)
         {
             typename Observers::iterator b(observers.begin()),
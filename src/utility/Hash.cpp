@@ -7,6 +7,12 @@
 
 // libc
 #include <assert.h>
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define VERBATIM_HASH_AVX2 1
+#endif
 
 namespace {
 
@@ -17,12 +23,13 @@ namespace {
  * http://isthe.com/chongo/tech/comp/fnv/
  * http://en.wikipedia.org/wiki/Fowler_Noll_Vo_hash#Notes
  *
+ * Both hash the byte following the string too, its terminator.
  */
 size_t
 fnv32(const char *s, size_t len)
 {
     static const uint32_t offset = 2166136261U,
-                          prime = 16777619U; 
+                          prime = 16777619U;
     uint32_t hash = offset;
 
     assert(sizeof(size_t) == sizeof(uint32_t));
@@ -38,7 +45,7 @@ size_t
 fnv64(const char *s, size_t len)
 {
     static const uint64_t offset = 14695981039346656037U,
-                          prime = 1099511628211U; 
+                          prime = 1099511628211U;
     uint64_t hash = offset;
 
     assert(sizeof(size_t) == sizeof(uint64_t));
@@ -50,21 +57,282 @@ fnv64(const char *s, size_t len)
     return hash;
 }
 
+/*
+ * Hash128. The stripe and block structure, lane initialisers and final
+ * mixing follow XXH3 (https://github.com/Cyan4973/xxHash); the secret is
+ * this module's own, so digests are not XXH3's.
+ */
+static const uint64_t PRIME32_1 = 0x9E3779B1U;
+static const uint64_t PRIME32_2 = 0x85EBCA77U;
+static const uint64_t PRIME32_3 = 0xC2B2AE3DU;
+static const uint64_t PRIME64_1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t PRIME64_3 = 0x165667B19E3779F9ULL;
+static const uint64_t PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+static const size_t STRIPES_PER_BLOCK = 8; // Between scrambles of the lanes
+
+/*
+ * Stripe s of a block is keyed by words s to s + 7, scrambles by the last
+ * eight; splitmix64 output
+ */
+static const uint64_t SECRET[16] = {
+    0x2CB0F69F4ABEA221ULL, 0x9417034723148989ULL,
+    0xDD555950609DFE03ULL, 0xDBAFB150DEB12800ULL,
+    0x7E789B2E6C442CB6ULL, 0xF41E5636C7E4F8C4ULL,
+    0x0959D150F8FBA7E4ULL, 0xA97316F13CDB9EEAULL,
+    0x74CD8258F9520068ULL, 0x55C74A62E116868BULL,
+    0xD2F4C799A2023CBDULL, 0xDF98CB79A37B51B9ULL,
+    0x396F5885524F3905ULL, 0xAF1D56386CA3B276ULL,
+    0xA9FFBE6B5104E85AULL, 0x6BD0C51B9FD533B3ULL
+};
+
+inline
+uint64_t
+load64(const char *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v)); // Host order, as the keys made of it are
+    return v;
+}
+
+__extension__ typedef unsigned __int128 uint128_t; // GCC and Clang
+
+inline
+uint64_t
+fold64(uint64_t a, uint64_t b)
+{
+    const uint128_t product = uint128_t(a) * b;
+    return uint64_t(product) ^ uint64_t(product >> 64);
+}
+
+inline
+uint64_t
+avalanche(uint64_t h)
+{
+    h ^= h >> 37;
+    h *= 0x165667919E3779F9ULL;
+    return h ^ (h >> 32);
+}
+
+/*
+ * Each lane adds the product of the halves of its keyed word, and the word
+ * of its neighbour unkeyed so no input is lost to a zero product
+ */
+void
+accumulate_scalar(uint64_t *acc, const char *p, size_t n, size_t &stripe)
+{
+    for ( ; n > 0 ; --n, p += 64) {
+        for (size_t i = 0 ; i < 8 ; ++i) {
+            const uint64_t data = load64(p + i * 8);
+            const uint64_t key = data ^ SECRET[stripe + i];
+
+            acc[i ^ 1] += data;
+            acc[i] += (key & 0xFFFFFFFFU) * (key >> 32);
+        }
+
+        if (++stripe < STRIPES_PER_BLOCK)
+            continue;
+
+        for (size_t i = 0 ; i < 8 ; ++i) {
+            acc[i] ^= acc[i] >> 47;
+            acc[i] ^= SECRET[8 + i];
+            acc[i] *= PRIME32_1;
+        }
+
+        stripe = 0;
+    }
+}
+
+#ifdef VERBATIM_HASH_AVX2
+/*
+ * The same, four lanes to a register; the neighbouring word is the other
+ * half of each 128-bit half
+ */
+__attribute__((target("avx2")))
+void
+accumulate_avx2(uint64_t *acc, const char *p, size_t n, size_t &stripe)
+{
+    const __m256i prime = _mm256_set1_epi64x(PRIME32_1);
+    __m256i a[2] = {
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(acc)),
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(acc + 4))
+    };
+
+    for ( ; n > 0 ; --n, p += 64) {
+        for (size_t i = 0 ; i < 2 ; ++i) {
+            const __m256i data = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i*>(p + i * 32));
+            const __m256i key = _mm256_xor_si256(data, _mm256_loadu_si256(
+                reinterpret_cast<const __m256i*>(SECRET + stripe + i * 4)));
+            const __m256i product =
+                _mm256_mul_epu32(key, _mm256_srli_epi64(key, 32));
+            const __m256i swapped =
+                _mm256_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+
+            a[i] = _mm256_add_epi64(a[i], _mm256_add_epi64(swapped, product));
+        }
+
+        if (++stripe < STRIPES_PER_BLOCK)
+            continue;
+
+        for (size_t i = 0 ; i < 2 ; ++i) {
+            __m256i x = _mm256_xor_si256(a[i], _mm256_srli_epi64(a[i], 47));
+
+            x = _mm256_xor_si256(x, _mm256_loadu_si256(
+                reinterpret_cast<const __m256i*>(SECRET + 8 + i * 4)));
+
+            const __m256i low = _mm256_mul_epu32(x, prime);
+            const __m256i high =
+                _mm256_mul_epu32(_mm256_srli_epi64(x, 32), prime);
+
+            a[i] = _mm256_add_epi64(low, _mm256_slli_epi64(high, 32));
+        }
+
+        stripe = 0;
+    }
+
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(acc), a[0]);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(acc + 4), a[1]);
+}
+#endif
+
+typedef void (*Accumulate)(uint64_t*, const char*, size_t, size_t&);
+
+Accumulate
+choose()
+{
+#ifdef VERBATIM_HASH_AVX2
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2"))
+        return &accumulate_avx2;
+#endif
+    return &accumulate_scalar;
+}
+
+/*
+ * Chosen on first use, whenever that is
+ */
+Accumulate
+accumulate()
+{
+    static const Accumulate chosen = choose();
+    return chosen;
+}
+
 } // anonymous
 
 namespace verbatim {
 namespace utility {
 
-const Hash::Hasher Hash::hashers[2] = {&fnv32, &fnv64};
-const int Hash::index = sizeof(size_t) == 4 ? 0 : // 32-bit
-                        sizeof(size_t) == 8 ? 1 : // 64-bit
-                        -1;
+/*
+ * Hash128 (implementation)
+ */
+Hash128::Hash128(bool scalar) :
+    buffered(0),
+    stripe(0),
+    length(0),
+    engaged(scalar ? &accumulate_scalar : accumulate())
+{
+    static const uint64_t initial[LANES] = {
+        PRIME32_3, PRIME64_1, PRIME64_2, PRIME64_3,
+        PRIME64_4, PRIME32_2, PRIME64_5, PRIME32_1
+    };
+
+    memcpy(acc, initial, sizeof(acc));
+}
 
+/*
+ * Whole stripes are taken straight from the input, only the odd bytes
+ * either side are copied
+ */
+Hash128&
+Hash128::update(const char *s, size_t len)
+{
+    length += len;
+
+    if (buffered > 0) {
+        const size_t n = len < STRIPE - buffered ? len : STRIPE - buffered;
+
+        memcpy(buffer + buffered, s, n);
+        buffered += n;
+        s += n;
+        len -= n;
+
+        if (buffered < STRIPE)
+            return *this;
+
+        engaged(acc, buffer, 1, stripe);
+        buffered = 0;
+    }
+
+    engaged(acc, s, len / STRIPE, stripe);
+    s += len - len % STRIPE;
+    len %= STRIPE;
+
+    memcpy(buffer, s, len);
+    buffered = len;
+
+    return *this;
+}
+
+/*
+ * The last stripe is padded with zeros; the length tells it from one that
+ * ends in zeros
+ */
+Hash128::Digest
+Hash128::digest() const
+{
+    uint64_t lanes[LANES];
+    size_t s = stripe;
+
+    memcpy(lanes, acc, sizeof(lanes));
+
+    if (buffered > 0) {
+        char last[STRIPE];
+
+        memcpy(last, buffer, buffered);
+        memset(last + buffered, 0, STRIPE - buffered);
+        engaged(lanes, last, 1, s);
+    }
+
+    uint64_t low = length * PRIME64_1, high = ~length * PRIME64_2;
+
+    for (size_t i = 0 ; i < LANES ; i += 2) {
+        low += fold64(lanes[i] ^ SECRET[i], lanes[i + 1] ^ SECRET[i + 1]);
+        high += fold64(lanes[i] ^ SECRET[i + 8], lanes[i + 1] ^ SECRET[i + 9]);
+    }
+
+    return Digest(avalanche(low), avalanche(high ^ low));
+}
+
+Hash128::Digest
+Hash128::of(const char *s, size_t len)
+{
+    return Hash128().update(s, len).digest();
+}
+
+const char*
+Hash128::engine()
+{
+    return accumulate() == &accumulate_scalar ? "scalar" : "avx2";
+}
+
+/*
+ * Hash (implementation)
+ */
 size_t
 Hash::operator() (const char *s, size_t len) const
 {
-    assert(Hash::index != -1);
-    return ((*hashers[Hash::index])(s, len));
+    return Hash128::of(s, len).low;
+}
+
+size_t
+Hash::fnv(const char *s, size_t len)
+{
+    return sizeof(size_t) == 4 ? fnv32(s, len) : fnv64(s, len);
 }
 
 } // utility
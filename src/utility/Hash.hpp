@@ -12,15 +12,69 @@
 namespace verbatim {
 namespace utility {
 
+/*
+ * A 128-bit hash of a stream of bytes, fed in pieces of any size. Eight
+ * 64-bit lanes take 64 bytes at a time, each lane a multiply apiece, and are
+ * only folded into a digest at the end. Lanes are independent of each
+ * other, so where the CPU has AVX2 they are updated four at a time; the
+ * digest is the same either way, as keys made from it are kept.
+ *
+ * Not cryptographic: fast, and collision resistant against accident only.
+ */
+class Hash128
+{
+    public:
+        /* Type definitions */
+        struct Digest
+        {
+            uint64_t low, high;
+            Digest() : low(0), high(0) {}
+            Digest(uint64_t l, uint64_t h) : low(l), high(h) {}
+            inline bool operator== (const Digest &other) const
+            {
+                return low == other.low && high == other.high;
+            }
+            inline bool operator!= (const Digest &other) const
+            {
+                return !(*this == other);
+            }
+        };
+
+        /* Member functions/methods */
+        explicit Hash128(bool scalar = false); // Scalar whatever the CPU
+
+        Hash128& update(const char *s, size_t len);
+        Digest digest() const; // Of everything so far, more may follow
+
+        static Digest of(const char *s, size_t len);
+        static const char* engine(); // Chosen for this CPU
+    private:
+        /* Type definitions */
+        typedef void (*Accumulate)(uint64_t *acc,
+                                   const char *stripes,
+                                   size_t n,
+                                   size_t &stripe);
+
+        /* Member variables/attributes */
+        static const size_t LANES = 8, STRIPE = 64;
+
+        uint64_t acc[LANES];
+        char buffer[STRIPE]; // The stripe not yet whole
+        size_t buffered, stripe; // Bytes in buffer, stripes into the block
+        uint64_t length;
+        Accumulate engaged;
+};
+
+/*
+ * Hash functor of keys: the low half of the 128-bit digest
+ */
 struct Hash
 {
     Hash() {};
     ~Hash() {};
 
     size_t operator() (const char *s, size_t len) const;
-    typedef size_t (*Hasher)(const char*, size_t);
-    static const Hasher hashers[2];
-    static const int index;
+    static size_t fnv(const char *s, size_t len); // FNV-1, as keys once were
 };
 
 } // utility
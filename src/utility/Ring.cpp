@@ -0,0 +1,364 @@
+/*
+ * vim: set smartindent autoindent expandtab tabstop=4 shiftwidth=4:
+ */
+
+// Interface
+#include "Ring.hpp"
+
+// verbatim
+#include "Exception.hpp"
+
+// libc
+#include <errno.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+
+#ifdef __NR_io_uring_setup
+#include <linux/io_uring.h>
+#endif
+
+namespace {
+
+#ifdef __NR_io_uring_setup
+
+inline
+int
+io_uring_setup(unsigned entries, io_uring_params *p)
+{
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+inline
+int
+io_uring_enter(int fd, unsigned submit, unsigned wait, unsigned flags)
+{
+    return syscall(__NR_io_uring_enter, fd, submit, wait, flags, NULL, 0);
+}
+
+template<typename T>
+inline
+T*
+offset(void *base, size_t bytes)
+{
+    return reinterpret_cast<T*>(static_cast<char*>(base) + bytes);
+}
+
+#endif
+
+} // anonymous
+
+namespace verbatim {
+namespace utility {
+
+#ifdef __NR_io_uring_setup
+
+Ring::Ring(unsigned entries) :
+    fd(-1),
+    sq_entries(0),
+    cq_entries(0),
+    unsubmitted(0),
+    queued(0),
+    entered(0),
+    sq_ring(MAP_FAILED),
+    cq_ring(MAP_FAILED),
+    sqes(MAP_FAILED),
+    sq_ring_size(0),
+    cq_ring_size(0),
+    sqes_size(0)
+{
+    static const int prot = PROT_READ | PROT_WRITE,
+                     flags = MAP_SHARED | MAP_POPULATE;
+    io_uring_params p;
+
+    memset(&p, 0, sizeof(p));
+
+    if ((fd = io_uring_setup(entries, &p)) == -1)
+        throw FileError("Ring::Ring", errno, "io_uring_setup() failed");
+
+    sq_entries = p.sq_entries;
+    cq_entries = p.cq_entries;
+    sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (cq_ring_size > sq_ring_size)
+            sq_ring_size = cq_ring_size;
+        cq_ring_size = 0;
+    }
+
+    sq_ring = mmap(NULL, sq_ring_size, prot, flags, fd, IORING_OFF_SQ_RING);
+
+    if (sq_ring != MAP_FAILED) {
+        cq_ring = cq_ring_size == 0 ?
+            sq_ring :
+            mmap(NULL, cq_ring_size, prot, flags, fd, IORING_OFF_CQ_RING);
+    }
+
+    if (cq_ring != MAP_FAILED)
+        sqes = mmap(NULL, sqes_size, prot, flags, fd, IORING_OFF_SQES);
+
+    if (sqes == MAP_FAILED) {
+        const int error = errno;
+        release();
+        throw FileError("Ring::Ring", error, "Failed to map io_uring queues");
+    }
+
+    sq_head = offset<unsigned>(sq_ring, p.sq_off.head);
+    sq_tail = offset<unsigned>(sq_ring, p.sq_off.tail);
+    sq_mask = offset<unsigned>(sq_ring, p.sq_off.ring_mask);
+    sq_array = offset<unsigned>(sq_ring, p.sq_off.array);
+    cq_head = offset<unsigned>(cq_ring, p.cq_off.head);
+    cq_tail = offset<unsigned>(cq_ring, p.cq_off.tail);
+    cq_mask = offset<unsigned>(cq_ring, p.cq_off.ring_mask);
+    cqes = offset<void>(cq_ring, p.cq_off.cqes);
+}
+
+Ring::~Ring()
+{
+    release();
+}
+
+void
+Ring::release()
+{
+    if (sqes != MAP_FAILED)
+        munmap(sqes, sqes_size);
+
+    if (cq_ring != MAP_FAILED && cq_ring != sq_ring)
+        munmap(cq_ring, cq_ring_size);
+
+    if (sq_ring != MAP_FAILED)
+        munmap(sq_ring, sq_ring_size);
+
+    if (fd != -1)
+        close(fd);
+
+    sqes = cq_ring = sq_ring = MAP_FAILED;
+    fd = -1;
+}
+
+bool
+Ring::supported()
+{
+    io_uring_params p;
+
+    memset(&p, 0, sizeof(p));
+
+    const int fd = io_uring_setup(1, &p);
+
+    if (fd == -1)
+        return false; // ENOSYS, EPERM (io_uring_disabled) etc.
+
+    close(fd);
+
+    return true;
+}
+
+/*
+ * Claim the next free submission queue entry, zeroed, or NULL if full.
+ * We are the only producer so only the head needs an acquiring load.
+ */
+void*
+Ring::next()
+{
+    const unsigned tail = *sq_tail,
+                   head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+
+    if (tail - head >= sq_entries)
+        return NULL;
+
+    const unsigned i = tail & *sq_mask;
+    io_uring_sqe *sqe = static_cast<io_uring_sqe*>(sqes) + i;
+
+    memset(sqe, 0, sizeof(*sqe));
+    sq_array[i] = i;
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    ++unsubmitted;
+    ++queued;
+
+    return sqe;
+}
+
+bool
+Ring::statx(int dirfd,
+            const char *path,
+            int flags,
+            unsigned mask,
+            struct statx *buffer,
+            uint64_t data)
+{
+    io_uring_sqe *sqe = static_cast<io_uring_sqe*>(next());
+
+    if (!sqe)
+        return false;
+
+    sqe->opcode = IORING_OP_STATX;
+    sqe->fd = dirfd;
+    sqe->addr = reinterpret_cast<uintptr_t>(path);
+    sqe->len = mask;
+    sqe->off = reinterpret_cast<uintptr_t>(buffer);
+    sqe->statx_flags = flags;
+    sqe->user_data = data;
+
+    return true;
+}
+
+bool
+Ring::openat(int dirfd, const char *path, int flags, uint64_t data)
+{
+    io_uring_sqe *sqe = static_cast<io_uring_sqe*>(next());
+
+    if (!sqe)
+        return false;
+
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = dirfd;
+    sqe->addr = reinterpret_cast<uintptr_t>(path);
+    sqe->open_flags = flags;
+    sqe->user_data = data;
+
+    return true;
+}
+
+bool
+Ring::read(int fd, void *buffer, unsigned size, off_t offset, uint64_t data)
+{
+    io_uring_sqe *sqe = static_cast<io_uring_sqe*>(next());
+
+    if (!sqe)
+        return false;
+
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uintptr_t>(buffer);
+    sqe->len = size;
+    sqe->off = offset;
+    sqe->user_data = data;
+
+    return true;
+}
+
+bool
+Ring::fadvise(int fd, off_t offset, off_t size, int advice, uint64_t data)
+{
+    io_uring_sqe *sqe = static_cast<io_uring_sqe*>(next());
+
+    if (!sqe)
+        return false;
+
+    sqe->opcode = IORING_OP_FADVISE;
+    sqe->fd = fd;
+    sqe->off = offset;
+    sqe->len = size;
+    sqe->fadvise_advice = advice;
+    sqe->user_data = data;
+
+    return true;
+}
+
+void
+Ring::submit(unsigned wait)
+{
+    const unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+
+    while (unsubmitted > 0 || wait > 0) {
+        const unsigned ready = *cq_tail - *cq_head;
+        const int n = io_uring_enter(fd,
+                                     unsubmitted,
+                                     wait > ready ? wait - ready : 0,
+                                     flags);
+
+        ++entered;
+
+        if (n == -1) {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+                continue;
+
+            throw FileError("Ring::submit", errno, "io_uring_enter() failed");
+        }
+
+        unsubmitted -= n;
+
+        if (unsubmitted == 0 &&
+            __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE) - *cq_head >= wait)
+            break;
+    }
+}
+
+/*
+ * We are the only consumer so only the tail needs an acquiring load
+ */
+bool
+Ring::reap(uint64_t &data, int &result)
+{
+    const unsigned head = *cq_head,
+                   tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+
+    if (head == tail)
+        return false;
+
+    const io_uring_cqe *cqe =
+        static_cast<const io_uring_cqe*>(cqes) + (head & *cq_mask);
+
+    data = cqe->user_data;
+    result = cqe->res;
+
+    __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+#else // No kernel headers for io_uring, always fall back
+
+Ring::Ring(unsigned entries)
+{
+    throw FileError("Ring::Ring", ENOSYS, "Built without io_uring support");
+}
+
+Ring::~Ring()
+{
+}
+
+void Ring::release() {}
+bool Ring::supported() { return false; }
+bool Ring::statx(int, const char*, int, unsigned, struct statx*, uint64_t)
+{ return false; }
+bool Ring::openat(int, const char*, int, uint64_t) { return false; }
+bool Ring::read(int, void*, unsigned, off_t, uint64_t) { return false; }
+bool Ring::fadvise(int, off_t, off_t, int, uint64_t) { return false; }
+void Ring::submit(unsigned) {}
+bool Ring::reap(uint64_t&, int&) { return false; }
+
+#endif
+
+void
+Ring::to_stat(const struct statx &x, struct stat &s)
+{
+    memset(&s, 0, sizeof(s));
+
+    s.st_dev = makedev(x.stx_dev_major, x.stx_dev_minor);
+    s.st_ino = x.stx_ino;
+    s.st_mode = x.stx_mode;
+    s.st_nlink = x.stx_nlink;
+    s.st_uid = x.stx_uid;
+    s.st_gid = x.stx_gid;
+    s.st_rdev = makedev(x.stx_rdev_major, x.stx_rdev_minor);
+    s.st_size = x.stx_size;
+    s.st_blksize = x.stx_blksize;
+    s.st_blocks = x.stx_blocks;
+    s.st_atim.tv_sec = x.stx_atime.tv_sec;
+    s.st_atim.tv_nsec = x.stx_atime.tv_nsec;
+    s.st_mtim.tv_sec = x.stx_mtime.tv_sec;
+    s.st_mtim.tv_nsec = x.stx_mtime.tv_nsec;
+    s.st_ctim.tv_sec = x.stx_ctime.tv_sec;
+    s.st_ctim.tv_nsec = x.stx_ctime.tv_nsec;
+}
+
+} // utility
+} // verbatim
@@ -0,0 +1,79 @@
+/*
+ * vim: set smartindent autoindent expandtab tabstop=4 shiftwidth=4:
+ */
+
+#ifndef VERBATIM_UTILITY_RING_HPP
+#define VERBATIM_UTILITY_RING_HPP
+
+// libc
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/stat.h>
+
+namespace verbatim {
+namespace utility {
+
+/*
+ * A minimal io_uring(7) submission and completion queue pair, driven
+ * through the raw system calls so there is no dependency on liburing.
+ * Requests are queued with one of the op methods, each tagged with a
+ * caller-defined value returned with the completion. An instance must
+ * only ever be used by one thread.
+ */
+class Ring
+{
+    public:
+        /* Member functions/methods */
+        Ring(unsigned entries); // Throws FileError if unavailable
+        ~Ring();
+
+        static bool supported(); // Compiled in and permitted at runtime
+
+        inline unsigned depth() const { return sq_entries; }
+        inline size_t requests() const { return queued; }
+        inline size_t syscalls() const { return entered; }
+
+        /*
+         * Queue requests; each returns false only when the queue is full
+         */
+        bool statx(int dirfd,
+                   const char *path,
+                   int flags,
+                   unsigned mask,
+                   struct statx *buffer,
+                   uint64_t data);
+        bool openat(int dirfd, const char *path, int flags, uint64_t data);
+        bool read(int fd, void *buffer, unsigned size, off_t offset,
+                  uint64_t data);
+        bool fadvise(int fd, off_t offset, off_t size, int advice,
+                     uint64_t data);
+
+        void submit(unsigned wait = 0); // Block until 'wait' have completed
+        bool reap(uint64_t &data, int &result); // Never blocks
+
+        static void to_stat(const struct statx &x, struct stat &s);
+    private:
+        /* Member functions/methods */
+        Ring(const Ring&); // Not copyable
+        Ring& operator= (const Ring&);
+
+        void* next();
+        void release();
+
+        /* Member variables/attributes */
+        int fd;
+        unsigned sq_entries, cq_entries, unsubmitted;
+        size_t queued, entered;
+
+        void *sq_ring, *cq_ring, *sqes;
+        size_t sq_ring_size, cq_ring_size, sqes_size;
+
+        unsigned *sq_head, *sq_tail, *sq_mask, *sq_array,
+                 *cq_head, *cq_tail, *cq_mask;
+        void *cqes;
+};
+
+} // utility
+} // verbatim
+
+#endif // VERBATIM_UTILITY_RING_HPP
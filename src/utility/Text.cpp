@@ -0,0 +1,506 @@
+/*
+ * vim: set smartindent autoindent expandtab tabstop=4 shiftwidth=4:
+ */
+
+// Interface
+#include "Text.hpp"
+
+// libstdc++
+#include <algorithm>
+
+// libc
+#include <stdint.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <emmintrin.h> // SSE2, as every x86-64 has
+#define VERBATIM_TEXT_SSE2 1
+#endif
+
+using std::string;
+using std::vector;
+
+namespace {
+
+typedef const unsigned char Byte;
+
+static const size_t BLOCK = 16; // Bytes of a vector, or to a scalar pass
+
+static const uint32_t REPLACEMENT = 0xFFFD;
+
+/*
+ * The code point at out, returning where it ends
+ */
+char*
+put_utf8(uint32_t c, char *out)
+{
+    if (c < 0x80) {
+        *out++ = char(c);
+    } else if (c < 0x800) {
+        *out++ = char(0xC0 | c >> 6);
+        *out++ = char(0x80 | (c & 0x3F));
+    } else if (c < 0x10000) {
+        *out++ = char(0xE0 | c >> 12);
+        *out++ = char(0x80 | (c >> 6 & 0x3F));
+        *out++ = char(0x80 | (c & 0x3F));
+    } else {
+        *out++ = char(0xF0 | c >> 18);
+        *out++ = char(0x80 | (c >> 12 & 0x3F));
+        *out++ = char(0x80 | (c >> 6 & 0x3F));
+        *out++ = char(0x80 | (c & 0x3F));
+    }
+
+    return out;
+}
+
+/*
+ * The code point of a well formed sequence of no more than size bytes and
+ * its length, else U+FFFD of one byte: overlong forms, surrogates and what
+ * is past U+10FFFF are not well formed
+ */
+uint32_t
+get_utf8(Byte *b, size_t size, size_t &n)
+{
+    const uint32_t c = b[0];
+    size_t length = 0;
+    uint32_t low = 0x80, high = 0xBF; // Of the second byte
+
+    if (c < 0x80) {
+        n = 1;
+        return c;
+    }
+
+    if (c >= 0xC2 && c <= 0xDF) {
+        length = 2;
+    } else if (c >= 0xE0 && c <= 0xEF) {
+        length = 3;
+        low = c == 0xE0 ? 0xA0 : low;
+        high = c == 0xED ? 0x9F : high;
+    } else if (c >= 0xF0 && c <= 0xF4) {
+        length = 4;
+        low = c == 0xF0 ? 0x90 : low;
+        high = c == 0xF4 ? 0x8F : high;
+    }
+
+    n = 1;
+
+    if (length == 0 || size < length || b[1] < low || b[1] > high)
+        return REPLACEMENT;
+
+    uint32_t code = c & (0xFF >> (length + 1));
+
+    for (size_t i = 1 ; i < length ; ++i) {
+        if ((b[i] & 0xC0) != 0x80)
+            return REPLACEMENT;
+
+        code = code << 6 | (b[i] & 0x3F);
+    }
+
+    n = length;
+
+    return code;
+}
+
+/*
+ * Leading blocks of ASCII, copied to out 16 bytes at a time; how many
+ * bytes. None without SSE2, leaving it all to the scalar pass.
+ */
+size_t
+ascii(const char *s, size_t size, char *out)
+{
+    size_t i = 0;
+
+#ifdef VERBATIM_TEXT_SSE2
+    for ( ; i + BLOCK <= size ; i += BLOCK) {
+        const __m128i v =
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+
+        if (_mm_movemask_epi8(v) != 0)
+            break;
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), v);
+    }
+#endif
+
+    return i;
+}
+
+/*
+ * Ditto of UTF-16, eight units at a time narrowed to bytes; how many units
+ */
+size_t
+ascii16(Byte *b, size_t units, bool big_endian, char *out)
+{
+    size_t i = 0;
+
+#ifdef VERBATIM_TEXT_SSE2
+    const __m128i mask = _mm_set1_epi16(short(0xFF80));
+    const __m128i zero = _mm_setzero_si128();
+
+    for ( ; i + BLOCK / 2 <= units ; i += BLOCK / 2) {
+        __m128i v =
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i * 2));
+
+        if (big_endian)
+            v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(v, mask),
+                                              zero)) != 0xFFFF)
+            break;
+
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(out + i),
+                         _mm_packus_epi16(v, v));
+    }
+#endif
+
+    return i;
+}
+
+/*
+ * Bytes of 16 of them lower cased into out, unless any is not printable
+ * ASCII or two spaces are side by side; the spaces there are, a bit each
+ */
+bool
+lower_block(const char *s, char *out, unsigned &spaces)
+{
+#ifdef VERBATIM_TEXT_SSE2
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s));
+    const __m128i printable = _mm_cmpgt_epi8(v, _mm_set1_epi8(' ' - 1));
+    const __m128i upper =
+        _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)),
+                      _mm_cmplt_epi8(v, _mm_set1_epi8('Z' + 1)));
+
+    spaces = _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+
+    if (_mm_movemask_epi8(printable) != 0xFFFF || (spaces & spaces >> 1))
+        return false;
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out),
+                     _mm_add_epi8(v, _mm_and_si128(upper,
+                                                   _mm_set1_epi8(0x20))));
+    return true;
+#else
+    (void) s;
+    (void) out;
+    (void) spaces;
+    return false;
+#endif
+}
+
+/*
+ * Letters of Latin-1 and Latin Extended-A, U+00C0 to U+017F, as the ASCII
+ * they are written with less their accents, lower case; those not listed,
+ * the multiplication and division signs, are as they are
+ */
+struct Folding
+{
+    uint32_t first, last;
+    const char *folded;
+};
+
+const Folding LATIN[] = {
+    {0xC0, 0xC5, "a"}, {0xC6, 0xC6, "ae"}, {0xC7, 0xC7, "c"},
+    {0xC8, 0xCB, "e"}, {0xCC, 0xCF, "i"}, {0xD0, 0xD0, "d"},
+    {0xD1, 0xD1, "n"}, {0xD2, 0xD6, "o"}, {0xD8, 0xD8, "o"},
+    {0xD9, 0xDC, "u"}, {0xDD, 0xDD, "y"}, {0xDE, 0xDE, "th"},
+    {0xDF, 0xDF, "ss"}, {0xE0, 0xE5, "a"}, {0xE6, 0xE6, "ae"},
+    {0xE7, 0xE7, "c"}, {0xE8, 0xEB, "e"}, {0xEC, 0xEF, "i"},
+    {0xF0, 0xF0, "d"}, {0xF1, 0xF1, "n"}, {0xF2, 0xF6, "o"},
+    {0xF8, 0xF8, "o"}, {0xF9, 0xFC, "u"}, {0xFD, 0xFD, "y"},
+    {0xFE, 0xFE, "th"}, {0xFF, 0xFF, "y"},
+    {0x100, 0x105, "a"}, {0x106, 0x10D, "c"}, {0x10E, 0x111, "d"},
+    {0x112, 0x11B, "e"}, {0x11C, 0x123, "g"}, {0x124, 0x127, "h"},
+    {0x128, 0x131, "i"}, {0x132, 0x133, "ij"}, {0x134, 0x135, "j"},
+    {0x136, 0x138, "k"}, {0x139, 0x142, "l"}, {0x143, 0x14B, "n"},
+    {0x14C, 0x151, "o"}, {0x152, 0x153, "oe"}, {0x154, 0x159, "r"},
+    {0x15A, 0x161, "s"}, {0x162, 0x167, "t"}, {0x168, 0x173, "u"},
+    {0x174, 0x175, "w"}, {0x176, 0x178, "y"}, {0x179, 0x17E, "z"},
+    {0x17F, 0x17F, "s"}
+};
+
+/*
+ * Greek with its tonos, U+0386 to U+038F and U+03AC to U+03AF, and final
+ * sigma, as the lower case letter less the accent; 0 where there is none
+ */
+const uint16_t GREEK[] = {
+    0x3B1, 0, 0x3B5, 0x3B7, 0x3B9, 0, 0x3BF, 0, 0x3C5, 0x3C9 // U+0386
+};
+
+/*
+ * The code point case folded and stripped of any accent, appended to out;
+ * where it ends. Latin, Greek and Cyrillic letters and fullwidth ASCII are
+ * folded, the rest left as they are.
+ */
+char*
+fold(uint32_t c, char *out)
+{
+    if (c >= 0xFF01 && c <= 0xFF5E) // Fullwidth ASCII
+        c -= 0xFEE0;
+
+    if (c < 0x80) {
+        *out++ = c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+        return out;
+    }
+
+    if (c >= 0xC0 && c < 0x180) {
+        for (size_t i = 0 ; i < sizeof(LATIN) / sizeof(LATIN[0]) ; ++i) {
+            if (c < LATIN[i].first || c > LATIN[i].last)
+                continue;
+
+            for (const char *f = LATIN[i].folded ; *f ; ++f)
+                *out++ = *f;
+
+            return out;
+        }
+    } else if (c >= 0x386 && c <= 0x38F && GREEK[c - 0x386]) {
+        c = GREEK[c - 0x386];
+    } else if (c >= 0x391 && c <= 0x3A9) {
+        c += 0x20;
+    } else if (c >= 0x3AC && c <= 0x3CE) {
+        static const uint16_t accented[] = {0x3B1, 0x3B5, 0x3B7, 0x3B9};
+        c = c <= 0x3AF ? accented[c - 0x3AC] :
+            c == 0x3C2 ? 0x3C3 :
+            c == 0x3CC ? 0x3BF :
+            c == 0x3CD ? 0x3C5 :
+            c == 0x3CE ? 0x3C9 : c;
+    } else if (c >= 0x400 && c <= 0x40F) {
+        c += 0x50;
+    } else if (c >= 0x410 && c <= 0x42F) {
+        c += 0x20;
+    }
+
+    return put_utf8(c, out);
+}
+
+inline
+bool
+is_space(uint32_t c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' ||
+           c == 0xA0 || c == 0x3000; // No-break and ideographic spaces
+}
+
+inline
+bool
+is_combining(uint32_t c)
+{
+    return c >= 0x300 && c < 0x370; // Accents of decomposed letters
+}
+
+} // anonymous
+
+namespace verbatim {
+namespace utility {
+
+/*
+ * Decoded a character at a time, but for blocks of 16 printable ASCII
+ * bytes lower cased at once; a block that isn't is not tried again until
+ * past it. Of a block, a leading space is trimmed as any other and a
+ * trailing one left to what follows. Each character is whole or not there
+ * at all.
+ */
+string
+normalise(const char *s, size_t size, size_t limit)
+{
+    Byte *b = reinterpret_cast<Byte*>(s);
+    string normal;
+    bool space = false;
+    char folded[BLOCK];
+    unsigned spaces = 0;
+
+    normal.reserve(size < limit ? size : limit);
+
+    for (size_t i = 0, n = 1, retry = 0 ; i < size && normal.size() < limit ;
+         i += n) {
+        if (!space &&
+            i >= retry &&
+            i + BLOCK <= size &&
+            normal.size() + BLOCK <= limit) {
+            if (lower_block(s + i, folded, spaces) &&
+                (!normal.empty() || (spaces & 1) == 0)) {
+                space = spaces >> (BLOCK - 1);
+                normal.append(folded, BLOCK - space);
+                n = BLOCK;
+                continue;
+            }
+
+            retry = i + BLOCK;
+        }
+
+        uint32_t c = b[i];
+        size_t length = 1;
+
+        if (c < 0x80) {
+            n = 1;
+            folded[0] = c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+        } else {
+            c = get_utf8(b + i, size - i, n);
+            length = is_combining(c) ? 0 : fold(c, folded) - folded;
+        }
+
+        if (is_space(c)) {
+            space = !normal.empty();
+            continue;
+        }
+
+        if (length == 0)
+            continue;
+
+        if (normal.size() + space + length > limit)
+            break;
+
+        if (space)
+            normal += ' ';
+
+        space = false;
+
+        if (length == 1)
+            normal += folded[0];
+        else
+            normal.append(folded, length);
+    }
+
+    return normal;
+}
+
+void
+trigrams(const string &normal, vector<string> &grams)
+{
+    const string padded(' ' + normal + ' ');
+
+    grams.clear();
+
+    for (size_t i = 0 ; i + 3 <= padded.size() ; ++i)
+        grams.push_back(padded.substr(i, 3));
+
+    std::sort(grams.begin(), grams.end());
+    grams.erase(std::unique(grams.begin(), grams.end()), grams.end());
+}
+
+/*
+ * Sellers' variant of Levenshtein's: a match may start anywhere in the text
+ * at no cost, so the first row is all zeros, and end anywhere, so the
+ * answer is the least of the last column rather than its last cell
+ */
+size_t
+edit_distance(const string &pattern, const string &text)
+{
+    const size_t m = pattern.size();
+    vector<size_t> column(m + 1);
+    size_t best = m;
+
+    for (size_t i = 0 ; i <= m ; ++i)
+        column[i] = i;
+
+    for (size_t j = 0 ; j < text.size() ; ++j) {
+        size_t diagonal = 0; // Row zero: free to start here
+
+        column[0] = 0;
+
+        for (size_t i = 1 ; i <= m ; ++i) {
+            const size_t above = column[i];
+            const size_t cost = pattern[i - 1] == text[j] ? 0 : 1;
+
+            column[i] = std::min(std::min(above, column[i - 1]) + 1,
+                                 diagonal + cost);
+            diagonal = above;
+        }
+
+        best = std::min(best, column[m]);
+    }
+
+    return best;
+}
+
+/*
+ * The transcoders write in place, to room for the longest the text could
+ * be, and take blocks of ASCII, as most tags are, a vector at a time. A
+ * block that isn't is taken a character at a time before trying again.
+ */
+void
+latin1_to_utf8(const char *s, size_t size, string &utf8)
+{
+    const size_t start = utf8.size();
+
+    utf8.resize(start + size * 2);
+
+    char *const first = &utf8[0], *out = first + start;
+
+    for (size_t i = 0 ; i < size ; ) {
+        const size_t n = ascii(s + i, size - i, out);
+        const size_t end = std::min(size, i + n + BLOCK);
+
+        for (i += n, out += n ; i < end ; ++i)
+            out = put_utf8(Byte(s[i]), out);
+    }
+
+    utf8.resize(out - first);
+}
+
+void
+utf16_to_utf8(const char *s, size_t size, bool big_endian, string &utf8)
+{
+    Byte *b = reinterpret_cast<Byte*>(s);
+    const size_t units = size / 2;
+    const size_t high = big_endian ? 0 : 1;
+    const size_t start = utf8.size();
+
+    utf8.resize(start + units * 3);
+
+    char *const first = &utf8[0], *out = first + start;
+
+    for (size_t i = 0 ; i < units ; ) {
+        const size_t n = ascii16(b + i * 2, units - i, big_endian, out);
+        const size_t end = std::min(units, i + n + BLOCK / 2);
+
+        for (i += n, out += n ; i < end ; ++i) {
+            uint32_t c = b[i * 2 + high] << 8 | b[i * 2 + 1 - high];
+
+            if (c >= 0xD800 && c < 0xDC00 && i + 1 < units) {
+                const uint32_t low =
+                    b[(i + 1) * 2 + high] << 8 | b[(i + 1) * 2 + 1 - high];
+
+                if (low >= 0xDC00 && low < 0xE000) {
+                    c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+                    ++i;
+                }
+            }
+
+            out = put_utf8(c >= 0xD800 && c < 0xE000 ? REPLACEMENT : c, out);
+        }
+    }
+
+    utf8.resize(out - first);
+}
+
+void
+utf8_to_utf8(const char *s, size_t size, string &utf8)
+{
+    Byte *b = reinterpret_cast<Byte*>(s);
+    const size_t start = utf8.size();
+
+    utf8.resize(start + size * 3);
+
+    char *const first = &utf8[0], *out = first + start;
+
+    for (size_t i = 0 ; i < size ; ) {
+        const size_t n = ascii(s + i, size - i, out);
+        const size_t end = std::min(size, i + n + BLOCK);
+        size_t length = 0;
+
+        for (i += n, out += n ; i < end ; i += length) {
+            const uint32_t c = get_utf8(b + i, size - i, length);
+
+            if (length > 1) {
+                std::copy(s + i, s + i + length, out);
+                out += length;
+            } else {
+                out = put_utf8(c, out);
+            }
+        }
+    }
+
+    utf8.resize(out - first);
+}
+
+} // utility
+} // verbatim
@@ -0,0 +1,67 @@
+/*
+ * vim: set smartindent autoindent expandtab tabstop=4 shiftwidth=4:
+ */
+
+#ifndef VERBATIM_UTILITY_TEXT_HPP
+#define VERBATIM_UTILITY_TEXT_HPP
+
+// libstdc++
+#include <string>
+#include <vector>
+
+// libc
+#include <stddef.h>
+
+namespace verbatim {
+namespace utility {
+
+/*
+ * Text as the indexes compare it, a search key: UTF-8 with letters case
+ * folded and stripped of their accents (of Latin, Greek and Cyrillic, as
+ * much of them as tags are written in) and runs of white space trimmed or
+ * collapsed to one space, so "The  Beatles " and "the beatles" are one and
+ * the same, as is Motorhead with its umlaut or without. At most limit
+ * bytes long, of whole characters.
+ */
+std::string normalise(const char *s,
+                      size_t size,
+                      size_t limit = std::string::npos);
+
+inline
+std::string
+normalise(const std::string &s, size_t limit = std::string::npos)
+{
+    return normalise(s.data(), s.size(), limit);
+}
+
+/*
+ * The distinct three byte substrings of normalised text, padded with a space
+ * either side so short text and the ends of words count as well; sorted
+ */
+void trigrams(const std::string &normal, std::vector<std::string> &grams);
+
+/*
+ * The fewest insertions, deletions and substitutions turning the pattern
+ * into any substring of the text, so a misspelt word still finds the title
+ * it is part of. O(m n) time, O(m) space.
+ */
+size_t edit_distance(const std::string &pattern, const std::string &text);
+
+/*
+ * Text as tags encode it, appended to utf8 as UTF-8. UTF-16 is of the byte
+ * order given, a trailing odd byte ignored; unpaired surrogates become
+ * U+FFFD, the replacement character, as does each byte of UTF-8 that is
+ * not of a well formed sequence. Runs of ASCII are copied 16 bytes at a
+ * time where there is SSE2.
+ */
+void latin1_to_utf8(const char *s, size_t size, std::string &utf8);
+void utf16_to_utf8(const char *s,
+                   size_t size,
+                   bool big_endian,
+                   std::string &utf8);
+void utf8_to_utf8(const char *s, size_t size, std::string &utf8);
+
+} // utility
+} // verbatim
+
+#endif // VERBATIM_UTILITY_TEXT_HPP
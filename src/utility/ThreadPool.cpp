@@ -93,6 +93,11 @@ ThreadPool::wait()
     service.stop();
 
     running = false;
+
+    /*
+     * Ready for whatever is submitted next, e.g. what watching finds
+     */
+    restart();
 }
 
 size_t
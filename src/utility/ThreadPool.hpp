@@ -36,7 +36,7 @@ class ThreadPool {
 
         void restart(); // Won't restart, unless stopped
         void stop(); // Will block
-        void wait(); // Will block
+        void wait(); // Will block, then restart
         size_t index() const; // Return index of executing worker
         template<typename Work> void submit(const Work &w);
         inline size_t size() const { return workers.size(); }
@@ -63,6 +63,11 @@ Timer::diff(const Timestamp &from, const Timestamp &to)
     d.seconds = from.seconds - to.seconds;
     d.nanoseconds = from.nanoseconds - to.nanoseconds;
 
+    if (from.nanoseconds < to.nanoseconds) {
+        --d.seconds; // Borrow a second
+        d.nanoseconds += 1000000000;
+    }
+
     return d;
 }
 
@@ -81,7 +81,12 @@ int main(int argc, char *argv[])
     Context c(0);
     size_t count = 0;
 
-    c.database().open(db_path);
+    try {
+        c.database().open(db_path, false);
+    } catch (const exception &e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
     count = c.database().list_entries(cout);
 
     if (verbose)
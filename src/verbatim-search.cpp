@@ -0,0 +1,160 @@
+/*
+ * vim: set smartindent autoindent expandtab tabstop=4 shiftwidth=4:
+ */
+
+// verbatim
+#include "Tag.hpp"
+#include "Context.hpp"
+#include "utility/tools.hpp"
+#include "utility/Timer.hpp"
+
+// libstdc++
+#include <string>
+#include <vector>
+#include <iostream>
+#include <exception>
+
+// libc
+#include <getopt.h>
+
+// libstdc++
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::string;
+using std::vector;
+using std::exception;
+
+// verbatim
+using verbatim::Tag;
+using verbatim::Context;
+using verbatim::Database;
+using verbatim::utility::Timer;
+using verbatim::utility::str2int;
+
+namespace {
+
+static const char *const FIELDS[] = {"artist", "album", "genre", "title"};
+
+void
+print_usage(const char *program_name)
+{
+    cerr << "usage: "
+         << program_name << " [options] " << "<db file> <text>\n\n";
+    cerr << "Options (defaults in parenthesis):\n"
+         << "-h/--help             "
+         << "Print this help message you're reading, then terminate\n"
+         << "-v/--verbose          "
+         << "Print noisy verbose messages to stdout (false)\n"
+         << "-f/--fuzzy            "
+         << "Print the artists, albums, genres and titles close to the text,\n"
+         << "                      "
+         << "allowing for misspellings, rather than tracks containing it\n"
+         << "-n/--limit            "
+         << "Print no more than this many matches, 0 for all (0, 10 if fuzzy)\n";
+}
+
+} // anonymous
+
+int main(int argc, char *argv[])
+{
+    /*
+     * Default values for optional flags - read help message in print_usage()!
+     */
+    bool verbose = false, fuzzy = false;
+    uint32_t limit = 0;
+    const char *db_path = NULL, *pattern = NULL;
+
+    try {
+        int option_index, c = 0;
+        const char *short_options = "+hvfn:";
+        struct option const long_options[] = {
+            {"help", 0, NULL, 'h'},
+            {"verbose", 0, NULL, 'v'},
+            {"fuzzy", 0, NULL, 'f'},
+            {"limit", 1, NULL, 'n'},
+            {NULL, 0, NULL, 0}
+        };
+
+        do {
+            c = getopt_long(argc,argv,short_options,long_options,&option_index);
+
+            switch (c) {
+                case 'v':
+                    verbose = true;
+                    break;
+                case 'f':
+                    fuzzy = true;
+                    break;
+                case 'n': {
+                        static const uint32_t min = 0, max = 1000000;
+                        limit = str2int<uint32_t>(optarg, &min, &max);
+                    }
+                    break;
+                case 'h':
+                    print_usage(argv[0]);
+                    return 1;
+            }
+        } while (c != -1);
+    } catch (const exception &e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+
+    if ((argc - optind) < 2) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    db_path = argv[optind++];
+    pattern = argv[optind++];
+
+    Context c(0);
+    Timer t;
+    vector<size_t> keys;
+    vector<Database::Match> matches;
+
+    try {
+        c.database().open(db_path, false);
+    } catch (const exception &e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+
+    t.start();
+    if (fuzzy)
+        c.database().fuzzy(pattern, matches, limit ? limit : 10);
+    else
+        c.database().search(pattern, keys, limit);
+    t.stop();
+
+    for (size_t i = 0 ; i < matches.size() ; ++i) {
+        const Database::Match &m = matches[i];
+
+        cout << FIELDS[m.by] << '\t' << m.value << '\t'
+             << m.distance << " edit(s), "
+             << c.database().find(m.by, m.value, keys) << " track(s)\n";
+    }
+
+    if (fuzzy)
+        keys.clear();
+
+    for (size_t i = 0 ; i < keys.size() ; ++i) {
+        Tag tag;
+
+        if (c.database().tag(keys[i], tag))
+            cout << tag.artist << " - " << tag.album << " - " << tag.title
+                 << '\t' << tag.filename << '\n';
+    }
+
+    if (verbose) {
+        const Timer::Duration d(t.elapsed());
+
+        cout << "verbatim-search: #matches =    "
+             << (fuzzy ? matches.size() : keys.size()) << endl
+             << "verbatim-search: Search time = "
+             << d.seconds + d.nanoseconds / 1000000000.0 << "s" << endl;
+    }
+
+    return 0;
+}
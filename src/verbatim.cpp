@@ -3,13 +3,21 @@
  */
 
 // verbatim
+#include "Watch.hpp"
 #include "Context.hpp"
 #include "utility/tools.hpp"
 #include "utility/Timer.hpp"
 
 // libstdc++
+#include <mutex>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
 #include <iostream>
 #include <exception>
+#include <condition_variable>
 
 // libc
 #include <getopt.h>
@@ -18,27 +26,94 @@
 using std::cout;
 using std::cerr;
 using std::endl;
+using std::string;
+using std::vector;
 using std::exception;
 
 // verbatim
+using verbatim::Watch;
 using verbatim::Context;
 using verbatim::utility::Timer;
 using verbatim::utility::str2int;
 
 namespace {
 
+/*
+ * Interrupts the scan, leaving it to be resumed by a later run, if it has
+ * not finished within the given no. of seconds. Zero means no limit.
+ */
+class Budget
+{
+    public:
+        Budget(Context &c, unsigned seconds) : finished(false)
+        {
+            if (seconds > 0)
+                timer = std::thread(&Budget::run, this, std::ref(c), seconds);
+        }
+
+        ~Budget()
+        {
+            {
+                std::lock_guard<std::mutex> l(lock);
+                finished = true;
+            }
+
+            wake.notify_one();
+
+            if (timer.joinable())
+                timer.join();
+        }
+    private:
+        void run(Context &c, unsigned seconds) // THREAD ENTRY POINT
+        {
+            std::unique_lock<std::mutex> l(lock);
+
+            if (wake.wait_for(l,
+                              std::chrono::seconds(seconds),
+                              [this] { return finished; }))
+                return;
+
+            c.traverser().stop();
+            c.database().interrupt();
+        }
+
+        bool finished;
+        std::mutex lock;
+        std::condition_variable wake;
+        std::thread timer;
+};
+
 void
 print_usage(const char *program_name)
 {
     cerr << "usage: "
-         << program_name << " [options] " << "<db file> <music directory>\n\n";
+         << program_name << " [options] "
+         << "<db file> <music directory> [<music directory>...]\n\n";
     cerr << "Options (defaults in parenthesis):\n"
          << "-h/--help             "
          << "Print this help message you're reading, then terminate\n"
          << "-v/--verbose          "
          << "Print noisy verbose messages to stdout (false)\n"
+         << "-i/--incremental      "
+         << "Skip files of directories unchanged since last scan (false)\n"
+         << "-R/--rebuild          "
+         << "Drop every entry and scan from scratch (false)\n"
+         << "-T/--taglib           "
+         << "Parse every ID3v2 tag with TagLib, for comparison (false)\n"
+         << "-W/--watch            "
+         << "After scanning, follow changes until interrupted (false)\n"
          << "-c/--concurrency <N>  "
-         << "No. of worker threads to run in parallel (2)\n";
+         << "No. of worker threads to run in parallel (2)\n"
+         << "-w/--walkers <N>      "
+         << "No. of directory walker threads to run in parallel (2)\n"
+         << "-b/--batch-size <N>   "
+         << "No. of paths handed to each worker thread at once (256)\n"
+         << "-q/--queue-depth <N>  "
+         << "Stat and sniff files via io_uring, N requests in flight (0)\n"
+         << "-l/--locality <N>     "
+         << "Parse files in on-disk order, N files at a time (0)\n"
+         << "-t/--time-budget <N>  "
+         << "Stop after N seconds, the next run resumes the scan (0)\n";
 }
 
 } // anonymous
@@ -48,17 +123,29 @@ int main(int argc, char *argv[])
     /*
      * Default values for optional flags - read help message in print_usage()!
      */
-    bool verbose = false;
-    uint16_t threads = 2;
-    const char *db_path = NULL, *music_path = NULL;
+    bool verbose = false, incremental = false, watch = false, taglib = false;
+    bool rebuild = false;
+    uint16_t threads = 2, walkers = 2, batch_size = 256, queue_depth = 0;
+    uint32_t window = 0, time_budget = 0;
+    const char *db_path = NULL;
+    vector<string> music_paths;
 
     try {
         int option_index, c = 0;
-        const char *short_options = "+hvc:";
+        const char *short_options = "+hviRTWc:w:b:q:l:t:";
         struct option const long_options[] = {
             {"help", 0, NULL, 'h'},
             {"verbose", 0, NULL, 'v'},
+            {"incremental", 0, NULL, 'i'},
+            {"rebuild", 0, NULL, 'R'},
+            {"taglib", 0, NULL, 'T'},
+            {"watch", 0, NULL, 'W'},
             {"concurrency", 1, NULL, 'c'},
+            {"walkers", 1, NULL, 'w'},
+            {"batch-size", 1, NULL, 'b'},
+            {"queue-depth", 1, NULL, 'q'},
+            {"locality", 1, NULL, 'l'},
+            {"time-budget", 1, NULL, 't'},
             {NULL, 0, NULL, 0}
         };
 
@@ -69,11 +156,48 @@ int main(int argc, char *argv[])
                 case 'v':
                     verbose = true;
                     break;
+                case 'i':
+                    incremental = true;
+                    break;
+                case 'R':
+                    rebuild = true;
+                    break;
+                case 'T':
+                    taglib = true;
+                    break;
+                case 'W':
+                    watch = true;
+                    break;
                 case 'c': {
                         static const uint16_t min = 1, max = 256;
                         threads = str2int<uint16_t>(optarg, &min, &max);
                     }
                     break;
+                case 'w': {
+                        static const uint16_t min = 1, max = 256;
+                        walkers = str2int<uint16_t>(optarg, &min, &max);
+                    }
+                    break;
+                case 'b': {
+                        static const uint16_t min = 1, max = 65535;
+                        batch_size = str2int<uint16_t>(optarg, &min, &max);
+                    }
+                    break;
+                case 'q': {
+                        static const uint16_t min = 0, max = 4096;
+                        queue_depth = str2int<uint16_t>(optarg, &min, &max);
+                    }
+                    break;
+                case 'l': {
+                        static const uint32_t min = 0, max = 1048576;
+                        window = str2int<uint32_t>(optarg, &min, &max);
+                    }
+                    break;
+                case 't': {
+                        static const uint32_t min = 0, max = 604800; // A week
+                        time_budget = str2int<uint32_t>(optarg, &min, &max);
+                    }
+                    break;
                 case 'h':
                     print_usage(argv[0]);
                     return 1;
@@ -90,14 +214,65 @@ int main(int argc, char *argv[])
     }
 
     db_path = argv[optind++];
-    music_path = argv[optind];
+    music_paths.assign(argv + optind, argv + argc); // Scanned concurrently
+
+    Context c(threads, walkers, batch_size);
+
+    if (rebuild)
+        c.database().rebuild();
+
+    try {
+        c.database().open(db_path);
+    } catch (const exception &e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+
+    if (incremental)
+        c.database().incremental();
+
+    if (taglib)
+        c.database().taglib();
+
+    if (window > 0)
+        c.database().locality(window);
 
-    Context c(threads);
+    if (queue_depth > 0) {
+        c.traverser().asynchronous(queue_depth);
+        c.database().asynchronous(queue_depth);
+    }
+
+    /*
+     * Constructed before scanning as it watches what the scan finds
+     */
+    std::unique_ptr<Watch> w(watch ?
+                             new Watch(c.traverser(), c.database()) :
+                             NULL);
+
+    if (c.database().begin(music_paths))
+        cout << "verbatim: Resuming the interrupted scan\n";
+
+    {
+        Budget b(c, time_budget);
 
-    c.database().open(db_path);
-    c.traverser().scan(music_path);
+        c.traverser().scan(music_paths);
+        c.wait();
+    }
+
+    if (c.database().interrupted())
+        cout << "verbatim: Out of time, run again to resume the scan\n";
+    else {
+        c.database().end();
+        c.database().index_text();
+    }
+
+    if (w && !c.database().interrupted()) {
+        w->run(music_paths);
+
+        c.wait();
+        w->print_metrics(cout);
+    }
 
-    c.wait();
     c.print_metrics(cout);
 
     return 0;